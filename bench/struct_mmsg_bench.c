@@ -0,0 +1,143 @@
+/*
+ * struct_mmsg_bench.c
+ *
+ * messages per second over loopback UDP: one sendto/recvfrom and one
+ * struct_pack/struct_unpack per message versus struct_mmsg_send() and
+ * struct_mmsg_recv() batches.
+ *
+ * usage: struct_mmsg_bench [messages] [batch]
+ */
+
+#define _GNU_SOURCE
+
+#include "struct.h"
+#include "struct_mmsg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define FMT "!IqVd"
+
+struct quote {
+    uint32_t id;
+    int64_t price;
+    uint64_t size;
+    double ts;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_per_call(int rfd, int sfd, struct sockaddr_in *addr,
+        struct quote *in, int batch, long messages)
+{
+    unsigned char buf[64];
+    struct quote out;
+    double start = now();
+    long sent;
+    int len;
+    int i;
+
+    for (sent = 0; sent < messages; sent += batch) {
+        for (i = 0; i < batch; i++) {
+            len = struct_pack(buf, FMT, in[i].id, in[i].price, in[i].size,
+                    in[i].ts);
+            sendto(sfd, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr));
+        }
+        for (i = 0; i < batch; i++) {
+            recvfrom(rfd, buf, sizeof(buf), 0, NULL, NULL);
+            struct_unpack(buf, FMT, &out.id, &out.price, &out.size, &out.ts);
+        }
+    }
+    return messages / (now() - start);
+}
+
+static double bench_mmsg(int rfd, int sfd, struct sockaddr_in *addr,
+        struct quote *in, struct quote *out, int batch, long messages)
+{
+    struct_format *sf = struct_compile(FMT);
+    struct_mmsg *smm = struct_mmsg_new(batch, 64);
+    struct_mmsg *rmm = struct_mmsg_new(batch, 64);
+    double start = now();
+    double rate;
+    long sent;
+    int n;
+    int i;
+
+    for (sent = 0; sent < messages; sent += batch) {
+        struct_mmsg_send(smm, sfd, sf, in, batch,
+                (struct sockaddr *)addr, sizeof(*addr), 0);
+        for (n = 0; n < batch; n += i) {
+            i = struct_mmsg_recv(rmm, rfd, sf, out + n, MSG_WAITFORONE);
+            if (i < 0) {
+                perror("struct_mmsg_recv");
+                exit(1);
+            }
+        }
+    }
+    rate = messages / (now() - start);
+
+    struct_mmsg_free(rmm);
+    struct_mmsg_free(smm);
+    struct_format_free(sf);
+    return rate;
+}
+
+int main(int argc, char *argv[])
+{
+    long messages = (argc > 1) ? atol(argv[1]) : 1000000;
+    int batch = (argc > 2) ? atoi(argv[2]) : 64;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct quote *in = calloc(batch, sizeof(*in));
+    struct quote *out = calloc(batch, sizeof(*out));
+    double per_call;
+    double mmsg;
+    int rfd;
+    int sfd;
+    int i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    rfd = socket(AF_INET, SOCK_DGRAM, 0);
+    sfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (rfd < 0 || sfd < 0 ||
+            bind(rfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            getsockname(rfd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    for (i = 0; i < batch; i++) {
+        in[i].id = i;
+        in[i].price = 1000000 + i;
+        in[i].size = 100 * i;
+        in[i].ts = i / 1000.0;
+    }
+
+    per_call = bench_per_call(rfd, sfd, &addr, in, batch, messages);
+    mmsg = bench_mmsg(rfd, sfd, &addr, in, out, batch, messages);
+
+    printf("messages: %ld, batch: %d\n", messages, batch);
+    printf("per call   : %12.0f msg/s\n", per_call);
+    printf("struct_mmsg: %12.0f msg/s (x%.2f)\n", mmsg, mmsg / per_call);
+
+    close(rfd);
+    close(sfd);
+    free(in);
+    free(out);
+    return 0;
+}
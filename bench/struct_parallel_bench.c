@@ -0,0 +1,100 @@
+/*
+ * struct_parallel_bench.c
+ *
+ * struct_pack_records_parallel() scaling from 1 to N threads, for a fixed
+ * size format and a varint format.
+ *
+ * usage: struct_parallel_bench [records] [max threads]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "struct.h"
+#include "struct_parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct record {
+    uint32_t id;
+    int64_t v;
+    uint64_t V;
+    double d;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *fmt, const struct record *records, long n,
+        int max_threads)
+{
+    struct_format *sf = struct_compile(fmt);
+    size_t bufsize = (size_t)n * struct_format_calcsize(sf);
+    unsigned char *seq = malloc(bufsize);
+    unsigned char *par = malloc(bufsize);
+    double start;
+    double base = 0;
+    double t;
+    long len = 0;
+    long i;
+    int nthreads;
+
+    /* fault the pages in before timing */
+    memset(seq, 0, bufsize);
+    memset(par, 0, bufsize);
+
+    start = now();
+    for (i = 0; i < n; i++) {
+        len += struct_format_pack_record(sf, seq + len, &records[i]);
+    }
+    base = now() - start;
+    printf("%s: %ld records, %ld bytes\n", fmt, n, len);
+    printf("  sequential : %8.3f s %10.0f rec/s\n", base, n / base);
+
+    for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        start = now();
+        if (struct_pack_records_parallel(sf, par, records, n, nthreads) != len
+                || memcmp(seq, par, len) != 0) {
+            printf("  %2d threads : output differs\n", nthreads);
+            exit(1);
+        }
+        t = now() - start;
+        printf("  %2d threads : %8.3f s %10.0f rec/s (x%.2f)\n",
+                nthreads, t, n / t, base / t);
+    }
+
+    free(seq);
+    free(par);
+    struct_format_free(sf);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1) ? atol(argv[1]) : 4000000;
+    int max_threads = (argc > 2) ? atoi(argv[2])
+        : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    struct record *records = malloc(n * sizeof(*records));
+    long i;
+
+    for (i = 0; i < n; i++) {
+        records[i].id = i;
+        records[i].v = (i % 2) ? -i : i * 1000;
+        records[i].V = (uint64_t)i * i;
+        records[i].d = i / 7.0;
+    }
+
+    bench("!IqQd", records, n, max_threads);
+    bench("!IvVd", records, n, max_threads);
+
+    free(records);
+    return 0;
+}
@@ -19,6 +19,8 @@
  *   >        | big-endian
  *  ----------+-----------------------
  *   !        | network (= big-endian)
+ *  ----------+-----------------------
+ *   ^        | order preserving
  *  ----------------------------------
  *
  * Table 2. Format characters
@@ -68,6 +70,26 @@
  * string, not a repeat count like for the other format characters.
  * For example, '10s' means a single 10-byte string.
  *
+ * A format character (with its repeat count) may be preceded by '?' to make
+ * it optional. A message with optional fields starts with a presence bitmap,
+ * one bit per '?' (bit i % 8 of byte i / 8 for the i-th one), and an absent
+ * field takes no space. struct_pack() takes an 'int' presence flag before
+ * the arguments of an optional field, which are passed (and ignored) even
+ * when it is absent. struct_unpack() takes an 'int *' (may be NULL), set to
+ * the presence flag, before the destinations of an optional field, which
+ * are left untouched when it is absent. struct_calcsize() counts every
+ * optional field as present. Compiled formats do not support '?'.
+ *
+ * A destination of struct_unpack() may be NULL to skip its field: fixed
+ * size fields are stepped over and varints are only scanned for their
+ * last byte.
+ *
+ * The '^' byte order packs big-endian with the sign bit of signed integers
+ * flipped, and the sign bit of non-negative floats (all bits of negative
+ * ones) flipped, so that packed keys sort with memcmp() in the order of
+ * their values. Unsigned integers and strings are plain big-endian;
+ * varints do not keep order.
+ *
  * Example 1. pack/unpack int type value.
  *
  * char buf[BUFSIZ] = {0, };
@@ -90,6 +112,26 @@
  * struct_pack(buf, fmt, str);
  * struct_unpack(buf, fmt, ostr);
  *
+ * Example 3. unpack a string without copying it.
+ *
+ * const char *view;
+ *
+ * struct_unpack_view(buf, fmt, &view);
+ * // view points into buf and holds strlen(str) bytes (no terminating NUL).
+ *
+ * Example 4. optional fields.
+ *
+ * int has_name;
+ *
+ * struct_pack(buf, "!I?16s?d", id, 0, "", 1, price);
+ * // 1 byte of bitmap, 4 bytes of id, 8 bytes of price
+ * struct_unpack(buf, "!I?16s?d", &id, &has_name, name, NULL, &price);
+ * // has_name == 0 and name is untouched
+ *
+ * Example 5. unpack only some fields.
+ *
+ * struct_unpack(buf, "!IVd16s", NULL, NULL, &price, NULL);
+ *
  */
 
 #ifdef __cplusplus
@@ -124,6 +166,90 @@ extern int struct_unpack_from(
     const char *fmt,
     ...);
 
+/**
+ * @brief unpack data, returning string fields by reference
+ * @return the number of bytes decoded on success, -1 on failure.
+ *
+ * same as struct_unpack(), except that each 's' or 'p' field takes a
+ * 'const char **' which is set to the start of the field inside buf.
+ * the length of the field is its count in the format string and the
+ * field is not NUL terminated. the pointers are valid as long as buf is.
+ */
+extern int struct_unpack_view(const void *buf, const char *fmt, ...);
+
+/**
+ * @brief unpack data with offset, returning string fields by reference
+ * @return the number of bytes decoded on success, -1 on failure.
+ *
+ * see struct_unpack_view().
+ */
+extern int struct_unpack_view_from(
+    int offset,
+    const void *buf,
+    const char *fmt,
+    ...);
+
+/**
+ * @brief pack data into a buffer of size bytes
+ * @return the number of bytes encoded on success, -1 on failure (or if
+ * size is negative). if the message does not fit, the size it needs is
+ * returned (more than size) and the content of buf is unspecified.
+ *
+ * the room left is checked once per run of fixed size fields and once
+ * per varint, without parsing the format twice.
+ */
+extern int struct_pack_checked(void *buf, int size, const char *fmt, ...);
+
+/**
+ * @brief pack data with offset into a buffer of size bytes
+ * @return see struct_pack_checked(); sizes count from buf, not from
+ * offset, and -1 is returned if offset is not within size.
+ */
+extern int struct_pack_into_checked(
+    int offset,
+    void *buf,
+    int size,
+    const char *fmt,
+    ...);
+
+/**
+ * @brief unpack data from a buffer of size bytes
+ * @return the number of bytes decoded on success, -1 on failure (or if
+ * size is negative, or a varint does not end within 10 bytes). if the
+ * message is cut short, a lower bound of the bytes it needs is returned,
+ * more than size: up to the end of the first fixed size field which does
+ * not fit, or size + 1 for a varint cut short. the destinations of the
+ * fields before it are set.
+ */
+extern int struct_unpack_checked(
+    const void *buf,
+    int size,
+    const char *fmt,
+    ...);
+
+/**
+ * @brief unpack data with offset from a buffer of size bytes
+ * @return see struct_unpack_checked(); sizes count from buf, not from
+ * offset, and -1 is returned if offset is not within size.
+ */
+extern int struct_unpack_from_checked(
+    int offset,
+    const void *buf,
+    int size,
+    const char *fmt,
+    ...);
+
+/**
+ * @brief check that the len bytes at buf hold a whole message of fmt
+ * @return the length of the message on success, -1 if it is longer than
+ * len bytes, has a varint which does not end within 10 bytes, or fmt is
+ * invalid.
+ *
+ * nothing is decoded: a message which passes may be unpacked without
+ * reading past len bytes.
+ */
+extern int struct_validate(const char *fmt, const void *buf, int len);
+
 /**
  * @brief calculate the size of a format string
  * @return the number of bytes needed by the format string on success,
@@ -133,6 +259,379 @@ extern int struct_unpack_from(
  */
 extern int struct_calcsize(const char *fmt);
 
+/**
+ * @brief calculate the exact size of a message
+ * @return the number of bytes struct_pack() encodes for the same
+ * arguments on success, -1 on failure.
+ *
+ * unlike struct_calcsize(), varints are counted by their values and
+ * absent optional fields are not counted.
+ */
+extern int struct_calcsize_values(const char *fmt, ...);
+
+/*
+ * Resumable decoder
+ *
+ * a decoder unpacks one message whose bytes arrive in several chunks
+ * (e.g. from a stream socket). it never reads past the chunk it is given
+ * and resumes in the middle of a field, varints included.
+ *
+ * Example 6. decode a message as it arrives.
+ *
+ * int32_t id;
+ * uint64_t seq;
+ * struct_decoder *dec = struct_decoder_new("!iV", &id, &seq);
+ *
+ * while (struct_decoder_needed(dec) > 0) {
+ *     n = recv(fd, chunk, sizeof(chunk), 0);
+ *     used = struct_decoder_feed(dec, chunk, n);
+ *     // chunk + used is the start of the next message, if any.
+ * }
+ * struct_decoder_free(dec);
+ */
+typedef struct struct_decoder struct_decoder;
+
+/**
+ * @brief create a decoder
+ * @return a decoder on success, NULL on failure.
+ *
+ * takes the same arguments as struct_unpack(), except the buffer.
+ * the destinations are written as each field completes; a NULL one
+ * skips its field.
+ */
+extern struct_decoder *struct_decoder_new(const char *fmt, ...);
+
+/**
+ * @brief feed a chunk of data to a decoder
+ * @return the number of bytes consumed.
+ *
+ * stops at the end of the message, so less than len bytes are consumed
+ * when the chunk also holds the start of the next message.
+ */
+extern int struct_decoder_feed(struct_decoder *dec, const void *data, int len);
+
+/**
+ * @brief the number of bytes needed to complete the message
+ * @return 0 when the message is complete, otherwise the number of bytes
+ * still needed. the number is exact for fixed size fields and counts a
+ * single byte for each pending varint, so it is a lower bound when the
+ * message has varints.
+ */
+extern int struct_decoder_needed(const struct_decoder *dec);
+
+/**
+ * @brief restart a decoder to decode the next message into the same
+ * destinations.
+ */
+extern void struct_decoder_reset(struct_decoder *dec);
+
+/**
+ * @brief destroy a decoder
+ */
+extern void struct_decoder_free(struct_decoder *dec);
+
+/*
+ * Resumable packer
+ *
+ * a packer packs one message into a series of bounded windows (e.g.
+ * fixed size transport slots). when a window is full it stops, in the
+ * middle of a field if necessary, and continues in the next window.
+ *
+ * Example 7. pack a message into 4 KiB slots.
+ *
+ * struct_packer *pk = struct_packer_new("!i4096sV", id, payload, seq);
+ *
+ * while (struct_packer_remaining(pk) > 0) {
+ *     slot = next_slot();
+ *     used = struct_packer_pack(pk, slot, 4096);
+ * }
+ * struct_packer_free(pk);
+ */
+typedef struct struct_packer struct_packer;
+
+/**
+ * @brief create a packer
+ * @return a packer on success, NULL on failure.
+ *
+ * takes the same arguments as struct_pack(), except the buffer.
+ * the values are copied, but the strings of 's' and 'p' fields are read
+ * when they are packed and must stay valid until then.
+ */
+extern struct_packer *struct_packer_new(const char *fmt, ...);
+
+/**
+ * @brief pack as much of the message as fits into a window
+ * @return the number of bytes written into the window.
+ */
+extern int struct_packer_pack(struct_packer *pk, void *window, int size);
+
+/**
+ * @brief the number of bytes of the message not packed yet
+ * @return 0 when the message is complete, otherwise the exact number of
+ * bytes left to pack.
+ */
+extern int struct_packer_remaining(const struct_packer *pk);
+
+/**
+ * @brief restart a packer to pack the same message again.
+ */
+extern void struct_packer_reset(struct_packer *pk);
+
+/**
+ * @brief destroy a packer
+ */
+extern void struct_packer_free(struct_packer *pk);
+
+/*
+ * Compiled format
+ *
+ * a format string compiled once by struct_compile() is packed and
+ * unpacked without parsing it again.
+ *
+ * every argument of struct_pack() is a field. a record is a C struct with
+ * one member per field, in format order, of the type struct_unpack()
+ * takes for it ('s' and 'p' fields are char arrays of their count),
+ * laid out by the usual alignment rules. 'x' has no member.
+ *
+ * Example 8. records of "!hV4sd".
+ *
+ * struct rec {
+ *     int16_t h;
+ *     uint64_t V;
+ *     char s[4];
+ *     double d;
+ * };
+ *
+ * struct_format *sf = struct_compile("!hV4sd");
+ * // struct_format_record_size(sf) == sizeof(struct rec)
+ *
+ * struct_format_pack_record(sf, buf, &rec);
+ * struct_format_unpack_record(sf, buf, &rec);
+ * struct_format_free(sf);
+ */
+typedef struct struct_format struct_format;
+
+/**
+ * @brief compile a format string
+ * @return a compiled format on success, NULL on failure.
+ */
+extern struct_format *struct_compile(const char *fmt);
+
+/**
+ * @brief destroy a compiled format
+ */
+extern void struct_format_free(struct_format *sf);
+
+/**
+ * @brief calculate the size of a compiled format
+ * @return the same value as struct_calcsize().
+ */
+extern int struct_format_calcsize(const struct_format *sf);
+
+/**
+ * @brief whether a compiled format has a fixed size
+ * @return 1 if the format has no varints (every message has the size
+ * struct_format_calcsize()), 0 otherwise.
+ */
+extern int struct_format_is_fixed(const struct_format *sf);
+
+/**
+ * @brief calculate the exact size of a packed record
+ * @return the number of bytes struct_format_pack_record() encodes for
+ * record.
+ */
+extern int struct_format_calcsize_record(
+    const struct_format *sf,
+    const void *record);
+
+/**
+ * @brief calculate the exact size of a message with a compiled format
+ * @return the number of bytes struct_format_pack() encodes for the same
+ * arguments.
+ */
+extern int struct_format_calcsize_values(const struct_format *sf, ...);
+
+/**
+ * @brief calculate the exact size of an array of records packed back to
+ * back
+ * @return the sum of struct_format_calcsize_record() over count records.
+ */
+extern long struct_format_calcsize_records(
+    const struct_format *sf,
+    const void *records,
+    long count);
+
+/**
+ * @brief measure the packed message at buf without decoding it
+ * @return the length of the message, -1 if it is longer than len bytes
+ * or has a varint which does not end within 10 bytes.
+ */
+extern int struct_format_length(
+    const struct_format *sf,
+    const void *buf,
+    int len);
+
+/**
+ * @brief check that the len bytes at buf hold count messages packed back
+ * to back
+ * @return the length of the messages on success, -1 if one of them is
+ * malformed (see struct_format_length()) or they are longer than len
+ * bytes.
+ */
+extern long struct_format_validate(
+    const struct_format *sf,
+    const void *buf,
+    long len,
+    long count);
+
+/**
+ * @brief the number of fields (arguments) of a compiled format
+ */
+extern int struct_format_nfields(const struct_format *sf);
+
+/**
+ * @brief the size of the record of a compiled format
+ */
+extern int struct_format_record_size(const struct_format *sf);
+
+/**
+ * @brief pack data with a compiled format
+ * @return the number of bytes encoded.
+ *
+ * takes the same arguments as struct_pack().
+ */
+extern int struct_format_pack(const struct_format *sf, void *buf, ...);
+
+/**
+ * @brief unpack data with a compiled format
+ * @return the number of bytes decoded.
+ *
+ * takes the same arguments as struct_unpack().
+ */
+extern int struct_format_unpack(const struct_format *sf, const void *buf, ...);
+
+/**
+ * @brief pack a record with a compiled format
+ * @return the number of bytes encoded.
+ */
+extern int struct_format_pack_record(
+    const struct_format *sf,
+    void *buf,
+    const void *record);
+
+/**
+ * @brief unpack a record with a compiled format
+ * @return the number of bytes decoded.
+ */
+extern int struct_format_unpack_record(
+    const struct_format *sf,
+    const void *buf,
+    void *record);
+
+/**
+ * @brief unpack the fields of a record selected by mask
+ * @return the number of bytes decoded.
+ *
+ * field i is unpacked when bit i % 8 of byte i / 8 of mask is set; the
+ * members of the other fields are left untouched.
+ */
+extern int struct_format_unpack_fields(
+    const struct_format *sf,
+    const void *buf,
+    void *record,
+    const unsigned char *mask);
+
+/**
+ * @brief find field index of the packed message at buf without decoding
+ * the fields before it
+ * @return the offset of the field in buf, -1 if there is no such field.
+ */
+extern int struct_format_offset(
+    const struct_format *sf,
+    const void *buf,
+    int index);
+
+/*
+ * Delta patches
+ *
+ * a patch holds the fields which differ between two messages of a
+ * compiled format: a bitmap of (nfields + 7) / 8 bytes, where bit i % 8
+ * of byte i / 8 is set when field i changed, followed by the packed
+ * changed fields in order. a patch is at most that bitmap plus
+ * struct_format_calcsize() bytes long.
+ *
+ * Example 9. replicate a record.
+ *
+ * len = struct_format_diff(sf, last, current, patch);
+ * send(fd, patch, len, 0);
+ * // on the replica
+ * struct_format_patch(sf, replica, sizeof(replica), patch, len);
+ */
+
+/**
+ * @brief encode the fields of the packed message to that differ from
+ * those of the packed message from
+ * @return the length of the patch.
+ */
+extern int struct_format_diff(
+    const struct_format *sf,
+    const void *from,
+    const void *to,
+    void *patch);
+
+/**
+ * @brief apply a patch of patch_len bytes to the packed message in buf,
+ * in place
+ * @return the length of the patched message on success, -1 if buf does
+ * not hold a whole message, the patch is truncated or holds a varint
+ * longer than 10 bytes, or the patched message does not fit in size
+ * bytes (buf is then left unchanged).
+ *
+ * the fields after a varint which changes length are moved. nothing is
+ * written past size bytes, even while varints grow and others shrink.
+ */
+extern int struct_format_patch(
+    const struct_format *sf,
+    void *buf,
+    int size,
+    const void *patch,
+    int patch_len);
+
+/*
+ * Transcoding
+ *
+ * messages packed with one format are converted into messages packed
+ * with another one, field by field, without going through the caller.
+ * integer fields convert to any integer or varint field, 'f' and 'd'
+ * convert to each other, and 's'/'p' fields are cut or padded with
+ * zeros. pad bytes ('x') are dropped and written as zeros.
+ *
+ * Example 10. big-endian varint feed to a little-endian fixed layout.
+ *
+ * len = struct_transcode("!VVqd", "<QQqd", feed, out, nrecords);
+ */
+
+/**
+ * @brief convert count messages packed back to back with src_fmt into
+ * messages packed with dst_fmt
+ * @return the number of bytes written to dst on success, -1 if the
+ * formats are invalid or their fields do not pair up.
+ *
+ * a number which does not fit its destination field is truncated the
+ * way struct_pack() truncates it, and errno is set to ERANGE (set errno
+ * to 0 before the call to detect it).
+ *
+ * when neither format has varints and every pair of fields has the same
+ * size and signedness, a message is converted by a precomputed byte
+ * shuffle.
+ */
+extern long struct_transcode(
+    const char *src_fmt,
+    const char *dst_fmt,
+    const void *src,
+    void *dst,
+    long count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,112 @@
+#ifndef STRUCT_LOG_INCLUDED
+#define STRUCT_LOG_INCLUDED
+/*
+ * struct_log.h
+ *
+ * Multi-producer append log of packed records
+ *
+ * any number of threads append records to one shared region without a
+ * lock: a producer reserves the exact space of its record with a single
+ * atomic fetch-add, packs the record in place and commits it by storing
+ * its length word. readers walk the log from the beginning and stop at
+ * the first record which is not committed yet, so they only ever see
+ * complete records.
+ *
+ * each record takes its length plus an 8 byte header, rounded up to 8
+ * bytes. the log does not wrap: once it is full, reservations fail until
+ * it is reset.
+ *
+ * Example 1. producer threads.
+ *
+ * void *slot = struct_log_reserve(log, struct_calcsize("!IV"));
+ * if (slot != NULL) {
+ *     struct_log_commit(log, slot, struct_pack(slot, "!IV", id, seq));
+ * }
+ *
+ * or simply struct_log_pack(log, "!IV", id, seq).
+ *
+ * Example 2. reader thread.
+ *
+ * long pos = 0;
+ * while ((rec = struct_log_next(log, &pos, &len)) != NULL) {
+ *     struct_unpack(rec, "!IV", &id, &seq);
+ * }
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct struct_log struct_log;
+
+/**
+ * @brief create a log of capacity bytes
+ * @return a log on success, NULL on failure.
+ */
+extern struct_log *struct_log_new(long capacity);
+
+/**
+ * @brief destroy a log
+ */
+extern void struct_log_free(struct_log *log);
+
+/**
+ * @brief reserve size bytes at the end of the log
+ * @return the slot, NULL if the log is full.
+ *
+ * every reserved slot must be committed, readers stop at it until it is.
+ */
+extern void *struct_log_reserve(struct_log *log, int size);
+
+/**
+ * @brief commit a slot returned by struct_log_reserve(), holding len bytes
+ * (at most the reserved size).
+ */
+extern void struct_log_commit(struct_log *log, void *slot, int len);
+
+/**
+ * @brief reserve, pack and commit a record. the reservation is the exact
+ * size of the values (see struct_calcsize_values()).
+ * @return the number of bytes encoded, 0 if the log is full,
+ * -1 on failure.
+ */
+extern int struct_log_pack(struct_log *log, const char *fmt, ...);
+
+/**
+ * @brief reserve, pack and commit a record (see struct_compile()).
+ * the size of a fixed format is known up front, so the reservation is a
+ * single fetch-add.
+ * @return see struct_log_pack().
+ */
+extern int struct_log_pack_record(
+    struct_log *log,
+    const struct_format *sf,
+    const void *record);
+
+/**
+ * @brief the committed record at *pos (0 for the first one)
+ * @return the record, NULL if there is none (yet). its length is stored
+ * in *len and *pos is advanced to the next record.
+ */
+extern const void *struct_log_next(
+    const struct_log *log,
+    long *pos,
+    int *len);
+
+/**
+ * @brief the number of bytes reserved so far
+ */
+extern long struct_log_size(const struct_log *log);
+
+/**
+ * @brief empty the log. no producer nor reader may use it meanwhile.
+ */
+extern void struct_log_reset(struct_log *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_LOG_INCLUDED */
@@ -0,0 +1,110 @@
+#ifndef STRUCT_MERGE_INCLUDED
+#define STRUCT_MERGE_INCLUDED
+/*
+ * struct_merge.h
+ *
+ * External sort of packed record files
+ *
+ * the records of a file are packed back to back with a compiled format
+ * (see struct_compile()), fixed or variable size, and sorted by one of
+ * their fields in two steps, each of them in bounded memory:
+ *
+ * - struct_make_runs() reads the input into a memory budget at a time,
+ *   sorts it and writes it out as a sorted run,
+ * - struct_merge_runs() streams sorted runs through buffered readers and
+ *   merges them by key with a loser tree: one comparison per level of
+ *   the tree for each record.
+ *
+ * integer, varint and float keys compare as numbers, 's' and 'p' keys as
+ * bytes (memcmp()). records of equal keys keep the order of their runs,
+ * so the sort is stable.
+ *
+ * Example 1. sort a file much larger than memory with 256 MB.
+ *
+ * static int open_run(void *arg)
+ * {
+ *     return open((const char *)arg, O_TMPFILE | O_RDWR, 0600);
+ * }
+ *
+ * struct_format *sf = struct_compile("!QVd16s");
+ *
+ * n = struct_external_sort(sf, 0, in_fd, out_fd, 256L << 20, 1 << 20,
+ *                          open_run, "/var/tmp");
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * open a new empty run file for reading and writing.
+ * returns its file descriptor, -1 on failure.
+ */
+typedef int (*struct_run_opener)(void *arg);
+
+/**
+ * @brief cut the records of in_fd into sorted runs
+ * @return the number of runs on success, -1 on failure.
+ *
+ * the records are read until the end of in_fd, memory bytes at a time
+ * (records and their sort index), sorted by the field key (an argument of
+ * struct_pack()) and written to a run opened with open_run(arg). bufsize
+ * is the size of the buffer of each reader and writer.
+ *
+ * on success *runs is set to a malloc()ed array of the run descriptors,
+ * rewound to their beginning, to be closed and released with free() by
+ * the caller. on failure the runs are closed.
+ */
+extern long struct_make_runs(
+    const struct_format *sf,
+    int key,
+    int in_fd,
+    long memory,
+    int bufsize,
+    struct_run_opener open_run,
+    void *arg,
+    int **runs);
+
+/**
+ * @brief merge sorted runs into out_fd
+ * @return the number of records written on success, -1 on failure (a
+ * bad key, a failed read or write, or a malformed or truncated record).
+ *
+ * each run is read from its current offset to its end through a buffer
+ * of bufsize bytes; the output is written through another one.
+ */
+extern long struct_merge_runs(
+    const struct_format *sf,
+    int key,
+    const int *runs,
+    int nruns,
+    int out_fd,
+    int bufsize);
+
+/**
+ * @brief sort the records of in_fd into out_fd
+ * @return the number of records written on success, -1 on failure.
+ *
+ * struct_make_runs(), then struct_merge_runs() in as many passes as
+ * needed to merge at most memory / bufsize - 1 runs at once: each pass
+ * merges groups of adjacent runs, so that n runs take about
+ * log(n) / log(fan-in) passes over the data. the runs of an intermediate
+ * pass are opened with open_run(arg) too. every run is closed on return.
+ */
+extern long struct_external_sort(
+    const struct_format *sf,
+    int key,
+    int in_fd,
+    int out_fd,
+    long memory,
+    int bufsize,
+    struct_run_opener open_run,
+    void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_MERGE_INCLUDED */
@@ -0,0 +1,99 @@
+#ifndef STRUCT_MMSG_INCLUDED
+#define STRUCT_MMSG_INCLUDED
+/*
+ * struct_mmsg.h
+ *
+ * Batched datagram pack/unpack (Linux)
+ *
+ * struct_mmsg_recv() receives up to vlen datagrams with a single
+ * recvmmsg(2) into preallocated buffers and unpacks each of them into a
+ * record (see struct_compile()). struct_mmsg_send() packs up to vlen
+ * records and sends them with a single sendmmsg(2).
+ *
+ * Example 1. receive a batch of quotes.
+ *
+ * struct quote {
+ *     uint32_t id;
+ *     int64_t price;
+ *     uint64_t size;
+ * } quotes[64];
+ *
+ * struct_format *sf = struct_compile("!IqV");
+ * struct_mmsg *mm = struct_mmsg_new(64, 1500);
+ *
+ * n = struct_mmsg_recv(mm, fd, sf, quotes, MSG_WAITFORONE);
+ * for (i = 0; i < n; i++) {
+ *     if (struct_mmsg_length(mm, i) >= 0) {
+ *         handle(&quotes[i]);
+ *     }
+ * }
+ */
+
+#include "struct.h"
+
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct struct_mmsg struct_mmsg;
+
+/**
+ * @brief create vlen datagram buffers of bufsize bytes each
+ * @return a batch on success, NULL on failure.
+ */
+extern struct_mmsg *struct_mmsg_new(int vlen, int bufsize);
+
+/**
+ * @brief destroy a batch
+ */
+extern void struct_mmsg_free(struct_mmsg *mm);
+
+/**
+ * @brief receive and unpack up to vlen datagrams
+ * @return the number of datagrams received on success, -1 on failure
+ * (errno is set).
+ *
+ * datagram i is unpacked into the i-th record of records.
+ * flags are passed to recvmmsg(2) (e.g. MSG_WAITFORONE, MSG_DONTWAIT).
+ * bufsize must be at least struct_format_calcsize(sf).
+ */
+extern int struct_mmsg_recv(
+    struct_mmsg *mm,
+    int fd,
+    const struct_format *sf,
+    void *records,
+    int flags);
+
+/**
+ * @brief the length of datagram i of the last struct_mmsg_recv()
+ * @return the length in bytes, -1 if the datagram was shorter than its
+ * encoding (or truncated), in which case its record must be ignored.
+ */
+extern int struct_mmsg_length(const struct_mmsg *mm, int i);
+
+/**
+ * @brief pack and send up to vlen records
+ * @return the number of datagrams sent on success, -1 on failure
+ * (errno is set).
+ *
+ * one datagram is sent per record, to addr if it is not NULL.
+ * at most vlen records are sent, so callers with more records call it
+ * again with the rest.
+ */
+extern int struct_mmsg_send(
+    struct_mmsg *mm,
+    int fd,
+    const struct_format *sf,
+    const void *records,
+    int nrecords,
+    const struct sockaddr *addr,
+    socklen_t addrlen,
+    int flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_MMSG_INCLUDED */
@@ -0,0 +1,82 @@
+#ifndef STRUCT_PARALLEL_INCLUDED
+#define STRUCT_PARALLEL_INCLUDED
+/*
+ * struct_parallel.h
+ *
+ * Multi-threaded batch operations on compiled formats
+ *
+ * the records are split into nthreads contiguous chunks, one per thread
+ * (the calling thread takes the first one). the result is the same as
+ * the sequential loop over struct_format_pack_record().
+ *
+ * Example 1. pack 100M records on 8 threads.
+ *
+ * struct_format *sf = struct_compile("!IvVd");
+ * char *buf = malloc(n * struct_format_calcsize(sf));
+ *
+ * len = struct_pack_records_parallel(sf, buf, records, n, 8);
+ *
+ * Example 2. index the records of a packed stream on 8 threads.
+ *
+ * long *offsets;
+ * long n = struct_index_records_parallel(sf, buf, len, &offsets, 8);
+ *
+ * struct_format_unpack_record(sf, buf + offsets[n / 2], &record);
+ * free(offsets);
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief pack an array of records (see struct_compile()) into one
+ * contiguous buffer using nthreads threads
+ * @return the number of bytes encoded on success, -1 on failure.
+ *
+ * buf must hold the packed records: nrecords * struct_format_calcsize(sf)
+ * bytes are always enough.
+ *
+ * the records of a fixed size format are placed at multiples of the
+ * format size. otherwise each thread first sums the exact sizes of its
+ * records, the sums are turned into chunk offsets by a prefix sum and
+ * each thread then packs its chunk at its offset.
+ */
+extern long struct_pack_records_parallel(
+    const struct_format *sf,
+    void *buf,
+    const void *records,
+    long nrecords,
+    int nthreads);
+
+/**
+ * @brief find the start of every record of a packed stream using
+ * nthreads threads
+ * @return the number of records on success, -1 on failure.
+ *
+ * buf holds len bytes of records packed back to back with sf. on success
+ * *offsets is set to a malloc()ed array of the offset of each record,
+ * to be released with free(). indexing stops at the first record which
+ * is truncated or malformed (see struct_format_length()). a format of
+ * size 0, such as "", is rejected.
+ *
+ * each thread parses its chunk speculatively, as if a record started at
+ * the beginning of the chunk. the chunks are then stitched together: the
+ * true record starts are parsed from the end of the previous chunk until
+ * they meet a start found by the speculative parse, after which the rest
+ * of the chunk is known to be right.
+ */
+extern long struct_index_records_parallel(
+    const struct_format *sf,
+    const void *buf,
+    long len,
+    long **offsets,
+    int nthreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_PARALLEL_INCLUDED */
@@ -0,0 +1,94 @@
+#ifndef STRUCT_PARTITION_INCLUDED
+#define STRUCT_PARTITION_INCLUDED
+/*
+ * struct_partition.h
+ *
+ * Hash-partitioned packing of records
+ *
+ * each record (see struct_compile()) is packed straight into the shard
+ * its key field hashes to, instead of being packed into a scratch buffer
+ * and copied. the shards are growable buffers which keep their contents
+ * across calls.
+ *
+ * in STRUCT_PARTITION_EXACT mode a first pass computes the partition and
+ * packed size of every record, so each shard grows once to its exact
+ * size before the records are packed.
+ *
+ * Example 1. shuffle records by their first field into 16 shards.
+ *
+ * struct struct_shard shards[16] = { { 0 } };
+ * struct_format *sf = struct_compile("!QvVd");
+ *
+ * struct_pack_partitioned(sf, 0, records, n, shards, 16,
+ *                         STRUCT_PARTITION_EXACT);
+ * for (i = 0; i < 16; i++) {
+ *     send(fds[i], shards[i].buf, shards[i].len, 0);
+ * }
+ * struct_shards_free(shards, 16);
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * a growable output buffer.
+ */
+struct struct_shard {
+    unsigned char *buf;
+    long len;                   /* bytes packed */
+    long cap;                   /* bytes allocated */
+    long count;                 /* records packed */
+};
+
+/*
+ * struct_pack_partitioned() modes
+ *
+ * STRUCT_PARTITION_GROW:  shards grow geometrically as records come.
+ * STRUCT_PARTITION_EXACT: a histogram pass sizes every shard exactly.
+ */
+#define STRUCT_PARTITION_GROW   0
+#define STRUCT_PARTITION_EXACT  1
+
+/**
+ * @brief the partition of a record
+ * @return the partition in [0, nparts), -1 on failure.
+ *
+ * key is the index of the key field (an argument of struct_pack()),
+ * which may be any field but a pad byte.
+ */
+extern int struct_partition_of(
+    const struct_format *sf,
+    int key,
+    const void *record,
+    int nparts);
+
+/**
+ * @brief pack an array of records, each one appended to shards[p] where
+ * p is struct_partition_of() the record
+ * @return 0 on success, -1 on failure.
+ *
+ * the shards must be zeroed before their first use. on failure, the
+ * shards hold the records packed so far.
+ */
+extern int struct_pack_partitioned(
+    const struct_format *sf,
+    int key,
+    const void *records,
+    long nrecords,
+    struct struct_shard *shards,
+    int nparts,
+    int mode);
+
+/**
+ * @brief release the buffers of shards and zero them
+ */
+extern void struct_shards_free(struct struct_shard *shards, int nparts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_PARTITION_INCLUDED */
@@ -0,0 +1,101 @@
+#ifndef STRUCT_POOL_INCLUDED
+#define STRUCT_POOL_INCLUDED
+/*
+ * struct_pool.h
+ *
+ * Pool of output buffers
+ *
+ * buffers are grouped in power-of-two size classes. each thread keeps a
+ * cache of free buffers per class, which it uses without locking; when a
+ * cache runs empty or overflows, half of it is exchanged with a global
+ * depot guarded by a mutex. only a miss in both goes to malloc(3).
+ *
+ * Example 1. pack a message into a pooled buffer.
+ *
+ * buf = struct_pool_pack(pool, &len, "!IV", id, seq);
+ * send(fd, buf, len, 0);
+ * struct_pool_release(pool, buf);
+ *
+ * Example 2. pack a record (see struct_compile()).
+ *
+ * buf = struct_pool_pack_record(pool, sf, &rec, &len);
+ * ...
+ * struct_pool_release(pool, buf);
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct struct_pool struct_pool;
+
+struct struct_pool_stats {
+    long acquired;              /* buffers of pooled sizes acquired */
+    long cache_hits;            /* served by the thread cache */
+    long depot_hits;            /* served by the depot */
+    long allocated;             /* served by malloc(3) */
+    long held;                  /* bytes of free buffers held by the pool */
+};
+
+/**
+ * @brief create a pool
+ * @return a pool on success, NULL on failure.
+ *
+ * max_size is the size of the largest class (from 64 bytes up), larger
+ * buffers are not pooled. each thread caches at most cache buffers
+ * per class.
+ */
+extern struct_pool *struct_pool_new(int max_size, int cache);
+
+/**
+ * @brief destroy a pool and every free buffer it holds. no thread may
+ * use the pool meanwhile.
+ */
+extern void struct_pool_free(struct_pool *pool);
+
+/**
+ * @brief a buffer of at least size bytes
+ * @return the buffer, NULL on failure.
+ */
+extern void *struct_pool_acquire(struct_pool *pool, int size);
+
+/**
+ * @brief give a buffer back to the pool (from any thread)
+ */
+extern void struct_pool_release(struct_pool *pool, void *buf);
+
+/**
+ * @brief acquire a buffer sized by struct_calcsize() and pack into it
+ * @return the buffer, NULL on failure. the number of bytes encoded is
+ * stored in *len.
+ */
+extern void *struct_pool_pack(
+    struct_pool *pool,
+    int *len,
+    const char *fmt, ...);
+
+/**
+ * @brief acquire a buffer sized for a record (see struct_compile()) and
+ * pack it into it
+ * @return see struct_pool_pack().
+ */
+extern void *struct_pool_pack_record(
+    struct_pool *pool,
+    const struct_format *sf,
+    const void *record,
+    int *len);
+
+/**
+ * @brief the statistics of a pool, summed over every thread
+ */
+extern void struct_pool_stats(
+    struct_pool *pool,
+    struct struct_pool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_POOL_INCLUDED */
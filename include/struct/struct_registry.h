@@ -0,0 +1,118 @@
+#ifndef STRUCT_REGISTRY_INCLUDED
+#define STRUCT_REGISTRY_INCLUDED
+/*
+ * struct_registry.h
+ *
+ * Tag-based dispatch of mixed messages
+ *
+ * every message starts with a tag, an integer packed with the tag format
+ * of the registry, followed by a body packed with the format registered
+ * for the tag. the formats are compiled once when registered (see
+ * struct_compile()); tags below 256 are looked up in a dense table and
+ * the others in a hash table.
+ *
+ * struct_registry_dispatch() decodes every message of a buffer into the
+ * record of its format and calls the handler registered for its tag.
+ * a registry must not be used by several threads at the same time.
+ *
+ * Example 1. a type byte followed by one of two messages.
+ *
+ * struct_registry *reg = struct_registry_new("B");
+ *
+ * struct_registry_add(reg, 1, "!IV", on_login, ctx);
+ * struct_registry_add(reg, 2, "!I16s", on_chat, ctx);
+ *
+ * ret = struct_registry_dispatch(reg, buf, len, &consumed);
+ * memmove(buf, buf + consumed, len - consumed);
+ */
+
+#include "struct.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct struct_registry struct_registry;
+
+/*
+ * handler of a message. record is the body decoded into the record of
+ * the format registered for tag, valid until the handler returns.
+ * returns 0 to go on with the next message, any other value to stop.
+ */
+typedef int (*struct_handler)(uint64_t tag, const void *record, void *arg);
+
+/*
+ * struct_registry_dispatch() return values
+ */
+#define STRUCT_REGISTRY_UNKNOWN     (-1)    /* no format for the tag */
+#define STRUCT_REGISTRY_MALFORMED   (-2)    /* a varint of over 10 bytes */
+
+/**
+ * @brief create a registry
+ * @return a registry on success, NULL on failure.
+ *
+ * tag_fmt is the format of the tag: a single unsigned integer or varint
+ * field, such as "B", "!H" or "V". signed fields are rejected, since their
+ * tags would not read back as the uint64_t they were registered under.
+ */
+extern struct_registry *struct_registry_new(const char *tag_fmt);
+
+/**
+ * @brief destroy a registry
+ */
+extern void struct_registry_free(struct_registry *reg);
+
+/**
+ * @brief register (or replace) the body format and handler of tag
+ * @return 0 on success, -1 on failure (tag does not fit in the tag
+ * format).
+ */
+extern int struct_registry_add(
+    struct_registry *reg,
+    uint64_t tag,
+    const char *fmt,
+    struct_handler handler,
+    void *arg);
+
+/**
+ * @brief the compiled body format of tag
+ * @return the format, NULL if tag is not registered.
+ */
+extern const struct_format *struct_registry_format(
+    const struct_registry *reg,
+    uint64_t tag);
+
+/**
+ * @brief pack a message: tag and the record of its body
+ * @return the number of bytes encoded, -1 if tag is not registered.
+ */
+extern int struct_registry_pack_record(
+    const struct_registry *reg,
+    void *buf,
+    uint64_t tag,
+    const void *record);
+
+/**
+ * @brief dispatch every complete message of buf
+ * @return 0 when the messages are all dispatched (up to an incomplete one
+ * at the end), STRUCT_REGISTRY_UNKNOWN at a message of an unregistered
+ * tag, STRUCT_REGISTRY_MALFORMED at a message with a varint which does
+ * not end within 10 bytes, or the value a handler returned to stop.
+ *
+ * *consumed is set to the number of bytes dispatched: the offset of the
+ * incomplete, unknown or malformed message, or the end of the message
+ * whose handler stopped.
+ */
+extern int struct_registry_dispatch(
+    struct_registry *reg,
+    const void *buf,
+    long len,
+    long *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_REGISTRY_INCLUDED */
@@ -0,0 +1,110 @@
+#ifndef STRUCT_RING_INCLUDED
+#define STRUCT_RING_INCLUDED
+/*
+ * struct_ring.h
+ *
+ * Single-producer/single-consumer ring of packed records
+ *
+ * the producer reserves a contiguous slot, packs a record directly into
+ * it and commits the length actually written. the consumer reads each
+ * record in place and releases it. a record never wraps around the end of
+ * the ring: when it does not fit before the end, it starts over at the
+ * beginning.
+ *
+ * the producer and the consumer each keep a private copy of their index
+ * and publish it to the other side only every batch records (and when
+ * the ring is full or empty), so the shared indices, which sit on cache
+ * lines of their own, are rarely written.
+ *
+ * Example 1. producer thread.
+ *
+ * void *slot = struct_ring_reserve(r, struct_calcsize("!IV"));
+ * if (slot != NULL) {
+ *     struct_ring_commit(r, struct_pack(slot, "!IV", id, seq));
+ * }
+ *
+ * or simply struct_ring_pack(r, "!IV", id, seq).
+ *
+ * Example 2. consumer thread.
+ *
+ * while ((rec = struct_ring_peek(r, &len)) != NULL) {
+ *     struct_unpack(rec, "!IV", &id, &seq);
+ *     struct_ring_release(r);
+ * }
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct struct_ring struct_ring;
+
+/**
+ * @brief create a ring
+ * @return a ring on success, NULL on failure.
+ *
+ * capacity is the size of the ring in bytes, a power of two. each record
+ * takes its length plus a 4 byte header, rounded up to 8 bytes.
+ * the indices are published every batch records.
+ */
+extern struct_ring *struct_ring_new(int capacity, int batch);
+
+/**
+ * @brief destroy a ring
+ */
+extern void struct_ring_free(struct_ring *r);
+
+/**
+ * @brief (producer) reserve a contiguous slot of size bytes
+ * @return the slot, NULL if the ring is full (or size does not fit in it).
+ */
+extern void *struct_ring_reserve(struct_ring *r, int size);
+
+/**
+ * @brief (producer) commit the slot reserved last, holding len bytes
+ * (at most the reserved size).
+ */
+extern void struct_ring_commit(struct_ring *r, int len);
+
+/**
+ * @brief (producer) make every committed record visible to the consumer
+ */
+extern void struct_ring_publish(struct_ring *r);
+
+/**
+ * @brief (producer) reserve, pack and commit a record. the exact size of
+ * the values is reserved (see struct_calcsize_values()).
+ * @return the number of bytes encoded, 0 if the ring is full,
+ * -1 on failure.
+ */
+extern int struct_ring_pack(struct_ring *r, const char *fmt, ...);
+
+/**
+ * @brief (producer) reserve, pack and commit a record (see
+ * struct_compile()). the exact packed size is reserved.
+ * @return see struct_ring_pack().
+ */
+extern int struct_ring_pack_record(
+    struct_ring *r,
+    const struct_format *sf,
+    const void *record);
+
+/**
+ * @brief (consumer) the next record
+ * @return the record, which stays valid until struct_ring_release(),
+ * NULL if there is none. its length is stored in *len.
+ */
+extern const void *struct_ring_peek(struct_ring *r, int *len);
+
+/**
+ * @brief (consumer) release the record returned by struct_ring_peek()
+ */
+extern void struct_ring_release(struct_ring *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_RING_INCLUDED */
@@ -0,0 +1,161 @@
+#ifndef STRUCT_SCAN_INCLUDED
+#define STRUCT_SCAN_INCLUDED
+/*
+ * struct_scan.h
+ *
+ * Aggregates and filters over fields of packed records
+ *
+ * the records are packed back to back with a fixed size format (see
+ * struct_compile()), so a field is found at the same position of every
+ * record: a scan reads it at that stride, converts its byte order in
+ * place and folds it into the aggregates, without unpacking the other
+ * fields. each combination of field size and byte order has its own
+ * branch-free loop, which the compiler may vectorize.
+ *
+ * a filter is a conjunction of comparisons of fields with constants. the
+ * records are filtered by blocks: the field of every predicate is read
+ * into a block of keys of the same order as its values, the comparison
+ * of each key gives a mask byte, and the masks of the predicates are
+ * and-ed. the matching records are then written out as a selection
+ * vector (their indexes) or a bitmap, which struct_scan_gather() may
+ * use to copy them out.
+ *
+ * Example 1. total and range of the prices of a batch of trades.
+ *
+ * struct_format *sf = struct_compile("!QdI8s");
+ * struct struct_aggregate agg;
+ *
+ * struct_scan_aggregate(sf, buf, n, 1, &agg);
+ * printf("%ld trades, %f total, %f to %f\n", agg.count, agg.sum.d,
+ *        agg.min.d, agg.max.d);
+ *
+ * Example 2. the trades of more than 1000 shares at 10.5.
+ *
+ * struct struct_predicate preds[2] = {
+ *     { 2, STRUCT_SCAN_GT, { 0 } },
+ *     { 1, STRUCT_SCAN_EQ, { 0 } },
+ * };
+ * long *sel = malloc(n * sizeof(*sel));
+ *
+ * preds[0].value.u = 1000;
+ * preds[1].value.d = 10.5;
+ * nsel = struct_scan_select(sf, buf, n, preds, 2, sel);
+ * len = struct_scan_gather(sf, buf, sel, nsel, out);
+ */
+
+#include "struct.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * a value of a field: i for signed integers ('b', 'h', 'i', 'l', 'q'),
+ * u for unsigned integers ('B', 'H', 'I', 'L', 'Q'), d for floats ('f',
+ * 'd').
+ */
+union struct_number {
+    int64_t i;
+    uint64_t u;
+    double d;
+};
+
+/*
+ * aggregates of a field. the sum of integers wraps around modulo 2^64;
+ * NaNs make the sum of floats NaN and are ignored by min and max. with
+ * no record, min and max are the largest and smallest values of the
+ * kind (+inf and -inf for floats).
+ */
+struct struct_aggregate {
+    long count;
+    union struct_number sum;
+    union struct_number min;
+    union struct_number max;
+};
+
+/*
+ * comparison operators of predicates
+ */
+#define STRUCT_SCAN_EQ  0   /* == */
+#define STRUCT_SCAN_NE  1   /* != */
+#define STRUCT_SCAN_LT  2   /* <  */
+#define STRUCT_SCAN_LE  3   /* <= */
+#define STRUCT_SCAN_GT  4   /* >  */
+#define STRUCT_SCAN_GE  5   /* >= */
+
+/*
+ * field op value, value being of the kind of the field (see union
+ * struct_number); it is rounded to float for an 'f' field. floats compare
+ * as numbers, except NaNs which compare above +inf (below -inf when
+ * negative).
+ */
+struct struct_predicate {
+    int field;
+    int op;
+    union struct_number value;
+};
+
+/**
+ * @brief compute the aggregates of field (an argument of struct_pack())
+ * over nrecords records packed at buf
+ * @return 0 on success, -1 if the format is not of fixed size or the
+ * field is not an integer or float.
+ */
+extern int struct_scan_aggregate(
+    const struct_format *sf,
+    const void *buf,
+    long nrecords,
+    int field,
+    struct struct_aggregate *agg);
+
+/**
+ * @brief select the records matching every predicate of preds
+ * @return the number of records selected on success, -1 if the format
+ * is not of fixed size or a predicate is invalid.
+ *
+ * the indexes of the records selected are written to sel in increasing
+ * order. sel must have room for nrecords indexes.
+ */
+extern long struct_scan_select(
+    const struct_format *sf,
+    const void *buf,
+    long nrecords,
+    const struct struct_predicate *preds,
+    int npreds,
+    long *sel);
+
+/**
+ * @brief set the bit of every record matching every predicate of preds
+ * @return the number of records matching on success, -1 on failure (see
+ * struct_scan_select()).
+ *
+ * bit i % 8 of byte i / 8 of bitmap is set for record i if it matches,
+ * cleared otherwise. bitmap must have room for (nrecords + 7) / 8 bytes.
+ */
+extern long struct_scan_bitmap(
+    const struct_format *sf,
+    const void *buf,
+    long nrecords,
+    const struct struct_predicate *preds,
+    int npreds,
+    unsigned char *bitmap);
+
+/**
+ * @brief copy the packed records of a selection vector back to back
+ * @return the number of bytes copied to out, -1 if the format is not of
+ * fixed size.
+ */
+extern long struct_scan_gather(
+    const struct_format *sf,
+    const void *buf,
+    const long *sel,
+    long nsel,
+    void *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_SCAN_INCLUDED */
@@ -0,0 +1,119 @@
+#ifndef STRUCT_SEARCH_INCLUDED
+#define STRUCT_SEARCH_INCLUDED
+/*
+ * struct_search.h
+ *
+ * Lookup in sorted packed record files
+ *
+ * the records of a file are packed back to back with a compiled format
+ * (see struct_compile()) and sorted by one of their fields, as written by
+ * struct_external_sort(). keys compare as in struct_merge.h: integers,
+ * varints and floats as numbers, 's' and 'p' as bytes.
+ *
+ * a file of fixed size records is binary searched in place, reading one
+ * record per step. a file of variable size records can not be, since the
+ * record starts are unknown: a sparse index of the offset and key of one
+ * record out of every is built by a scan of the file, and a lookup binary
+ * searches the index, then scans at most every records of the file.
+ * the index may be saved to a file and loaded back.
+ *
+ * the key to look up is given as a record whose key member is set. an
+ * index keeps a pointer to its format, and a lookup uses its scratch
+ * space: it must not be shared by threads.
+ *
+ * Example 1. point lookup in a fixed size record file.
+ *
+ * struct_format *sf = struct_compile("!QdI8s");
+ *
+ * probe.id = 42;
+ * off = struct_search_fixed(sf, 0, fd, &probe, &rec);
+ *
+ * Example 2. build, save and use a sparse index.
+ *
+ * struct_format *sf = struct_compile("!QVd16s");
+ * struct_index *idx = struct_index_build(sf, 0, fd, 64);
+ *
+ * struct_index_save(idx, idx_fd);
+ * off = struct_index_search(idx, fd, &probe, &rec);
+ * struct_index_free(idx);
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct struct_index struct_index;
+
+/**
+ * @brief binary search a file of fixed size records sorted by field key
+ * @return the offset of the first record whose key equals the key of
+ * probe, -1 if there is none or on failure.
+ *
+ * the record found is unpacked into record unless it is NULL.
+ */
+extern long struct_search_fixed(
+    const struct_format *sf,
+    int key,
+    int fd,
+    const void *probe,
+    void *record);
+
+/**
+ * @brief build the sparse index of a file sorted by field key, one entry
+ * per every records
+ * @return an index on success, NULL on failure (a bad key, a failed read,
+ * or a malformed or truncated record).
+ */
+extern struct_index *struct_index_build(
+    const struct_format *sf,
+    int key,
+    int fd,
+    int every);
+
+/**
+ * @brief write an index to fd
+ * @return 0 on success, -1 on failure.
+ */
+extern int struct_index_save(const struct_index *idx, int fd);
+
+/**
+ * @brief read an index written by struct_index_save() from fd
+ * @return an index on success, NULL on failure (or if it was not built
+ * for a key field of the same kind and size, or is corrupted: its entry
+ * count does not match its record count, or its offsets do not increase).
+ */
+extern struct_index *struct_index_load(
+    const struct_format *sf,
+    int key,
+    int fd);
+
+/**
+ * @brief look up the key of probe in the file of an index
+ * @return the offset of the first record whose key equals the key of
+ * probe, -1 if there is none or on failure.
+ *
+ * the record found is unpacked into record unless it is NULL.
+ */
+extern long struct_index_search(
+    struct_index *idx,
+    int fd,
+    const void *probe,
+    void *record);
+
+/**
+ * @brief the number of records of the file of an index
+ */
+extern long struct_index_nrecords(const struct_index *idx);
+
+/**
+ * @brief destroy an index
+ */
+extern void struct_index_free(struct_index *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_SEARCH_INCLUDED */
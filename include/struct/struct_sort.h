@@ -0,0 +1,58 @@
+#ifndef STRUCT_SORT_INCLUDED
+#define STRUCT_SORT_INCLUDED
+/*
+ * struct_sort.h
+ *
+ * Radix sort of packed records
+ *
+ * an array of records packed back to back with a fixed size format (see
+ * struct_compile()) is sorted by one of its fields in packed form, with
+ * an LSD radix sort on the bytes of the key: no record is unpacked,
+ * compared or packed again.
+ *
+ * the key bytes are read in the byte order of the field, and signed
+ * integers and floats are mapped to unsigned integers of the same order,
+ * so the result is the numeric order of the keys ('s': the memcmp()
+ * order). a byte which is the same in every key costs no pass.
+ *
+ * records of up to 16 bytes are moved on every pass. wider ones are
+ * sorted through an array of (key, index) items, and then moved once
+ * into place.
+ *
+ * Example 1. sort 10M packed trades by price on 8 threads.
+ *
+ * struct_format *sf = struct_compile("!QdI8s");
+ *
+ * struct_sort_packed(sf, buf, 10000000, 1, 8);
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief sort nrecords records packed at buf by the field key, in place
+ * @return 0 on success, -1 on failure.
+ *
+ * the format must be of fixed size; key is the index of the key field
+ * (an argument of struct_pack()), an integer, float or 's' field. the
+ * sort is stable.
+ *
+ * each pass is split into nthreads contiguous chunks of the records:
+ * every thread counts the key bytes of its chunk, and scatters it to the
+ * offsets given by the prefix sum of the counts of every thread.
+ */
+extern int struct_sort_packed(
+    const struct_format *sf,
+    void *buf,
+    long nrecords,
+    int key,
+    int nthreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_SORT_INCLUDED */
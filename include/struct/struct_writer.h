@@ -0,0 +1,95 @@
+#ifndef STRUCT_WRITER_INCLUDED
+#define STRUCT_WRITER_INCLUDED
+/*
+ * struct_writer.h
+ *
+ * Double-buffered asynchronous writer
+ *
+ * the producer packs records into the active buffer while a background
+ * thread writes the other buffer to a file descriptor. the buffers are
+ * swapped when the active buffer is full, or after flush_ms milliseconds
+ * (checked on the next pack, so an idle producer should call
+ * struct_writer_flush()).
+ *
+ * a writer has a single producer: its functions must not be called from
+ * more than one thread at a time.
+ *
+ * Example 1. log records to a file.
+ *
+ * struct_writer *w = struct_writer_new(fd, 1 << 20, 10, STRUCT_WRITER_BLOCK);
+ *
+ * struct_writer_pack(w, "!IqV", id, ts, seq);
+ * ...
+ * struct_writer_close(w);
+ */
+
+#include "struct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * what to do when the active buffer is full and the other buffer is
+ * still being written.
+ */
+#define STRUCT_WRITER_BLOCK     0   /* wait for the write (back-pressure) */
+#define STRUCT_WRITER_DROP      1   /* drop the record */
+
+typedef struct struct_writer struct_writer;
+
+/**
+ * @brief create a writer and start its thread
+ * @return a writer on success, NULL on failure.
+ *
+ * bufsize is the size of each of the two buffers. flush_ms <= 0 disables
+ * the time threshold. the threshold is acted upon by the next pack: the
+ * writer never flushes by itself, so records packed before the producer
+ * goes idle stay in the active buffer until struct_writer_flush() or
+ * struct_writer_close().
+ */
+extern struct_writer *struct_writer_new(
+    int fd,
+    int bufsize,
+    int flush_ms,
+    int policy);
+
+/**
+ * @brief pack data into the active buffer
+ * @return the number of bytes encoded on success, 0 if the record was
+ * dropped, -1 on failure (a bad format, a record larger than bufsize or
+ * a failed write).
+ */
+extern int struct_writer_pack(struct_writer *w, const char *fmt, ...);
+
+/**
+ * @brief pack a record (see struct_compile()) into the active buffer
+ * @return see struct_writer_pack().
+ */
+extern int struct_writer_pack_record(
+    struct_writer *w,
+    const struct_format *sf,
+    const void *record);
+
+/**
+ * @brief write everything packed so far
+ * @return 0 once it is written, -1 if a write failed.
+ */
+extern int struct_writer_flush(struct_writer *w);
+
+/**
+ * @brief the number of records dropped by STRUCT_WRITER_DROP
+ */
+extern long struct_writer_dropped(const struct_writer *w);
+
+/**
+ * @brief flush, stop the thread and destroy the writer
+ * @return 0 on success, -1 if a write failed. the fd is not closed.
+ */
+extern int struct_writer_close(struct_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !STRUCT_WRITER_INCLUDED */
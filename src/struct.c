@@ -1,13 +1,17 @@
 #include "struct.h"
 #include "struct_endian.h"
+#include "struct_internal.h"
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <math.h>
+#include <float.h>
 
 #define IEEE754_32_NAN     0x7FC00000
 #define IEEE754_32_INF     0x7F800000
@@ -37,6 +41,31 @@
 
 #define CLEAR_REPETITION(_x) _struct_rep = 0
 
+/*
+ * order preserving byte order ('^')
+ *
+ * values are big-endian, signed integers have their sign bit flipped and
+ * floats have their sign bit flipped when positive and all their bits
+ * flipped when negative, so that packed keys compare with memcmp() like
+ * the values they hold.
+ */
+#define ORDER_SIGN(val, bits, endian) \
+    (((endian) == STRUCT_ENDIAN_ORDERED) ? \
+     ((val) ^ ((uint64_t)1 << ((bits) - 1))) : (uint64_t)(val))
+
+/*
+ * unpack_va_list() flags
+ *
+ * UNPACK_STRING_VIEW: 's' and 'p' take a 'const char **' and receive a
+ *                     pointer into the source buffer instead of a copy.
+ */
+#define UNPACK_STRING_VIEW 0x01
+
+/*
+ * returned by pack_va_list() when the message does not fit its buffer
+ */
+#define PACK_OVERFLOW (-2)
+
 static int myendian = STRUCT_ENDIAN_NOT_SET;
 
 static void struct_init(void)
@@ -219,15 +248,35 @@ static void pack_int64_t(unsigned char **bp, uint64_t val, int endian)
     }
 }
 
+static uint64_t order_float(uint64_t bits, unsigned int nbits)
+{
+    uint64_t sign = (uint64_t)1 << (nbits - 1);
+    uint64_t mask = sign | (sign - 1);
+
+    return (bits & sign) ? (~bits & mask) : (bits | sign);
+}
+
+static uint64_t unorder_float(uint64_t bits, unsigned int nbits)
+{
+    uint64_t sign = (uint64_t)1 << (nbits - 1);
+    uint64_t mask = sign | (sign - 1);
+
+    return (bits & sign) ? (bits ^ sign) : (~bits & mask);
+}
+
 static void pack_float(unsigned char **bp, float val, int endian)
 {
     uint64_t ieee754_encoded_val = PACK_IEEE754_32(val);
+    if (endian == STRUCT_ENDIAN_ORDERED)
+        ieee754_encoded_val = order_float(ieee754_encoded_val, 32);
     pack_int32_t(bp, ieee754_encoded_val, endian);
 }
 
 static void pack_double(unsigned char **bp, double val, int endian)
 {
     uint64_t ieee754_encoded_val = PACK_IEEE754_64(val);
+    if (endian == STRUCT_ENDIAN_ORDERED)
+        ieee754_encoded_val = order_float(ieee754_encoded_val, 64);
     pack_int64_t(bp, ieee754_encoded_val, endian);
 }
 
@@ -256,6 +305,7 @@ static void unpack_int16_t(const unsigned char **bp, int16_t *dst, int endian)
         val = (uint16_t)(*((*bp)++)) << 8;
         val |= *((*bp)++);
     }
+    val = ORDER_SIGN(val, 16, endian);
     if (val <= 0x7fffU) {
         *dst = val;
     } else {
@@ -288,6 +338,7 @@ static void unpack_int32_t(const unsigned char **bp, int32_t *dst, int endian)
         val |= (uint32_t)(*((*bp)++)) << 8;
         val |= (uint32_t)(*((*bp)++));
     }
+    val = ORDER_SIGN(val, 32, endian);
     if (val <= 0x7fffffffU) {
         *dst = val;
     } else {
@@ -332,6 +383,7 @@ static void unpack_int64_t(const unsigned char **bp, int64_t *dst, int endian)
         val |= (uint64_t)(*((*bp)++)) << 8;
         val |= *((*bp)++);
     }
+    val = ORDER_SIGN(val, 64, endian);
     if (val <= 0x7fffffffffffffffULL) {
         *dst = val;
     } else {
@@ -366,6 +418,8 @@ static void unpack_float(const unsigned char **bp, float *dst, int endian)
 {
     uint32_t ieee754_encoded_val = 0;
     unpack_uint32_t(bp, &ieee754_encoded_val, endian);
+    if (endian == STRUCT_ENDIAN_ORDERED)
+        ieee754_encoded_val = unorder_float(ieee754_encoded_val, 32);
     *dst = UNPACK_IEEE754_32(ieee754_encoded_val);
 }
 
@@ -373,20 +427,68 @@ static void unpack_double(const unsigned char **bp, double *dst, int endian)
 {
     uint64_t ieee754_encoded_val = 0;
     unpack_uint64_t(bp, &ieee754_encoded_val, endian);
+    if (endian == STRUCT_ENDIAN_ORDERED)
+        ieee754_encoded_val = unorder_float(ieee754_encoded_val, 64);
     *dst = UNPACK_IEEE754_64(ieee754_encoded_val);
 }
 
+/*
+ * a varint is read up to its tenth byte at most, like struct_validate()
+ * checks it, so that every way of stepping over one agrees.
+ */
 static void unpack_varint(const unsigned char **bp, uint64_t *dst, int endian)
 {
+    const unsigned char *p = *bp;
+
     *dst = 0;
-    for (size_t bits = 0; bits <= 63; bits += 7, (*bp)++) {
-        *dst |= (uint64_t)((*bp)[0] & 0x7f) << bits;
-        if (!((*bp)[0] & 0x80))
+    for (size_t bits = 0; bits <= 63; bits += 7) {
+        *dst |= (uint64_t)(*p & 0x7f) << bits;
+        if (!(*p++ & 0x80))
             break;
     }
+    *bp = p;
+}
+
+static void skip_varint(const unsigned char **bp)
+{
+    const unsigned char *last = *bp + 9;
+
+    while (*bp < last && (**bp & 0x80)) {
+        (*bp)++;
+    }
     (*bp)++;
 }
 
+/*
+ * the length of the varint at bp, -1 if it does not end within avail
+ * bytes or 10 bytes. the terminator is looked for in 8 bytes at once.
+ */
+static int varint_length(const unsigned char *bp, long avail)
+{
+    uint64_t word;
+    uint64_t stops;
+    long stop = (avail < 10) ? avail : 10;
+    long n = 0;
+
+    if (avail >= 8) {
+        memcpy(&word, bp, 8);
+        stops = ~word & 0x8080808080808080ULL;
+        if (stops != 0) {
+            /* the first byte of bp is the lowest on little-endian hosts */
+            n = (myendian == STRUCT_ENDIAN_LITTLE) ?
+                __builtin_ctzll(stops) / 8 : __builtin_clzll(stops) / 8;
+            return n + 1;
+        }
+        n = 8;
+    }
+    for (; n < stop; n++) {
+        if (!(bp[n] & 0x80)) {
+            return n + 1;
+        }
+    }
+    return -1;
+}
+
 static void unpack_signed_varint(const unsigned char **bp, int64_t *dst, int endian)
 {
     uint64_t uval;
@@ -396,14 +498,88 @@ static void unpack_signed_varint(const unsigned char **bp, int64_t *dst, int end
         *dst = ~*dst;
 }
 
-static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
-                          va_list args)
+/*
+ * the encoded size of a fixed size format character, 0 for the others.
+ */
+static int code_size(int code)
+{
+    switch (code) {
+    case 'b': /* fall through */
+    case 'B':
+        return 1;
+    case 'h': /* fall through */
+    case 'H':
+        return 2;
+    case 'i': /* fall through */
+    case 'I': /* fall through */
+    case 'l': /* fall through */
+    case 'L': /* fall through */
+    case 'f':
+        return 4;
+    case 'q': /* fall through */
+    case 'Q': /* fall through */
+    case 'd':
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * the number of bytes pack_varint() writes for val: 7 bits per byte of
+ * its significant bits (at least one).
+ */
+static int varint_size(uint64_t val)
+{
+    return (64 - __builtin_clzll(val | 1) + 6) / 7;
+}
+
+static uint64_t zigzag(int64_t val)
+{
+    uint64_t uval = (uint64_t)val << 1ull;
+    if (val < 0)
+        uval = ~uval;
+    return uval;
+}
+
+/*
+ * optional fields
+ *
+ * '?' makes the next format character (with its repeat count) optional.
+ * a message with optional fields starts with a presence bitmap of
+ * (n + 7) / 8 bytes for n '?', bit i % 8 of byte i / 8 set when the
+ * i-th optional field is present. an absent field takes no space.
+ */
+static int count_optional(const char *fmt)
+{
+    int n = 0;
+
+    for (; *fmt != '\0'; fmt++) {
+        if (*fmt == '?') {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * pack into buf at offset. unless size is negative, the message must end
+ * within size bytes of buf, or PACK_OVERFLOW is returned.
+ */
+static int pack_va_list(unsigned char *buf, int offset, int size,
+                          const char *fmt, va_list args)
 {
     INIT_REPETITION();
     const char *p;
     unsigned char *bp;
+    unsigned char *bitmap;
+    const unsigned char *end = (size >= 0) ? buf + size : NULL;
+    int n;
     int *ep = &myendian;
     int endian;
+    int opt = -1;               /* index of the pending optional field */
+    int nopt = 0;
+    int present = 1;
 
     char b;
     unsigned char B;
@@ -429,8 +605,58 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
      * represented by an ellipsis ... parameter.
      */
 
-    bp = buf + offset;
+    n = (count_optional(fmt) + 7) / 8;
+    if (end != NULL && offset + n > size) {
+        return PACK_OVERFLOW;
+    }
+    bitmap = buf + offset;
+    bp = bitmap + n;
+    memset(bitmap, 0, bp - bitmap);
     for (p = fmt; *p != '\0'; p++) {
+        if (opt >= 0 && !present && !isdigit((int)*p) &&
+                strchr("=<>!^?", *p) == NULL) {
+            /* absent: consume the arguments, pack nothing */
+            switch (*p) {
+            case 's': /* fall through */
+            case 'p':
+                (void)va_arg(args, char*);
+                break;
+            case 'x':
+                break;
+            case 'q': case 'Q': case 'v': case 'V':
+                BEGIN_REPETITION();
+                    (void)va_arg(args, int64_t);
+                END_REPETITION();
+                break;
+            case 'f': /* fall through */
+            case 'd':
+                BEGIN_REPETITION();
+                    (void)va_arg(args, double);
+                END_REPETITION();
+                break;
+            case 'b': case 'B': case 'h': case 'H':
+            case 'i': case 'I': case 'l': case 'L':
+                BEGIN_REPETITION();
+                    (void)va_arg(args, int);
+                END_REPETITION();
+                break;
+            default:
+                return -1;
+            }
+            opt = -1;
+            CLEAR_REPETITION();
+            continue;
+        }
+
+        /* the room for a run of fixed size fields is checked at once */
+        if (end != NULL && strchr("bBhHiIlLqQfdspx", *p) != NULL) {
+            n = (code_size(*p) > 0) ? code_size(*p) : 1;
+            n *= (_struct_rep > 0) ? _struct_rep : 1;
+            if (end - bp < n) {
+                return PACK_OVERFLOW;
+            }
+        }
+
         switch (*p) {
         case '=': /* native */
             ep = &myendian;
@@ -447,10 +673,24 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
             endian = STRUCT_ENDIAN_BIG;
             ep = &endian;
             break;
+        case '^': /* order preserving (big-endian) */
+            endian = STRUCT_ENDIAN_ORDERED;
+            ep = &endian;
+            break;
+        case '?':
+            if (opt >= 0) {
+                return -1;
+            }
+            opt = nopt++;
+            present = va_arg(args, int);
+            if (present) {
+                bitmap[opt / 8] |= 1 << (opt % 8);
+            }
+            break;
         case 'b':
             BEGIN_REPETITION();
                 b = va_arg(args, int);
-                *bp++ = b;
+                *bp++ = ORDER_SIGN((unsigned char)b, 8, *ep);
             END_REPETITION();
             break;
         case 'B':
@@ -462,7 +702,7 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
         case 'h':
             BEGIN_REPETITION();
                 h = va_arg(args, int);
-                pack_int16_t(&bp, h, *ep);
+                pack_int16_t(&bp, ORDER_SIGN((uint16_t)h, 16, *ep), *ep);
             END_REPETITION();
             break;
         case 'H':
@@ -475,7 +715,7 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
         case 'l':
             BEGIN_REPETITION();
                 l = va_arg(args, int32_t);
-                pack_int32_t(&bp, l, *ep);
+                pack_int32_t(&bp, ORDER_SIGN((uint32_t)l, 32, *ep), *ep);
             END_REPETITION();
             break;
         case 'I': /* fall through */
@@ -488,7 +728,7 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
         case 'q':
             BEGIN_REPETITION();
                 q = va_arg(args, int64_t);
-                pack_int64_t(&bp, q, *ep);
+                pack_int64_t(&bp, ORDER_SIGN((uint64_t)q, 64, *ep), *ep);
             END_REPETITION();
             break;
         case 'Q':
@@ -527,12 +767,18 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
         case 'v':
             BEGIN_REPETITION();
             v = va_arg(args, int64_t);
+            if (end != NULL && end - bp < varint_size(zigzag(v))) {
+                return PACK_OVERFLOW;
+            }
             pack_signed_varint(&bp, v, *ep);
             END_REPETITION();
             break;
         case 'V':
             BEGIN_REPETITION();
             V = va_arg(args, uint64_t);
+            if (end != NULL && end - bp < varint_size(V)) {
+                return PACK_OVERFLOW;
+            }
             pack_varint(&bp, V, *ep);
             END_REPETITION();
             break;
@@ -546,22 +792,40 @@ static int pack_va_list(unsigned char *buf, int offset, const char *fmt,
 
         if (!isdigit((int)*p)) {
             CLEAR_REPETITION();
+            if (strchr("=<>!^?", *p) == NULL) {
+                opt = -1;
+            }
         }
     }
     return (bp - buf);
 }
 
+/*
+ * unpack from buf at offset. unless size is negative, the message must
+ * end within size bytes of buf: if it does not, a lower bound of the
+ * bytes it needs is returned (more than size): up to the end of the first
+ * fixed size field which does not fit, or size + 1 for a varint cut short.
+ */
 static int unpack_va_list(
     const unsigned char *buf,
     int offset,
+    int size,
     const char *fmt,
+    int flags,
     va_list args)
 {
     INIT_REPETITION();
     const char *p;
     const unsigned char *bp;
+    const unsigned char *bitmap;
+    const unsigned char *end = (size >= 0) ? buf + size : NULL;
+    int n;
     int *ep = &myendian;
     int endian;
+    int opt = -1;               /* index of the pending optional field */
+    int nopt = 0;
+    int present = 1;
+    int *pres;
 
     char *b;
     unsigned char *B;
@@ -574,6 +838,7 @@ static int unpack_va_list(
     float *f;
     double *d;
     char *s;
+    const char **sv;
     int64_t *v;
     uint64_t *V;
 
@@ -581,8 +846,47 @@ static int unpack_va_list(
         struct_init();
     }
 
-    bp = buf + offset;
+    n = (count_optional(fmt) + 7) / 8;
+    if (end != NULL && offset + n > size) {
+        return offset + n;
+    }
+    bitmap = buf + offset;
+    bp = bitmap + n;
     for (p = fmt; *p != '\0'; p++) {
+        if (opt >= 0 && !present && !isdigit((int)*p) &&
+                strchr("=<>!^?", *p) == NULL) {
+            /* absent: consume the destinations, leave them untouched */
+            switch (*p) {
+            case 's': /* fall through */
+            case 'p':
+                (void)va_arg(args, void*);
+                break;
+            case 'x':
+                break;
+            case 'b': case 'B': case 'h': case 'H': case 'i': case 'I':
+            case 'l': case 'L': case 'q': case 'Q': case 'f': case 'd':
+            case 'v': case 'V':
+                BEGIN_REPETITION();
+                    (void)va_arg(args, void*);
+                END_REPETITION();
+                break;
+            default:
+                return -1;
+            }
+            opt = -1;
+            CLEAR_REPETITION();
+            continue;
+        }
+
+        /* a run of fixed size fields is checked at once */
+        if (end != NULL && strchr("bBhHiIlLqQfdspx", *p) != NULL) {
+            n = (code_size(*p) > 0) ? code_size(*p) : 1;
+            n *= (_struct_rep > 0) ? _struct_rep : 1;
+            if (end - bp < n) {
+                return (bp - buf) + n;
+            }
+        }
+
         switch (*p) {
         case '=': /* native */
             ep = &myendian;
@@ -599,75 +903,139 @@ static int unpack_va_list(
             endian = STRUCT_ENDIAN_BIG;
             ep = &endian;
             break;
+        case '^': /* order preserving (big-endian) */
+            endian = STRUCT_ENDIAN_ORDERED;
+            ep = &endian;
+            break;
+        case '?':
+            if (opt >= 0) {
+                return -1;
+            }
+            opt = nopt++;
+            present = (bitmap[opt / 8] >> (opt % 8)) & 1;
+            pres = va_arg(args, int*);
+            if (pres != NULL) {
+                *pres = present;
+            }
+            break;
         case 'b':
             BEGIN_REPETITION();
                 b = va_arg(args, char*);
-                *b = *bp++;
+                if (b != NULL) {
+                    *b = ORDER_SIGN(*bp, 8, *ep);
+                }
+                bp++;
             END_REPETITION();
             break;
         case 'B':
             BEGIN_REPETITION();
                 B = va_arg(args, unsigned char*);
-                *B = *bp++;
+                if (B != NULL) {
+                    *B = *bp;
+                }
+                bp++;
             END_REPETITION();
             break;
         case 'h':
             BEGIN_REPETITION();
                 h = va_arg(args, int16_t*);
-                unpack_int16_t(&bp, h, *ep);
+                if (h != NULL) {
+                    unpack_int16_t(&bp, h, *ep);
+                } else {
+                    bp += 2;
+                }
             END_REPETITION();
             break;
         case 'H':
             BEGIN_REPETITION();
                 H = va_arg(args, uint16_t*);
-                unpack_uint16_t(&bp, H, *ep);
+                if (H != NULL) {
+                    unpack_uint16_t(&bp, H, *ep);
+                } else {
+                    bp += 2;
+                }
             END_REPETITION();
             break;
         case 'i': /* fall through */
         case 'l':
             BEGIN_REPETITION();
                 l = va_arg(args, int32_t*);
-                unpack_int32_t(&bp, l, *ep);
+                if (l != NULL) {
+                    unpack_int32_t(&bp, l, *ep);
+                } else {
+                    bp += 4;
+                }
             END_REPETITION();
             break;
         case 'I': /* fall through */
         case 'L':
             BEGIN_REPETITION();
                 L = va_arg(args, uint32_t*);
-                unpack_uint32_t(&bp, L, *ep);
+                if (L != NULL) {
+                    unpack_uint32_t(&bp, L, *ep);
+                } else {
+                    bp += 4;
+                }
             END_REPETITION();
             break;
         case 'q':
             BEGIN_REPETITION();
                 q = va_arg(args, int64_t*);
-                unpack_int64_t(&bp, q, *ep);
+                if (q != NULL) {
+                    unpack_int64_t(&bp, q, *ep);
+                } else {
+                    bp += 8;
+                }
             END_REPETITION();
             break;
         case 'Q':
             BEGIN_REPETITION();
                 Q = va_arg(args, uint64_t*);
-                unpack_uint64_t(&bp, Q, *ep);
+                if (Q != NULL) {
+                    unpack_uint64_t(&bp, Q, *ep);
+                } else {
+                    bp += 8;
+                }
             END_REPETITION();
             break;
         case 'f':
             BEGIN_REPETITION();
                 f = va_arg(args, float*);
-                unpack_float(&bp, f, *ep);
+                if (f != NULL) {
+                    unpack_float(&bp, f, *ep);
+                } else {
+                    bp += 4;
+                }
             END_REPETITION();
             break;
         case 'd':
             BEGIN_REPETITION();
                 d = va_arg(args, double*);
-                unpack_double(&bp, d, *ep);
+                if (d != NULL) {
+                    unpack_double(&bp, d, *ep);
+                } else {
+                    bp += 8;
+                }
             END_REPETITION();
             break;
         case 's': /* fall through */
         case 'p':
-            {
+            if (flags & UNPACK_STRING_VIEW) {
+                sv = va_arg(args, const char**);
+                if (sv != NULL) {
+                    *sv = (const char *)bp;
+                }
+                BEGIN_REPETITION();
+                    bp++;
+                END_REPETITION();
+            } else {
                 int i = 0;
                 s = va_arg(args, char*);
                 BEGIN_REPETITION();
-                    s[i++] = *bp++;
+                    if (s != NULL) {
+                        s[i++] = *bp;
+                    }
+                    bp++;
                 END_REPETITION();
             }
             break;
@@ -679,13 +1047,29 @@ static int unpack_va_list(
         case 'v':
             BEGIN_REPETITION();
             v = va_arg(args, int64_t*);
-            unpack_signed_varint(&bp, v, *ep);
+            if (end != NULL && varint_length(bp, end - bp) < 0) {
+                /* cut short, or malformed if 10 bytes are there */
+                return (end - bp < 10) ? (end - buf) + 1 : -1;
+            }
+            if (v != NULL) {
+                unpack_signed_varint(&bp, v, *ep);
+            } else {
+                skip_varint(&bp);
+            }
             END_REPETITION();
             break;
         case 'V':
             BEGIN_REPETITION();
             V = va_arg(args, uint64_t*);
-            unpack_varint(&bp, V, *ep);
+            if (end != NULL && varint_length(bp, end - bp) < 0) {
+                /* cut short, or malformed if 10 bytes are there */
+                return (end - bp < 10) ? (end - buf) + 1 : -1;
+            }
+            if (V != NULL) {
+                unpack_varint(&bp, V, *ep);
+            } else {
+                skip_varint(&bp);
+            }
             END_REPETITION();
             break;
         default:
@@ -698,170 +1082,2273 @@ static int unpack_va_list(
 
         if (!isdigit((int)*p)) {
             CLEAR_REPETITION();
+            if (strchr("=<>!^?", *p) == NULL) {
+                opt = -1;
+            }
         }
     }
     return (bp - buf);
 }
 
 /*
- * EXPORT
+ * scan the format string from *pp up to the next format character.
+ * byte order characters update *endian and digits are collected into
+ * *count (0 if there is no repeat count).
  *
- * preifx: struct_
+ * returns the format character and leaves *pp just past it,
+ * '\0' at the end of the format string, -1 on an invalid character.
+ */
+static int next_code(const char **pp, int *count, int *endian)
+{
+    const char *p;
+
+    *count = 0;
+    for (p = *pp; *p != '\0'; p++) {
+        switch (*p) {
+        case '=': /* native */
+            *endian = myendian;
+            break;
+        case '<': /* little-endian */
+            *endian = STRUCT_ENDIAN_LITTLE;
+            break;
+        case '>': /* fall through */
+        case '!': /* big-endian, network */
+            *endian = STRUCT_ENDIAN_BIG;
+            break;
+        case '^': /* order preserving */
+            *endian = STRUCT_ENDIAN_ORDERED;
+            break;
+        case 'b': case 'B': case 'h': case 'H': case 'i': case 'I':
+        case 'l': case 'L': case 'q': case 'Q': case 'f': case 'd':
+        case 's': case 'p': case 'x': case 'v': case 'V':
+            *pp = p + 1;
+            return *p;
+        default:
+            if (isdigit((int)*p)) {
+                *count = *count * 10 + (*p - '0');
+            } else {
+                return -1;
+            }
+        }
+    }
+    *pp = p;
+    return '\0';
+}
+
+/*
+ * the number of arguments consumed by fmt, -1 on an invalid format.
+ */
+static int count_args(const char *fmt)
+{
+    const char *p = fmt;
+    int endian = myendian;
+    int count;
+    int code;
+    int n = 0;
+
+    while ((code = next_code(&p, &count, &endian)) > 0) {
+        switch (code) {
+        case 'x':
+            break;
+        case 's': /* fall through */
+        case 'p':
+            n++;
+            break;
+        default:
+            n += (count > 0) ? count : 1;
+        }
+    }
+    return (code == 0) ? n : -1;
+}
+
+/*
+ * read the argument of format character code from a va_list.
+ * see pack_va_list() for the promoted types of the arguments.
+ */
+static void va_value(int code, va_list *args, union struct_value *val)
+{
+    switch (code) {
+    case 'b': case 'h': case 'i': case 'l':
+        val->q = va_arg(*args, int);
+        break;
+    case 'B': case 'H': case 'I': case 'L':
+        val->Q = va_arg(*args, unsigned int);
+        break;
+    case 'q': /* fall through */
+    case 'v':
+        val->q = va_arg(*args, int64_t);
+        break;
+    case 'Q': /* fall through */
+    case 'V':
+        val->Q = va_arg(*args, uint64_t);
+        break;
+    case 'f': /* fall through */
+    case 'd':
+        val->d = va_arg(*args, double);
+        break;
+    case 's': /* fall through */
+    case 'p':
+        val->s = va_arg(*args, const char *);
+        break;
+    }
+}
+
+/*
+ * pack a single value of a fixed size or varint format character.
+ */
+static void pack_value(unsigned char **bp, int code,
+        const union struct_value *val, int endian)
+{
+    switch (code) {
+    case 'b':
+        *((*bp)++) = ORDER_SIGN((unsigned char)val->Q, 8, endian);
+        break;
+    case 'B':
+        *((*bp)++) = val->Q;
+        break;
+    case 'h':
+        pack_int16_t(bp, ORDER_SIGN((uint16_t)val->Q, 16, endian), endian);
+        break;
+    case 'H':
+        pack_int16_t(bp, val->Q, endian);
+        break;
+    case 'i': /* fall through */
+    case 'l':
+        pack_int32_t(bp, ORDER_SIGN((uint32_t)val->Q, 32, endian), endian);
+        break;
+    case 'I': /* fall through */
+    case 'L':
+        pack_int32_t(bp, val->Q, endian);
+        break;
+    case 'q':
+        pack_int64_t(bp, ORDER_SIGN(val->Q, 64, endian), endian);
+        break;
+    case 'Q':
+        pack_int64_t(bp, val->Q, endian);
+        break;
+    case 'f':
+        pack_float(bp, val->d, endian);
+        break;
+    case 'd':
+        pack_double(bp, val->d, endian);
+        break;
+    case 'v':
+        pack_signed_varint(bp, val->q, endian);
+        break;
+    case 'V':
+        pack_varint(bp, val->Q, endian);
+        break;
+    }
+}
+
+/*
+ * unpack a single value of a fixed size or varint format character into
+ * dst, which has the type struct_unpack() expects for code.
+ */
+static void unpack_value(const unsigned char **bp, int code, void *dst,
+        int endian)
+{
+    switch (code) {
+    case 'b':
+        *(char *)dst = ORDER_SIGN(**bp, 8, endian);
+        (*bp)++;
+        break;
+    case 'B':
+        *(unsigned char *)dst = *((*bp)++);
+        break;
+    case 'h':
+        unpack_int16_t(bp, (int16_t *)dst, endian);
+        break;
+    case 'H':
+        unpack_uint16_t(bp, (uint16_t *)dst, endian);
+        break;
+    case 'i': /* fall through */
+    case 'l':
+        unpack_int32_t(bp, (int32_t *)dst, endian);
+        break;
+    case 'I': /* fall through */
+    case 'L':
+        unpack_uint32_t(bp, (uint32_t *)dst, endian);
+        break;
+    case 'q':
+        unpack_int64_t(bp, (int64_t *)dst, endian);
+        break;
+    case 'Q':
+        unpack_uint64_t(bp, (uint64_t *)dst, endian);
+        break;
+    case 'f':
+        unpack_float(bp, (float *)dst, endian);
+        break;
+    case 'd':
+        unpack_double(bp, (double *)dst, endian);
+        break;
+    case 'v':
+        unpack_signed_varint(bp, (int64_t *)dst, endian);
+        break;
+    case 'V':
+        unpack_varint(bp, (uint64_t *)dst, endian);
+        break;
+    }
+}
+
+/*
+ * resumable decoder
  *
+ * the format string is walked one format character at a time, and a
+ * field which is split between two chunks is kept in tmp until it is
+ * complete. 's' and 'p' fields are copied into their destination as the
+ * bytes arrive.
  */
-int struct_pack(void *buf, const char *fmt, ...)
+struct struct_decoder {
+    const char *fmt;
+    const char *p;              /* next format character to scan */
+    int code;                   /* current format character, '\0' if done */
+    int rep;                    /* remaining repetitions ('s', 'p', 'x': bytes) */
+    int endian;
+    void **outs;
+    int outi;                   /* index of the current destination */
+    int stroff;                 /* bytes of the current 's'/'p' field copied */
+    unsigned char tmp[10];      /* partially received field */
+    int ntmp;
+};
+
+static void decoder_advance(struct struct_decoder *dec)
 {
-    va_list args;
-    int packed_len = 0;
+    int count;
 
-    va_start(args, fmt);
-    packed_len = pack_va_list(
-            (unsigned char*)buf, 0, fmt, args);
-    va_end(args);
+    dec->code = next_code(&dec->p, &count, &dec->endian);
+    dec->rep = (count > 0) ? count : 1;
+    dec->stroff = 0;
+    dec->ntmp = 0;
+}
 
-    return packed_len;
+static void decoder_store(struct struct_decoder *dec)
+{
+    const unsigned char *bp = dec->tmp;
+
+    /* a NULL destination skips its field, as with struct_unpack() */
+    if (dec->outs[dec->outi] != NULL) {
+        unpack_value(&bp, dec->code, dec->outs[dec->outi], dec->endian);
+    }
+    dec->outi++;
+    dec->ntmp = 0;
+    dec->rep--;
 }
 
-int struct_pack_into(int offset, void *buf, const char *fmt, ...)
+/*
+ * resumable packer
+ *
+ * the arguments are saved when the packer is created. each field is
+ * encoded into tmp and copied out as far as the window allows, so a field
+ * may be split between two windows. 's' and 'p' fields are copied straight
+ * from the caller's string.
+ */
+struct struct_packer {
+    const char *fmt;
+    const char *p;              /* next format character to scan */
+    int code;                   /* current format character, '\0' if done */
+    int rep;                    /* remaining repetitions ('s', 'p', 'x': bytes) */
+    int endian;
+    union struct_value *args;
+    int argi;                   /* index of the current argument */
+    int stroff;                 /* bytes of the current 's'/'p' field written */
+    unsigned char tmp[10];      /* the encoded current field */
+    int ntmp;                   /* encoded bytes in tmp, 0 if not encoded */
+    int tmpoff;                 /* bytes of tmp already written */
+};
+
+static void packer_advance(struct struct_packer *pk)
 {
-    va_list args;
-    int packed_len = 0;
+    int count;
 
-    va_start(args, fmt);
-    packed_len = pack_va_list(
-            (unsigned char*)buf, offset, fmt, args);
-    va_end(args);
+    pk->code = next_code(&pk->p, &count, &pk->endian);
+    pk->rep = (count > 0) ? count : 1;
+    pk->stroff = 0;
+    pk->ntmp = 0;
+}
 
-    return packed_len;
+static void packer_encode(struct struct_packer *pk)
+{
+    unsigned char *bp = pk->tmp;
+
+    pack_value(&bp, pk->code, &pk->args[pk->argi], pk->endian);
+    pk->ntmp = bp - pk->tmp;
+    pk->tmpoff = 0;
 }
 
-int struct_unpack(const void *buf, const char *fmt, ...)
+/*
+ * the encoded size of the argument at argi for format character code.
+ */
+static int packer_arg_size(const struct struct_packer *pk, int code, int argi)
 {
-    va_list args;
-    int unpacked_len = 0;
+    switch (code) {
+    case 'v':
+        return varint_size(zigzag(pk->args[argi].q));
+    case 'V':
+        return varint_size(pk->args[argi].Q);
+    default:
+        return code_size(code);
+    }
+}
 
-    va_start(args, fmt);
-    unpacked_len = unpack_va_list(
-            (const unsigned char*)buf, 0, fmt, args);
-    va_end(args);
+/*
+ * compiled format
+ *
+ * the format string is parsed once into ops, one per format character.
+ * every argument of struct_pack() is a field, and every field has a
+ * member in a record: a C struct with one member per field in format
+ * order, of the type struct_unpack() expects ('s' and 'p' fields are
+ * char arrays), laid out with natural alignment.
+ */
+struct struct_op {
+    int code;
+    int endian;
+    int count;          /* repetitions ('s', 'p', 'x': bytes), at least 1 */
+    int offset;         /* record offset of the first member */
+    int msize;          /* record size of one member */
+};
+
+struct struct_format {
+    int nops;
+    int nfields;
+    int calcsize;       /* see struct_calcsize() */
+    int fixed;          /* 1 if the format has no varints */
+    int record_size;
+    struct struct_op *ops;
+};
+
+struct align_int16_t { char c; int16_t t; };
+struct align_int32_t { char c; int32_t t; };
+struct align_int64_t { char c; int64_t t; };
+struct align_float { char c; float t; };
+struct align_double { char c; double t; };
+
+#define ALIGNOF(type) offsetof(struct align_##type, t)
+
+static int member_align(int code)
+{
+    switch (code) {
+    case 'h': /* fall through */
+    case 'H':
+        return ALIGNOF(int16_t);
+    case 'i': case 'I': case 'l': case 'L':
+        return ALIGNOF(int32_t);
+    case 'q': case 'Q': case 'v': case 'V':
+        return ALIGNOF(int64_t);
+    case 'f':
+        return ALIGNOF(float);
+    case 'd':
+        return ALIGNOF(double);
+    default:
+        return 1;
+    }
+}
 
-    return unpacked_len;
+static int member_size(int code)
+{
+    switch (code) {
+    case 'v': /* fall through */
+    case 'V':
+        return sizeof(int64_t);
+    case 's': /* fall through */
+    case 'p':
+        return 1;
+    default:
+        return code_size(code);
+    }
 }
 
-int struct_unpack_from(int offset, const void *buf, const char *fmt, ...)
+/*
+ * read the member of a record for format character code.
+ */
+static void record_value(int code, const unsigned char *member,
+        union struct_value *val)
 {
-    va_list args;
-    int unpacked_len = 0;
+    switch (code) {
+    case 'b':
+        val->q = *(const char *)member;
+        break;
+    case 'B':
+        val->Q = *member;
+        break;
+    case 'h':
+        val->q = *(const int16_t *)member;
+        break;
+    case 'H':
+        val->Q = *(const uint16_t *)member;
+        break;
+    case 'i': /* fall through */
+    case 'l':
+        val->q = *(const int32_t *)member;
+        break;
+    case 'I': /* fall through */
+    case 'L':
+        val->Q = *(const uint32_t *)member;
+        break;
+    case 'q': /* fall through */
+    case 'v':
+        val->q = *(const int64_t *)member;
+        break;
+    case 'Q': /* fall through */
+    case 'V':
+        val->Q = *(const uint64_t *)member;
+        break;
+    case 'f':
+        val->d = *(const float *)member;
+        break;
+    case 'd':
+        val->d = *(const double *)member;
+        break;
+    }
+}
 
-    va_start(args, fmt);
-    unpacked_len = unpack_va_list(
-            (const unsigned char*)buf, offset, fmt, args);
-    va_end(args);
+/*
+ * transcoding
+ *
+ * the fields of the source and destination formats are paired up in
+ * order into a list of steps, pad bytes aside. when both formats are
+ * fixed and every pair of fields has the same size and signedness, the
+ * whole conversion of a message is a byte shuffle: dst[i] is
+ * src[perm[i]], or 0 for a pad byte.
+ */
+enum {
+    TC_SKIP,            /* n source pad bytes */
+    TC_ZERO,            /* n destination pad bytes */
+    TC_STRING,          /* n source bytes into dst_n bytes */
+    TC_VALUE            /* a number */
+};
+
+struct tc_step {
+    int op;
+    int n;
+    int dst_n;
+    int src_code;
+    int src_endian;
+    int dst_code;
+    int dst_endian;
+};
+
+struct tc_plan {
+    struct tc_step *steps;
+    int nsteps;
+    int src_size;       /* fixed message sizes, -1 with varints */
+    int dst_size;
+    int *perm;          /* byte shuffle, NULL if there is none */
+    unsigned char *mask;
+};
+
+static int code_kind(int code)
+{
+    switch (code) {
+    case 'f': /* fall through */
+    case 'd':
+        return 'f';
+    case 's': /* fall through */
+    case 'p':
+        return 's';
+    default:
+        return 'i';
+    }
+}
 
-    return unpacked_len;
+static int code_signed(int code)
+{
+    return (strchr("bhilqv", code) != NULL);
 }
 
-int struct_calcsize(const char *fmt)
+/*
+ * whether the number val of format character src fits in a field of
+ * format character dst.
+ */
+static int value_fits(int src, int dst, const union struct_value *val)
 {
-    INIT_REPETITION();
-    int ret = 0;
-    const char *p;
+    uint64_t max;
+    int64_t min;
 
-    if (STRUCT_ENDIAN_NOT_SET == myendian) {
-        struct_init();
+    if (code_kind(dst) == 'f') {
+        return !(dst == 'f' && isfinite(val->d) && fabs(val->d) > FLT_MAX);
     }
 
-    for (p = fmt; *p != '\0'; p++) {
-        switch (*p) {
-        case '=': /* fall through */
-        case '<': /* fall through */
-        case '>': /* fall through */
-        case '!': /* ignore endian characters */
-            break;
-        case 'b':
-            BEGIN_REPETITION();
-            ret += sizeof(int8_t);
-            END_REPETITION();
+    switch (dst) {
+    case 'b': min = INT8_MIN; max = INT8_MAX; break;
+    case 'B': min = 0; max = UINT8_MAX; break;
+    case 'h': min = INT16_MIN; max = INT16_MAX; break;
+    case 'H': min = 0; max = UINT16_MAX; break;
+    case 'i': case 'l': min = INT32_MIN; max = INT32_MAX; break;
+    case 'I': case 'L': min = 0; max = UINT32_MAX; break;
+    case 'q': case 'v': min = INT64_MIN; max = INT64_MAX; break;
+    default: min = 0; max = UINT64_MAX; break;
+    }
+
+    if (code_signed(src) && val->q < 0) {
+        return (val->q >= min);
+    }
+    return (val->Q <= max);
+}
+
+static void tc_plan_free(struct tc_plan *plan)
+{
+    free(plan->steps);
+    free(plan->perm);
+    free(plan->mask);
+}
+
+/* the byte shuffle of a plan, if both formats are fixed and compatible */
+static void tc_plan_shuffle(struct tc_plan *plan)
+{
+    const struct tc_step *step;
+    int src = 0;
+    int dst = 0;
+    int size;
+    int i;
+
+    for (step = plan->steps; step < plan->steps + plan->nsteps; step++) {
+        if (step->op == TC_STRING && step->n != step->dst_n) {
+            return;
+        }
+        if (step->op == TC_VALUE &&
+                (code_size(step->src_code) != code_size(step->dst_code) ||
+                 (step->src_endian != step->dst_endian &&
+                  (step->src_endian == STRUCT_ENDIAN_ORDERED ||
+                   step->dst_endian == STRUCT_ENDIAN_ORDERED)) ||
+                 code_kind(step->src_code) != code_kind(step->dst_code) ||
+                 code_signed(step->src_code) != code_signed(step->dst_code))) {
+            return;
+        }
+    }
+
+    plan->perm = malloc((plan->dst_size + 1) * sizeof(*plan->perm));
+    plan->mask = malloc(plan->dst_size + 1);
+    if (plan->perm == NULL || plan->mask == NULL) {
+        free(plan->perm);
+        free(plan->mask);
+        plan->perm = NULL;
+        plan->mask = NULL;
+        return;
+    }
+
+    for (step = plan->steps; step < plan->steps + plan->nsteps; step++) {
+        switch (step->op) {
+        case TC_SKIP:
+            src += step->n;
             break;
-        case 'B':
-            BEGIN_REPETITION();
-            ret += sizeof(uint8_t);
-            END_REPETITION();
+        case TC_ZERO:
+            for (i = 0; i < step->n; i++, dst++) {
+                plan->perm[dst] = 0;
+                plan->mask[dst] = 0;
+            }
             break;
-        case 'h':
-            BEGIN_REPETITION();
-            ret += sizeof(int16_t);
-            END_REPETITION();
+        case TC_STRING:
+            for (i = 0; i < step->n; i++, dst++) {
+                plan->perm[dst] = src + i;
+                plan->mask[dst] = 0xFF;
+            }
+            src += step->n;
             break;
-        case 'H':
-            BEGIN_REPETITION();
-            ret += sizeof(uint16_t);
-            END_REPETITION();
+        default:
+            size = code_size(step->src_code);
+            for (i = 0; i < size; i++, dst++) {
+                plan->perm[dst] = (size == 1 ||
+                        step->src_endian == step->dst_endian) ?
+                    src + i : src + size - 1 - i;
+                plan->mask[dst] = 0xFF;
+            }
+            src += size;
+        }
+    }
+}
+
+/*
+ * pair the fields of two formats.
+ * returns 0 on success, -1 if the formats do not compile or their
+ * fields do not match.
+ */
+static int tc_plan_new(struct tc_plan *plan, const char *src_fmt,
+        const char *dst_fmt)
+{
+    struct struct_format *src = struct_compile(src_fmt);
+    struct struct_format *dst = struct_compile(dst_fmt);
+    const struct struct_op *sop, *dop;
+    struct tc_step *step;
+    int si = 0;
+    int di = 0;
+    int ret = -1;
+
+    memset(plan, 0, sizeof(*plan));
+    if (src == NULL || dst == NULL || src->nfields != dst->nfields) {
+        goto out;
+    }
+
+    plan->steps = malloc((src->nops + dst->nops + src->nfields + 1) *
+            sizeof(*plan->steps));
+    if (plan->steps == NULL) {
+        goto out;
+    }
+
+    sop = src->ops;
+    dop = dst->ops;
+    for (;;) {
+        step = &plan->steps[plan->nsteps];
+        if (sop < src->ops + src->nops && sop->code == 'x') {
+            step->op = TC_SKIP;
+            step->n = sop->count;
+            plan->nsteps++;
+            sop++;
+            continue;
+        }
+        if (dop < dst->ops + dst->nops && dop->code == 'x') {
+            step->op = TC_ZERO;
+            step->n = dop->count;
+            plan->nsteps++;
+            dop++;
+            continue;
+        }
+        if (sop == src->ops + src->nops || dop == dst->ops + dst->nops) {
             break;
-        case 'i': /* fall through */
-        case 'l':
-            BEGIN_REPETITION();
-            ret += sizeof(int32_t);
-            END_REPETITION();
+        }
+        if (code_kind(sop->code) != code_kind(dop->code)) {
+            goto out;
+        }
+
+        step->src_code = sop->code;
+        step->src_endian = sop->endian;
+        step->dst_code = dop->code;
+        step->dst_endian = dop->endian;
+        if (code_kind(sop->code) == 's') {
+            step->op = TC_STRING;
+            step->n = sop->count;
+            step->dst_n = dop->count;
+            si = sop->count;
+            di = dop->count;
+        } else {
+            step->op = TC_VALUE;
+            si++;
+            di++;
+        }
+        plan->nsteps++;
+
+        /* one field at a time out of repeated format characters */
+        if (si == sop->count) {
+            sop++;
+            si = 0;
+        }
+        if (di == dop->count) {
+            dop++;
+            di = 0;
+        }
+    }
+
+    plan->src_size = src->fixed ? src->calcsize : -1;
+    plan->dst_size = dst->fixed ? dst->calcsize : -1;
+    if (plan->src_size >= 0 && plan->dst_size >= 0) {
+        tc_plan_shuffle(plan);
+    }
+    ret = 0;
+
+out:
+    if (ret < 0) {
+        tc_plan_free(plan);
+    }
+    struct_format_free(src);
+    struct_format_free(dst);
+    return ret;
+}
+
+/*
+ * transcode one message along the steps of a plan.
+ * returns the number of values which did not fit their destination.
+ */
+static int tc_message(const struct tc_plan *plan, const unsigned char **sp,
+        unsigned char **dp)
+{
+    const struct tc_step *step;
+    union struct_value val;
+    union {
+        int64_t q;
+        double d;
+        float f;
+    } member;
+    int overflows = 0;
+
+    for (step = plan->steps; step < plan->steps + plan->nsteps; step++) {
+        switch (step->op) {
+        case TC_SKIP:
+            *sp += step->n;
             break;
-        case 'I': /* fall through */
-        case 'L':
-            BEGIN_REPETITION();
-            ret += sizeof(uint32_t);
-            END_REPETITION();
+        case TC_ZERO:
+            memset(*dp, 0, step->n);
+            *dp += step->n;
             break;
-        case 'q':
-            BEGIN_REPETITION();
-            ret += sizeof(int64_t);
-            END_REPETITION();
+        case TC_STRING:
+            if (step->n >= step->dst_n) {
+                memcpy(*dp, *sp, step->dst_n);
+            } else {
+                memcpy(*dp, *sp, step->n);
+                memset(*dp + step->n, 0, step->dst_n - step->n);
+            }
+            *sp += step->n;
+            *dp += step->dst_n;
             break;
-        case 'Q':
-            BEGIN_REPETITION();
-            ret += sizeof(uint64_t);
-            END_REPETITION();
+        default:
+            unpack_value(sp, step->src_code, &member, step->src_endian);
+            record_value(step->src_code, (const unsigned char *)&member,
+                    &val);
+            if (!value_fits(step->src_code, step->dst_code, &val)) {
+                overflows++;
+            }
+            pack_value(dp, step->dst_code, &val, step->dst_endian);
+        }
+    }
+    return overflows;
+}
+
+/*
+ * the length of the packed field of format character code at bp ('s',
+ * 'p' and 'x' have count bytes).
+ */
+static int field_length(int code, int count, const unsigned char *bp)
+{
+    const unsigned char *p = bp;
+
+    switch (code) {
+    case 's': case 'p': case 'x':
+        return count;
+    case 'v': /* fall through */
+    case 'V':
+        while (p < bp + 9 && (*p & 0x80)) {
+            p++;
+        }
+        return (p - bp + 1);
+    default:
+        return code_size(code);
+    }
+}
+
+/*
+ * the exact size of the message struct_pack() encodes for fmt and args,
+ * -1 on an invalid format.
+ */
+static int calcsize_va_list(const char *fmt, va_list args)
+{
+    INIT_REPETITION();
+    va_list ap;
+    union struct_value val;
+    const char *p;
+    int opt = 0;                /* 1 if an optional field is pending */
+    int present = 1;
+    int n;
+    int ret;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    ret = (count_optional(fmt) + 7) / 8;
+    va_copy(ap, args);
+    for (p = fmt; *p != '\0'; p++) {
+        switch (*p) {
+        case '=': /* fall through */
+        case '<': /* fall through */
+        case '>': /* fall through */
+        case '!': /* fall through */
+        case '^': /* ignore endian characters */
             break;
-        case 'f':
-            BEGIN_REPETITION();
-            ret += sizeof(int32_t); // see pack_float()
-            END_REPETITION();
+        case '?':
+            if (opt) {
+                va_end(ap);
+                return -1;
+            }
+            opt = 1;
+            present = va_arg(ap, int);
             break;
-        case 'd':
+        case 'b': case 'B': case 'h': case 'H': case 'i': case 'I':
+        case 'l': case 'L': case 'q': case 'Q': case 'f': case 'd':
+            n = 0;
             BEGIN_REPETITION();
-            ret += sizeof(int64_t); // see pack_double()
+                va_value(*p, &ap, &val);
+                n += code_size(*p);
             END_REPETITION();
+            ret += present ? n : 0;
             break;
         case 's': /* fall through */
         case 'p':
-            BEGIN_REPETITION();
-            ret += sizeof(int8_t);
-            END_REPETITION();
-            break;
+            va_value(*p, &ap, &val);
+            /* fall through */
         case 'x':
-            BEGIN_REPETITION();
-            ret += sizeof(int8_t);
-            END_REPETITION();
+            ret += present ? ((_struct_rep > 0) ? _struct_rep : 1) : 0;
             break;
         case 'v':
             BEGIN_REPETITION();
-            ret += 10;
+                va_value(*p, &ap, &val);
+                ret += present ? varint_size(zigzag(val.q)) : 0;
             END_REPETITION();
             break;
         case 'V':
             BEGIN_REPETITION();
-            ret += 10;
+                va_value(*p, &ap, &val);
+                ret += present ? varint_size(val.Q) : 0;
             END_REPETITION();
             break;
         default:
             if (isdigit((int)*p)) {
                 INC_REPETITION();
             } else {
+                va_end(ap);
                 return -1;
             }
         }
 
         if (!isdigit((int)*p)) {
             CLEAR_REPETITION();
+            if (strchr("=<>!^?", *p) == NULL) {
+                opt = 0;
+                present = 1;
+            }
         }
     }
+    va_end(ap);
     return ret;
 }
+
+/*
+ * EXPORT
+ *
+ * preifx: struct_
+ *
+ */
+int struct_pack(void *buf, const char *fmt, ...)
+{
+    va_list args;
+    int packed_len = 0;
+
+    va_start(args, fmt);
+    packed_len = pack_va_list(
+            (unsigned char*)buf, 0, -1, fmt, args);
+    va_end(args);
+
+    return packed_len;
+}
+
+int struct_pack_into(int offset, void *buf, const char *fmt, ...)
+{
+    va_list args;
+    int packed_len = 0;
+
+    va_start(args, fmt);
+    packed_len = pack_va_list(
+            (unsigned char*)buf, offset, -1, fmt, args);
+    va_end(args);
+
+    return packed_len;
+}
+
+int struct_pack_va_list(
+    void *buf,
+    int offset,
+    const char *fmt,
+    va_list args)
+{
+    return pack_va_list((unsigned char*)buf, offset, -1, fmt, args);
+}
+
+int struct_calcsize_va_list(const char *fmt, va_list args)
+{
+    return calcsize_va_list(fmt, args);
+}
+
+int struct_pack_va_list_checked(
+    void *buf,
+    int offset,
+    int size,
+    const char *fmt,
+    va_list args)
+{
+    va_list copy;
+    int packed_len;
+
+    /* a negative size would turn the checks off */
+    if (size < 0 || offset < 0 || offset > size) {
+        return -1;
+    }
+    va_copy(copy, args);
+    packed_len = pack_va_list((unsigned char*)buf, offset, size, fmt, args);
+    if (packed_len == PACK_OVERFLOW) {
+        packed_len = calcsize_va_list(fmt, copy);
+        if (packed_len >= 0) {
+            packed_len += offset;
+        }
+    }
+    va_end(copy);
+
+    return packed_len;
+}
+
+void struct_record_value(
+    int code,
+    const void *member,
+    union struct_value *val)
+{
+    record_value(code, (const unsigned char *)member, val);
+}
+
+int struct_key_width(const struct struct_field *field)
+{
+    return (field->code == 's' || field->code == 'p') ? field->size : 8;
+}
+
+void struct_key_encode(
+    const struct struct_field *field,
+    const void *record,
+    unsigned char *key)
+{
+    const unsigned char *member = (const unsigned char *)record +
+        field->offset;
+    union struct_value val;
+
+    switch (field->code) {
+    case 's': /* fall through */
+    case 'p':
+        memcpy(key, member, field->size);
+        return;
+    }
+
+    record_value(field->code, member, &val);
+    switch (field->code) {
+    case 'f': /* fall through */
+    case 'd':
+        pack_double(&key, val.d, STRUCT_ENDIAN_ORDERED);
+        break;
+    case 'b': case 'h': case 'i': case 'l': case 'q': case 'v':
+        pack_int64_t(&key, ORDER_SIGN(val.Q, 64, STRUCT_ENDIAN_ORDERED),
+                STRUCT_ENDIAN_ORDERED);
+        break;
+    default:
+        pack_int64_t(&key, val.Q, STRUCT_ENDIAN_ORDERED);
+    }
+}
+
+int struct_unpack(const void *buf, const char *fmt, ...)
+{
+    va_list args;
+    int unpacked_len = 0;
+
+    va_start(args, fmt);
+    unpacked_len = unpack_va_list(
+            (const unsigned char*)buf, 0, -1, fmt, 0, args);
+    va_end(args);
+
+    return unpacked_len;
+}
+
+int struct_unpack_from(int offset, const void *buf, const char *fmt, ...)
+{
+    va_list args;
+    int unpacked_len = 0;
+
+    va_start(args, fmt);
+    unpacked_len = unpack_va_list(
+            (const unsigned char*)buf, offset, -1, fmt, 0, args);
+    va_end(args);
+
+    return unpacked_len;
+}
+
+int struct_unpack_view(const void *buf, const char *fmt, ...)
+{
+    va_list args;
+    int unpacked_len = 0;
+
+    va_start(args, fmt);
+    unpacked_len = unpack_va_list(
+            (const unsigned char*)buf, 0, -1, fmt, UNPACK_STRING_VIEW, args);
+    va_end(args);
+
+    return unpacked_len;
+}
+
+int struct_unpack_view_from(
+    int offset,
+    const void *buf,
+    const char *fmt,
+    ...)
+{
+    va_list args;
+    int unpacked_len = 0;
+
+    va_start(args, fmt);
+    unpacked_len = unpack_va_list(
+            (const unsigned char*)buf, offset, -1, fmt, UNPACK_STRING_VIEW,
+            args);
+    va_end(args);
+
+    return unpacked_len;
+}
+
+int struct_pack_checked(void *buf, int size, const char *fmt, ...)
+{
+    va_list args;
+    int packed_len = 0;
+
+    va_start(args, fmt);
+    packed_len = struct_pack_va_list_checked(buf, 0, size, fmt, args);
+    va_end(args);
+
+    return packed_len;
+}
+
+int struct_pack_into_checked(
+    int offset,
+    void *buf,
+    int size,
+    const char *fmt,
+    ...)
+{
+    va_list args;
+    int packed_len = 0;
+
+    va_start(args, fmt);
+    packed_len = struct_pack_va_list_checked(buf, offset, size, fmt, args);
+    va_end(args);
+
+    return packed_len;
+}
+
+int struct_unpack_checked(const void *buf, int size, const char *fmt, ...)
+{
+    va_list args;
+    int unpacked_len = 0;
+
+    /* a negative size would turn the checks off */
+    if (size < 0) {
+        return -1;
+    }
+    va_start(args, fmt);
+    unpacked_len = unpack_va_list(
+            (const unsigned char*)buf, 0, size, fmt, 0, args);
+    va_end(args);
+
+    return unpacked_len;
+}
+
+int struct_unpack_from_checked(
+    int offset,
+    const void *buf,
+    int size,
+    const char *fmt,
+    ...)
+{
+    va_list args;
+    int unpacked_len = 0;
+
+    if (size < 0 || offset < 0 || offset > size) {
+        return -1;
+    }
+    va_start(args, fmt);
+    unpacked_len = unpack_va_list(
+            (const unsigned char*)buf, offset, size, fmt, 0, args);
+    va_end(args);
+
+    return unpacked_len;
+}
+
+int struct_validate(const char *fmt, const void *buf, int len)
+{
+    INIT_REPETITION();
+    const unsigned char *bitmap = (const unsigned char *)buf;
+    const unsigned char *end = bitmap + len;
+    const unsigned char *bp;
+    const char *p;
+    int opt = -1;               /* index of the pending optional field */
+    int nopt = 0;
+    int present = 1;
+    int n;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    n = (count_optional(fmt) + 7) / 8;
+    if (len < n) {
+        return -1;
+    }
+    bp = bitmap + n;
+    for (p = fmt; *p != '\0'; p++) {
+        switch (*p) {
+        case '=': /* fall through */
+        case '<': /* fall through */
+        case '>': /* fall through */
+        case '!': /* fall through */
+        case '^': /* ignore endian characters */
+            break;
+        case '?':
+            if (opt >= 0) {
+                return -1;
+            }
+            opt = nopt++;
+            present = (bitmap[opt / 8] >> (opt % 8)) & 1;
+            break;
+        case 'b': case 'B': case 'h': case 'H': case 'i': case 'I':
+        case 'l': case 'L': case 'q': case 'Q': case 'f': case 'd':
+        case 's': case 'p': case 'x':
+            /* a run of fixed size fields is checked at once */
+            n = (code_size(*p) > 0) ? code_size(*p) : 1;
+            n *= (_struct_rep > 0) ? _struct_rep : 1;
+            if (present) {
+                if (end - bp < n) {
+                    return -1;
+                }
+                bp += n;
+            }
+            break;
+        case 'v': /* fall through */
+        case 'V':
+            if (present) {
+                BEGIN_REPETITION();
+                    n = varint_length(bp, end - bp);
+                    if (n < 0) {
+                        return -1;
+                    }
+                    bp += n;
+                END_REPETITION();
+            }
+            break;
+        default:
+            if (isdigit((int)*p)) {
+                INC_REPETITION();
+            } else {
+                return -1;
+            }
+        }
+
+        if (!isdigit((int)*p)) {
+            CLEAR_REPETITION();
+            if (strchr("=<>!^?", *p) == NULL) {
+                opt = -1;
+                present = 1;
+            }
+        }
+    }
+    return (bp - (const unsigned char *)buf);
+}
+
+int struct_calcsize(const char *fmt)
+{
+    INIT_REPETITION();
+    int ret = 0;
+    const char *p;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    ret = (count_optional(fmt) + 7) / 8;
+    for (p = fmt; *p != '\0'; p++) {
+        switch (*p) {
+        case '=': /* fall through */
+        case '<': /* fall through */
+        case '>': /* fall through */
+        case '!': /* fall through */
+        case '^': /* ignore endian characters */
+            break;
+        case '?': /* optional fields are counted as present */
+            break;
+        case 'b':
+            BEGIN_REPETITION();
+            ret += sizeof(int8_t);
+            END_REPETITION();
+            break;
+        case 'B':
+            BEGIN_REPETITION();
+            ret += sizeof(uint8_t);
+            END_REPETITION();
+            break;
+        case 'h':
+            BEGIN_REPETITION();
+            ret += sizeof(int16_t);
+            END_REPETITION();
+            break;
+        case 'H':
+            BEGIN_REPETITION();
+            ret += sizeof(uint16_t);
+            END_REPETITION();
+            break;
+        case 'i': /* fall through */
+        case 'l':
+            BEGIN_REPETITION();
+            ret += sizeof(int32_t);
+            END_REPETITION();
+            break;
+        case 'I': /* fall through */
+        case 'L':
+            BEGIN_REPETITION();
+            ret += sizeof(uint32_t);
+            END_REPETITION();
+            break;
+        case 'q':
+            BEGIN_REPETITION();
+            ret += sizeof(int64_t);
+            END_REPETITION();
+            break;
+        case 'Q':
+            BEGIN_REPETITION();
+            ret += sizeof(uint64_t);
+            END_REPETITION();
+            break;
+        case 'f':
+            BEGIN_REPETITION();
+            ret += sizeof(int32_t); // see pack_float()
+            END_REPETITION();
+            break;
+        case 'd':
+            BEGIN_REPETITION();
+            ret += sizeof(int64_t); // see pack_double()
+            END_REPETITION();
+            break;
+        case 's': /* fall through */
+        case 'p':
+            BEGIN_REPETITION();
+            ret += sizeof(int8_t);
+            END_REPETITION();
+            break;
+        case 'x':
+            BEGIN_REPETITION();
+            ret += sizeof(int8_t);
+            END_REPETITION();
+            break;
+        case 'v':
+            BEGIN_REPETITION();
+            ret += 10;
+            END_REPETITION();
+            break;
+        case 'V':
+            BEGIN_REPETITION();
+            ret += 10;
+            END_REPETITION();
+            break;
+        default:
+            if (isdigit((int)*p)) {
+                INC_REPETITION();
+            } else {
+                return -1;
+            }
+        }
+
+        if (!isdigit((int)*p)) {
+            CLEAR_REPETITION();
+        }
+    }
+    return ret;
+}
+
+int struct_calcsize_values(const char *fmt, ...)
+{
+    va_list args;
+    int size;
+
+    va_start(args, fmt);
+    size = calcsize_va_list(fmt, args);
+    va_end(args);
+
+    return size;
+}
+
+struct_decoder *struct_decoder_new(const char *fmt, ...)
+{
+    va_list args;
+    struct struct_decoder *dec;
+    size_t fmtlen;
+    int nouts;
+    int i;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    nouts = count_args(fmt);
+    if (nouts < 0) {
+        return NULL;
+    }
+
+    fmtlen = strlen(fmt) + 1;
+    dec = malloc(sizeof(*dec) + nouts * sizeof(void *) + fmtlen);
+    if (dec == NULL) {
+        return NULL;
+    }
+    dec->outs = (void **)(dec + 1);
+    dec->fmt = memcpy(dec->outs + nouts, fmt, fmtlen);
+
+    va_start(args, fmt);
+    for (i = 0; i < nouts; i++) {
+        dec->outs[i] = va_arg(args, void *);
+    }
+    va_end(args);
+
+    struct_decoder_reset(dec);
+    return dec;
+}
+
+void struct_decoder_reset(struct_decoder *dec)
+{
+    dec->p = dec->fmt;
+    dec->endian = myendian;
+    dec->outi = 0;
+    decoder_advance(dec);
+}
+
+int struct_decoder_feed(struct_decoder *dec, const void *data, int len)
+{
+    const unsigned char *bp = (const unsigned char *)data;
+    const unsigned char *end = bp + len;
+    int n;
+
+    while (dec->code != '\0' && bp < end) {
+        switch (dec->code) {
+        case 's': /* fall through */
+        case 'p':
+            n = (end - bp < dec->rep) ? (int)(end - bp) : dec->rep;
+            if (dec->outs[dec->outi] != NULL) {
+                memcpy((char *)dec->outs[dec->outi] + dec->stroff, bp, n);
+            }
+            dec->stroff += n;
+            dec->rep -= n;
+            bp += n;
+            if (dec->rep == 0) {
+                dec->outi++;
+            }
+            break;
+        case 'x':
+            n = (end - bp < dec->rep) ? (int)(end - bp) : dec->rep;
+            dec->rep -= n;
+            bp += n;
+            break;
+        case 'v': /* fall through */
+        case 'V':
+            dec->tmp[dec->ntmp++] = *bp;
+            if (!(*bp++ & 0x80) || dec->ntmp == sizeof(dec->tmp)) {
+                decoder_store(dec);
+            }
+            break;
+        default:
+            n = code_size(dec->code) - dec->ntmp;
+            n = (end - bp < n) ? (int)(end - bp) : n;
+            memcpy(dec->tmp + dec->ntmp, bp, n);
+            dec->ntmp += n;
+            bp += n;
+            if (dec->ntmp == code_size(dec->code)) {
+                decoder_store(dec);
+            }
+        }
+
+        if (dec->rep == 0) {
+            decoder_advance(dec);
+        }
+    }
+    return (bp - (const unsigned char *)data);
+}
+
+int struct_decoder_needed(const struct_decoder *dec)
+{
+    const char *p = dec->p;
+    int endian = dec->endian;
+    int code = dec->code;
+    int count;
+    int ret;
+
+    if (code == '\0') {
+        return 0;
+    }
+
+    /* the rest of the current format character */
+    if (code_size(code) > 0) {
+        ret = dec->rep * code_size(code) - dec->ntmp;
+    } else {
+        ret = dec->rep; /* bytes, or at least one byte per varint */
+    }
+
+    while ((code = next_code(&p, &count, &endian)) > 0) {
+        if (count == 0) {
+            count = 1;
+        }
+        if (code_size(code) > 0) {
+            ret += count * code_size(code);
+        } else {
+            ret += count;
+        }
+    }
+    return ret;
+}
+
+void struct_decoder_free(struct_decoder *dec)
+{
+    free(dec);
+}
+
+struct_packer *struct_packer_new(const char *fmt, ...)
+{
+    va_list args;
+    struct struct_packer *pk;
+    union struct_value *arg;
+    const char *p;
+    size_t fmtlen;
+    int endian;
+    int count;
+    int code;
+    int nargs;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    nargs = count_args(fmt);
+    if (nargs < 0) {
+        return NULL;
+    }
+
+    fmtlen = strlen(fmt) + 1;
+    pk = malloc(sizeof(*pk) + nargs * sizeof(union struct_value) + fmtlen);
+    if (pk == NULL) {
+        return NULL;
+    }
+    pk->args = (union struct_value *)(pk + 1);
+    pk->fmt = memcpy(pk->args + nargs, fmt, fmtlen);
+
+    arg = pk->args;
+    p = fmt;
+    endian = myendian;
+    va_start(args, fmt);
+    while ((code = next_code(&p, &count, &endian)) > 0) {
+        if (code == 'x') {
+            continue;
+        }
+        if (code == 's' || code == 'p') {
+            va_value(code, &args, arg++);
+            continue;
+        }
+        INIT_REPETITION();
+        _struct_rep = count;
+        BEGIN_REPETITION();
+            va_value(code, &args, arg++);
+        END_REPETITION();
+    }
+    va_end(args);
+
+    struct_packer_reset(pk);
+    return pk;
+}
+
+void struct_packer_reset(struct_packer *pk)
+{
+    pk->p = pk->fmt;
+    pk->endian = myendian;
+    pk->argi = 0;
+    packer_advance(pk);
+}
+
+int struct_packer_pack(struct_packer *pk, void *window, int size)
+{
+    unsigned char *bp = (unsigned char *)window;
+    unsigned char *end = bp + size;
+    int n;
+
+    while (pk->code != '\0' && bp < end) {
+        switch (pk->code) {
+        case 's': /* fall through */
+        case 'p':
+            n = (end - bp < pk->rep) ? (int)(end - bp) : pk->rep;
+            memcpy(bp, pk->args[pk->argi].s + pk->stroff, n);
+            pk->stroff += n;
+            pk->rep -= n;
+            bp += n;
+            if (pk->rep == 0) {
+                pk->argi++;
+            }
+            break;
+        case 'x':
+            n = (end - bp < pk->rep) ? (int)(end - bp) : pk->rep;
+            memset(bp, 0, n);
+            pk->rep -= n;
+            bp += n;
+            break;
+        default:
+            if (pk->ntmp == 0) {
+                packer_encode(pk);
+            }
+            n = pk->ntmp - pk->tmpoff;
+            n = (end - bp < n) ? (int)(end - bp) : n;
+            memcpy(bp, pk->tmp + pk->tmpoff, n);
+            pk->tmpoff += n;
+            bp += n;
+            if (pk->tmpoff == pk->ntmp) {
+                pk->ntmp = 0;
+                pk->argi++;
+                pk->rep--;
+            }
+        }
+
+        if (pk->rep == 0) {
+            packer_advance(pk);
+        }
+    }
+    return (bp - (unsigned char *)window);
+}
+
+int struct_packer_remaining(const struct_packer *pk)
+{
+    const char *p = pk->p;
+    int endian = pk->endian;
+    int code = pk->code;
+    int argi = pk->argi;
+    int count;
+    int ret = 0;
+
+    if (code == '\0') {
+        return 0;
+    }
+
+    /* the rest of the current format character */
+    if (code == 's' || code == 'p' || code == 'x') {
+        ret = pk->rep;
+    } else {
+        count = pk->rep;
+        if (pk->ntmp > 0) {
+            ret += pk->ntmp - pk->tmpoff;
+            argi++;
+            count--;
+        }
+        for (; count > 0; count--) {
+            ret += packer_arg_size(pk, code, argi++);
+        }
+    }
+    if (code == 's' || code == 'p') {
+        argi++;
+    }
+
+    while ((code = next_code(&p, &count, &endian)) > 0) {
+        if (count == 0) {
+            count = 1;
+        }
+        if (code == 's' || code == 'p') {
+            ret += count;
+            argi++;
+        } else if (code == 'x') {
+            ret += count;
+        } else {
+            for (; count > 0; count--) {
+                ret += packer_arg_size(pk, code, argi++);
+            }
+        }
+    }
+    return ret;
+}
+
+void struct_packer_free(struct_packer *pk)
+{
+    free(pk);
+}
+
+struct_format *struct_compile(const char *fmt)
+{
+    struct struct_format *sf;
+    struct struct_op *op;
+    const char *p;
+    int endian;
+    int count;
+    int code;
+    int nops = 0;
+    int nfields;
+    int offset = 0;
+    int align = 1;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    nfields = count_args(fmt);
+    if (nfields < 0) {
+        return NULL;
+    }
+    p = fmt;
+    endian = myendian;
+    while (next_code(&p, &count, &endian) > 0) {
+        nops++;
+    }
+
+    sf = malloc(sizeof(*sf) + nops * sizeof(*op));
+    if (sf == NULL) {
+        return NULL;
+    }
+    sf->ops = (struct struct_op *)(sf + 1);
+    sf->nops = nops;
+    sf->nfields = nfields;
+    sf->fixed = 1;
+
+    op = sf->ops;
+    p = fmt;
+    endian = myendian;
+    while ((code = next_code(&p, &count, &endian)) > 0) {
+        op->code = code;
+        op->endian = endian;
+        op->count = (count > 0) ? count : 1;
+        op->msize = member_size(code);
+
+        if (member_align(code) > align) {
+            align = member_align(code);
+        }
+        offset = (offset + member_align(code) - 1) / member_align(code)
+            * member_align(code);
+        op->offset = offset;
+
+        if (code != 'x') {
+            offset += op->count * op->msize;
+        }
+        if (code == 'v' || code == 'V') {
+            sf->fixed = 0;
+        }
+        op++;
+    }
+    sf->record_size = (offset + align - 1) / align * align;
+    sf->calcsize = struct_calcsize(fmt);
+    return sf;
+}
+
+void struct_format_free(struct_format *sf)
+{
+    free(sf);
+}
+
+int struct_format_calcsize(const struct_format *sf)
+{
+    return sf->calcsize;
+}
+
+int struct_format_is_fixed(const struct_format *sf)
+{
+    return sf->fixed;
+}
+
+int struct_format_calcsize_record(
+    const struct_format *sf,
+    const void *record)
+{
+    const struct struct_op *op;
+    const unsigned char *rp;
+    union struct_value val;
+    int ret = 0;
+    int i;
+
+    if (sf->fixed) {
+        return sf->calcsize;
+    }
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        rp = (const unsigned char *)record + op->offset;
+        switch (op->code) {
+        case 'v':
+            for (i = 0; i < op->count; i++, rp += op->msize) {
+                record_value(op->code, rp, &val);
+                ret += varint_size(zigzag(val.q));
+            }
+            break;
+        case 'V':
+            for (i = 0; i < op->count; i++, rp += op->msize) {
+                record_value(op->code, rp, &val);
+                ret += varint_size(val.Q);
+            }
+            break;
+        case 's': case 'p': case 'x':
+            ret += op->count;
+            break;
+        default:
+            ret += op->count * code_size(op->code);
+        }
+    }
+    return ret;
+}
+
+int struct_format_calcsize_values(const struct_format *sf, ...)
+{
+    va_list args;
+    const struct struct_op *op;
+    union struct_value val;
+    int ret = 0;
+    int i;
+
+    if (sf->fixed) {
+        return sf->calcsize;
+    }
+
+    va_start(args, sf);
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        switch (op->code) {
+        case 'v':
+            for (i = 0; i < op->count; i++) {
+                va_value(op->code, &args, &val);
+                ret += varint_size(zigzag(val.q));
+            }
+            break;
+        case 'V':
+            for (i = 0; i < op->count; i++) {
+                va_value(op->code, &args, &val);
+                ret += varint_size(val.Q);
+            }
+            break;
+        case 's': /* fall through */
+        case 'p':
+            va_value(op->code, &args, &val);
+            /* fall through */
+        case 'x':
+            ret += op->count;
+            break;
+        default:
+            for (i = 0; i < op->count; i++) {
+                va_value(op->code, &args, &val);
+            }
+            ret += op->count * code_size(op->code);
+        }
+    }
+    va_end(args);
+    return ret;
+}
+
+long struct_format_calcsize_records(
+    const struct_format *sf,
+    const void *records,
+    long count)
+{
+    const unsigned char *rp = (const unsigned char *)records;
+    long ret = 0;
+    long i;
+
+    if (sf->fixed) {
+        return count * sf->calcsize;
+    }
+    for (i = 0; i < count; i++, rp += sf->record_size) {
+        ret += struct_format_calcsize_record(sf, rp);
+    }
+    return ret;
+}
+
+int struct_format_length(
+    const struct_format *sf,
+    const void *buf,
+    int len)
+{
+    const struct struct_op *op;
+    const unsigned char *bp = (const unsigned char *)buf;
+    const unsigned char *end = bp + len;
+    int n;
+    int i;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        if (op->code == 'v' || op->code == 'V') {
+            for (i = 0; i < op->count; i++) {
+                n = varint_length(bp, end - bp);
+                if (n < 0) {
+                    return -1;
+                }
+                bp += n;
+            }
+        } else {
+            n = (code_size(op->code) > 0) ? op->count * code_size(op->code)
+                : op->count;
+            if (end - bp < n) {
+                return -1;
+            }
+            bp += n;
+        }
+    }
+    return (bp - (const unsigned char *)buf);
+}
+
+long struct_format_validate(
+    const struct_format *sf,
+    const void *buf,
+    long len,
+    long count)
+{
+    const unsigned char *bp = (const unsigned char *)buf;
+    long avail;
+    long i;
+    int n;
+
+    if (len < 0 || count < 0) {
+        return -1;
+    }
+    if (sf->fixed) {
+        if (sf->calcsize > 0 && count > len / sf->calcsize) {
+            return -1;
+        }
+        return count * sf->calcsize;
+    }
+
+    for (i = 0; i < count; i++) {
+        avail = len - (bp - (const unsigned char *)buf);
+        n = struct_format_length(sf, bp, (avail < INT_MAX) ? avail : INT_MAX);
+        if (n < 0) {
+            return -1;
+        }
+        bp += n;
+    }
+    return (bp - (const unsigned char *)buf);
+}
+
+int struct_format_nfields(const struct_format *sf)
+{
+    return sf->nfields;
+}
+
+int struct_format_record_size(const struct_format *sf)
+{
+    return sf->record_size;
+}
+
+int struct_format_field(
+    const struct_format *sf,
+    int index,
+    struct struct_field *field)
+{
+    const struct struct_op *op;
+    int position = 0;
+    int n;
+
+    if (index < 0) {
+        return -1;
+    }
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        switch (op->code) {
+        case 'x':
+            n = 0;
+            break;
+        case 's': /* fall through */
+        case 'p':
+            n = 1;
+            break;
+        default:
+            n = op->count;
+        }
+
+        if (index < n) {
+            field->code = op->code;
+            field->endian = op->endian;
+            if (op->code == 's' || op->code == 'p') {
+                field->size = op->count;
+            } else {
+                field->size = code_size(op->code);
+            }
+            field->offset = op->offset + index * op->msize;
+            field->position = (position < 0) ? -1 :
+                position + index * field->size;
+            return 0;
+        }
+        index -= n;
+
+        if (op->code == 'v' || op->code == 'V') {
+            position = -1;
+        } else if (position >= 0) {
+            position += (code_size(op->code) > 0) ?
+                op->count * code_size(op->code) : op->count;
+        }
+    }
+    return -1;
+}
+
+int struct_format_pack(const struct_format *sf, void *buf, ...)
+{
+    va_list args;
+    const struct struct_op *op;
+    unsigned char *bp = (unsigned char *)buf;
+    union struct_value val;
+    int i;
+
+    va_start(args, buf);
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        switch (op->code) {
+        case 'x':
+            memset(bp, 0, op->count);
+            bp += op->count;
+            break;
+        case 's': /* fall through */
+        case 'p':
+            va_value(op->code, &args, &val);
+            memcpy(bp, val.s, op->count);
+            bp += op->count;
+            break;
+        default:
+            for (i = 0; i < op->count; i++) {
+                va_value(op->code, &args, &val);
+                pack_value(&bp, op->code, &val, op->endian);
+            }
+        }
+    }
+    va_end(args);
+
+    return (bp - (unsigned char *)buf);
+}
+
+int struct_format_unpack(const struct_format *sf, const void *buf, ...)
+{
+    va_list args;
+    const struct struct_op *op;
+    const unsigned char *bp = (const unsigned char *)buf;
+    void *dst;
+    int i;
+
+    va_start(args, buf);
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        switch (op->code) {
+        case 'x':
+            bp += op->count;
+            break;
+        case 's': /* fall through */
+        case 'p':
+            dst = va_arg(args, char *);
+            if (dst != NULL) {
+                memcpy(dst, bp, op->count);
+            }
+            bp += op->count;
+            break;
+        default:
+            for (i = 0; i < op->count; i++) {
+                dst = va_arg(args, void *);
+                if (dst != NULL) {
+                    unpack_value(&bp, op->code, dst, op->endian);
+                } else {
+                    bp += field_length(op->code, 1, bp);
+                }
+            }
+        }
+    }
+    va_end(args);
+
+    return (bp - (const unsigned char *)buf);
+}
+
+int struct_format_pack_record(
+    const struct_format *sf,
+    void *buf,
+    const void *record)
+{
+    const struct struct_op *op;
+    const unsigned char *rp;
+    unsigned char *bp = (unsigned char *)buf;
+    union struct_value val;
+    int i;
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        rp = (const unsigned char *)record + op->offset;
+        switch (op->code) {
+        case 'x':
+            memset(bp, 0, op->count);
+            bp += op->count;
+            break;
+        case 's': /* fall through */
+        case 'p':
+            memcpy(bp, rp, op->count);
+            bp += op->count;
+            break;
+        default:
+            for (i = 0; i < op->count; i++, rp += op->msize) {
+                record_value(op->code, rp, &val);
+                pack_value(&bp, op->code, &val, op->endian);
+            }
+        }
+    }
+    return (bp - (unsigned char *)buf);
+}
+
+int struct_format_unpack_record(
+    const struct_format *sf,
+    const void *buf,
+    void *record)
+{
+    const struct struct_op *op;
+    const unsigned char *bp = (const unsigned char *)buf;
+    unsigned char *rp;
+    int i;
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        rp = (unsigned char *)record + op->offset;
+        switch (op->code) {
+        case 'x':
+            bp += op->count;
+            break;
+        case 's': /* fall through */
+        case 'p':
+            memcpy(rp, bp, op->count);
+            bp += op->count;
+            break;
+        default:
+            for (i = 0; i < op->count; i++, rp += op->msize) {
+                unpack_value(&bp, op->code, rp, op->endian);
+            }
+        }
+    }
+    return (bp - (const unsigned char *)buf);
+}
+
+int struct_format_unpack_fields(
+    const struct_format *sf,
+    const void *buf,
+    void *record,
+    const unsigned char *mask)
+{
+    const struct struct_op *op;
+    const unsigned char *bp = (const unsigned char *)buf;
+    unsigned char *rp;
+    int field = 0;
+    int i;
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        rp = (unsigned char *)record + op->offset;
+        switch (op->code) {
+        case 'x':
+            bp += op->count;
+            break;
+        case 's': /* fall through */
+        case 'p':
+            if (mask[field / 8] & (1 << (field % 8))) {
+                memcpy(rp, bp, op->count);
+            }
+            bp += op->count;
+            field++;
+            break;
+        default:
+            for (i = 0; i < op->count; i++, rp += op->msize, field++) {
+                if (mask[field / 8] & (1 << (field % 8))) {
+                    unpack_value(&bp, op->code, rp, op->endian);
+                } else {
+                    bp += field_length(op->code, 1, bp);
+                }
+            }
+        }
+    }
+    return (bp - (const unsigned char *)buf);
+}
+
+int struct_format_offset(
+    const struct_format *sf,
+    const void *buf,
+    int index)
+{
+    const struct struct_op *op;
+    const unsigned char *bp = (const unsigned char *)buf;
+    int nreps;
+    int nskip;
+    int i;
+
+    if (index < 0) {
+        return -1;
+    }
+
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        if (op->code == 'x') {
+            bp += op->count;
+            continue;
+        }
+
+        nreps = (op->code == 's' || op->code == 'p') ? 1 : op->count;
+        nskip = (index < nreps) ? index : nreps;
+        if (op->code == 'v' || op->code == 'V') {
+            for (i = 0; i < nskip; i++) {
+                skip_varint(&bp);
+            }
+        } else {
+            /* a run of fixed size fields is skipped at once */
+            bp += nskip * field_length(op->code, op->count, bp);
+        }
+        if (index < nreps) {
+            return (bp - (const unsigned char *)buf);
+        }
+        index -= nreps;
+    }
+    return -1;
+}
+
+int struct_format_diff(
+    const struct_format *sf,
+    const void *from,
+    const void *to,
+    void *patch)
+{
+    const struct struct_op *op;
+    const unsigned char *fp = (const unsigned char *)from;
+    const unsigned char *tp = (const unsigned char *)to;
+    unsigned char *bitmap = (unsigned char *)patch;
+    unsigned char *pp = bitmap + (sf->nfields + 7) / 8;
+    int field = 0;
+    int nreps;
+    int ol, nl;
+    int i;
+
+    memset(bitmap, 0, (sf->nfields + 7) / 8);
+    for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+        if (op->code == 'x') {
+            fp += op->count;
+            tp += op->count;
+            continue;
+        }
+
+        nreps = (op->code == 's' || op->code == 'p') ? 1 : op->count;
+        for (i = 0; i < nreps; i++, field++) {
+            ol = field_length(op->code, op->count, fp);
+            nl = field_length(op->code, op->count, tp);
+            if (ol != nl || memcmp(fp, tp, nl) != 0) {
+                bitmap[field / 8] |= 1 << (field % 8);
+                memcpy(pp, tp, nl);
+                pp += nl;
+            }
+            fp += ol;
+            tp += nl;
+        }
+    }
+    return (pp - (unsigned char *)patch);
+}
+
+/*
+ * length of the field at bp within avail bytes of a patch, or -1 if it
+ * runs past them or is a varint which does not end within 10 bytes
+ */
+static int patch_field_length(
+    int code,
+    int count,
+    const unsigned char *bp,
+    long avail)
+{
+    int n;
+
+    if (code == 'v' || code == 'V') {
+        return varint_length(bp, avail);
+    }
+    n = field_length(code, count, bp);
+    return (n <= avail) ? n : -1;
+}
+
+int struct_format_patch(
+    const struct_format *sf,
+    void *buf,
+    int size,
+    const void *patch,
+    int patch_len)
+{
+    const struct struct_op *op;
+    const unsigned char *bitmap = (const unsigned char *)patch;
+    const unsigned char *end = bitmap + patch_len;
+    const unsigned char *pp;
+    unsigned char *bp;
+    int len = struct_format_length(sf, buf, size);
+    int newlen;
+    int field;
+    int nreps;
+    int ol, nl;
+    int pass;
+    int i;
+
+    if (len < 0 || patch_len < (sf->nfields + 7) / 8) {
+        return -1;
+    }
+
+    /*
+     * pass 0 measures the patched record and checks the patch, pass 1
+     * applies the fields which do not grow, pass 2 the others: the record
+     * only shrinks, then only grows up to its final length, and never runs
+     * past size.
+     */
+    newlen = len;
+    for (pass = 0; pass < 3; pass++) {
+        bp = (unsigned char *)buf;
+        pp = bitmap + (sf->nfields + 7) / 8;
+        field = 0;
+        for (op = sf->ops; op < sf->ops + sf->nops; op++) {
+            if (op->code == 'x') {
+                bp += op->count;
+                continue;
+            }
+
+            nreps = (op->code == 's' || op->code == 'p') ? 1 : op->count;
+            for (i = 0; i < nreps; i++, field++) {
+                ol = field_length(op->code, op->count, bp);
+                if (!(bitmap[field / 8] & (1 << (field % 8)))) {
+                    bp += ol;
+                    continue;
+                }
+
+                nl = patch_field_length(op->code, op->count, pp, end - pp);
+                if (nl < 0) {
+                    return -1;
+                }
+                if (pass == 0) {
+                    newlen += nl - ol;
+                    bp += ol;
+                } else if (pass == 1 && nl > ol) {
+                    bp += ol;
+                } else {
+                    if (nl != ol) {
+                        memmove(bp + nl, bp + ol,
+                                len - (bp - (unsigned char *)buf) - ol);
+                        len += nl - ol;
+                    }
+                    memcpy(bp, pp, nl);
+                    bp += nl;
+                }
+                pp += nl;
+            }
+        }
+
+        if (newlen > size) {
+            return -1;
+        }
+    }
+    return len;
+}
+
+long struct_transcode(
+    const char *src_fmt,
+    const char *dst_fmt,
+    const void *src,
+    void *dst,
+    long count)
+{
+    struct tc_plan plan;
+    const unsigned char *sp = (const unsigned char *)src;
+    unsigned char *dp = (unsigned char *)dst;
+    const unsigned char *mask;
+    const int *perm;
+    long overflows = 0;
+    long n;
+    int i;
+
+    if (STRUCT_ENDIAN_NOT_SET == myendian) {
+        struct_init();
+    }
+
+    if (count < 0 || tc_plan_new(&plan, src_fmt, dst_fmt) < 0) {
+        return -1;
+    }
+
+    if (plan.perm != NULL) {
+        perm = plan.perm;
+        mask = plan.mask;
+        for (n = 0; n < count; n++) {
+            for (i = 0; i < plan.dst_size; i++) {
+                dp[i] = sp[perm[i]] & mask[i];
+            }
+            sp += plan.src_size;
+            dp += plan.dst_size;
+        }
+    } else {
+        for (n = 0; n < count; n++) {
+            overflows += tc_message(&plan, &sp, &dp);
+        }
+    }
+
+    tc_plan_free(&plan);
+    if (overflows > 0) {
+        errno = ERANGE;
+    }
+    return (dp - (unsigned char *)dst);
+}
@@ -4,6 +4,7 @@
 #define STRUCT_ENDIAN_NOT_SET   0
 #define STRUCT_ENDIAN_BIG       1
 #define STRUCT_ENDIAN_LITTLE    2
+#define STRUCT_ENDIAN_ORDERED   3   /* big-endian, order preserving */
 
 extern int struct_get_endian(void);
 
@@ -0,0 +1,104 @@
+#ifndef STRUCT_INTERNAL_INCLUDED
+#define STRUCT_INTERNAL_INCLUDED
+
+#include "struct.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * a single argument of a fixed size or varint format character, as it is
+ * passed to struct_pack().
+ */
+union struct_value {
+    int64_t q;
+    uint64_t Q;
+    double d;
+    const char *s;
+};
+
+/*
+ * a field of a compiled format, see struct_compile().
+ */
+struct struct_field {
+    int code;
+    int endian;
+    int size;           /* encoded size ('s', 'p': bytes), 0 for a varint */
+    int position;       /* encoded offset, -1 if a varint precedes it */
+    int offset;         /* record offset of its member */
+};
+
+/*
+ * pack_va_list() for the other modules of the library.
+ * returns the offset of the end of the packed data, -1 on failure.
+ */
+extern int struct_pack_va_list(
+    void *buf,
+    int offset,
+    const char *fmt,
+    va_list args);
+
+/*
+ * struct_calcsize_values() for the other modules of the library. args is
+ * left untouched (it is copied), so it may be packed afterwards.
+ */
+extern int struct_calcsize_va_list(const char *fmt, va_list args);
+
+/*
+ * struct_pack_into_checked() for the other modules of the library.
+ * returns the offset of the end of the packed data, or of the end of the
+ * data it needs (more than size) if it does not fit, -1 on failure.
+ */
+extern int struct_pack_va_list_checked(
+    void *buf,
+    int offset,
+    int size,
+    const char *fmt,
+    va_list args);
+
+/*
+ * describe field index of a compiled format.
+ * returns 0 on success, -1 if there is no such field.
+ */
+extern int struct_format_field(
+    const struct_format *sf,
+    int index,
+    struct struct_field *field);
+
+/*
+ * read the record member of a field of format character code ('s' and
+ * 'p' excepted).
+ */
+extern void struct_record_value(
+    int code,
+    const void *member,
+    union struct_value *val);
+
+/*
+ * the size of the key of a field encoded by struct_key_encode().
+ */
+extern int struct_key_width(const struct struct_field *field);
+
+/*
+ * encode the record member of a field as a key which compares with
+ * memcmp() like the member: the bytes of 's' and 'p', the value of the
+ * others as 8 bytes in the order preserving byte order ('^').
+ */
+extern void struct_key_encode(
+    const struct struct_field *field,
+    const void *record,
+    unsigned char *key);
+
+/*
+ * run fn on every job of an array of njobs jobs of job_size bytes, jobs
+ * 1.. on their own threads and job 0 on the calling thread. a job whose
+ * thread can not be created runs on the calling thread too.
+ */
+extern void struct_run_jobs(
+    void *jobs,
+    size_t job_size,
+    int njobs,
+    void *(*fn)(void *));
+
+#endif /* !STRUCT_INTERNAL_INCLUDED */
@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "struct_log.h"
+#include "struct_internal.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE      64
+
+/*
+ * header of a record: the span reserved for it, written by the producer
+ * before the commit, and its state, 0 until the record is committed,
+ * then its length with LOG_COMMITTED set.
+ */
+struct log_header {
+    uint32_t span;
+    uint32_t state;
+};
+
+#define LOG_COMMITTED   0x80000000U
+#define LOG_HEADER      sizeof(struct log_header)
+#define LOG_ALIGN(n)    (((n) + 7) & ~(uint64_t)7)
+
+struct struct_log {
+    /* shared, the end of the reserved space */
+    uint64_t tail;
+    char pad0[CACHE_LINE - sizeof(uint64_t)];
+
+    /* read-only */
+    unsigned char *buf;
+    uint64_t capacity;
+};
+
+struct_log *struct_log_new(long capacity)
+{
+    struct struct_log *log;
+    void *mem;
+
+    if (capacity < (long)LOG_HEADER) {
+        return NULL;
+    }
+
+    if (posix_memalign(&mem, CACHE_LINE, sizeof(*log)) != 0) {
+        return NULL;
+    }
+    log = mem;
+    memset(log, 0, sizeof(*log));
+    /* uncommitted headers must read 0 */
+    log->buf = calloc(1, capacity);
+    if (log->buf == NULL) {
+        free(log);
+        return NULL;
+    }
+    log->capacity = capacity;
+    return log;
+}
+
+void struct_log_free(struct_log *log)
+{
+    if (log == NULL) {
+        return;
+    }
+    free(log->buf);
+    free(log);
+}
+
+void *struct_log_reserve(struct_log *log, int size)
+{
+    uint64_t span = LOG_ALIGN(LOG_HEADER + (uint64_t)size);
+    uint64_t off;
+    struct log_header *hdr;
+
+    if (size < 0 || span > log->capacity) {
+        return NULL;
+    }
+
+    off = __atomic_fetch_add(&log->tail, span, __ATOMIC_RELAXED);
+    if (off + span > log->capacity) {
+        /* nothing is written there, readers stop at this point */
+        return NULL;
+    }
+
+    hdr = (struct log_header *)(log->buf + off);
+    hdr->span = (uint32_t)span;
+    return log->buf + off + LOG_HEADER;
+}
+
+void struct_log_commit(struct_log *log, void *slot, int len)
+{
+    struct log_header *hdr =
+        (struct log_header *)((unsigned char *)slot - LOG_HEADER);
+
+    (void)log;
+    __atomic_store_n(&hdr->state, (uint32_t)len | LOG_COMMITTED,
+            __ATOMIC_RELEASE);
+}
+
+int struct_log_pack(struct_log *log, const char *fmt, ...)
+{
+    va_list args;
+    unsigned char *slot;
+    int size;
+    int len;
+
+    /* the exact size of the values: varints take what they need */
+    va_start(args, fmt);
+    size = struct_calcsize_va_list(fmt, args);
+    if (size < 0 || LOG_ALIGN(LOG_HEADER + (uint64_t)size) > log->capacity) {
+        va_end(args);
+        return -1;
+    }
+    slot = struct_log_reserve(log, size);
+    if (slot == NULL) {
+        va_end(args);
+        return 0;
+    }
+    len = struct_pack_va_list(slot, 0, fmt, args);
+    va_end(args);
+
+    struct_log_commit(log, slot, len);
+    return len;
+}
+
+int struct_log_pack_record(
+    struct_log *log,
+    const struct_format *sf,
+    const void *record)
+{
+    unsigned char *slot;
+    int size;
+    int len;
+
+    if (struct_format_is_fixed(sf)) {
+        size = struct_format_calcsize(sf);
+    } else {
+        size = struct_format_calcsize_record(sf, record);
+    }
+    if (LOG_ALIGN(LOG_HEADER + (uint64_t)size) > log->capacity) {
+        return -1;
+    }
+    slot = struct_log_reserve(log, size);
+    if (slot == NULL) {
+        return 0;
+    }
+
+    len = struct_format_pack_record(sf, slot, record);
+    struct_log_commit(log, slot, len);
+    return len;
+}
+
+const void *struct_log_next(
+    const struct_log *log,
+    long *pos,
+    int *len)
+{
+    const struct log_header *hdr;
+    uint64_t off = *pos;
+    uint32_t state;
+
+    if (off + LOG_HEADER > log->capacity) {
+        return NULL;
+    }
+
+    hdr = (const struct log_header *)(log->buf + off);
+    state = __atomic_load_n(&hdr->state, __ATOMIC_ACQUIRE);
+    if (state == 0) {
+        return NULL;
+    }
+
+    *len = state & ~LOG_COMMITTED;
+    *pos = off + hdr->span;
+    return log->buf + off + LOG_HEADER;
+}
+
+long struct_log_size(const struct_log *log)
+{
+    uint64_t tail = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+
+    return (tail < log->capacity) ? tail : log->capacity;
+}
+
+void struct_log_reset(struct_log *log)
+{
+    memset(log->buf, 0, struct_log_size(log));
+    log->tail = 0;
+}
@@ -0,0 +1,518 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "struct_merge.h"
+#include "struct_internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MERGE_ALIGN(n)  (((n) + 7) & ~(long)7)
+
+/*
+ * a buffered reader of the records of a run.
+ */
+struct merge_reader {
+    int fd;
+    unsigned char *buf;
+    int size;
+    int start;                  /* the unread data is [start, end) */
+    int end;
+    int eof;
+};
+
+/*
+ * a buffered writer.
+ */
+struct merge_writer {
+    int fd;
+    unsigned char *buf;
+    int size;
+    int len;
+};
+
+/*
+ * the key field of a format, see struct_key_encode().
+ */
+struct merge_key {
+    const struct_format *sf;
+    struct struct_field field;
+    int width;                  /* encoded key size */
+    unsigned char *record;      /* scratch record */
+};
+
+/*
+ * a record of a run being cut, in the memory of struct_make_runs(),
+ * followed by its key.
+ */
+struct run_entry {
+    long offset;
+    int len;
+    int width;
+};
+
+/*
+ * the head of a run being merged.
+ */
+struct merge_run {
+    struct merge_reader reader;
+    const unsigned char *rec;   /* NULL at the end of the run */
+    int len;
+    unsigned char *key;
+};
+
+struct merge_tree {
+    struct merge_run *runs;
+    int *nodes;                 /* nodes[0]: winner, others: losers */
+    int k;
+    int width;
+};
+
+static int key_init(struct merge_key *k, const struct_format *sf, int key)
+{
+    if (struct_format_calcsize(sf) <= 0 ||
+            struct_format_field(sf, key, &k->field) < 0) {
+        return -1;
+    }
+    k->sf = sf;
+    k->width = struct_key_width(&k->field);
+    k->record = malloc(struct_format_record_size(sf) + 1);
+    return (k->record != NULL) ? 0 : -1;
+}
+
+static void key_encode(struct merge_key *k, const unsigned char *rec,
+        unsigned char *key)
+{
+    struct_format_unpack_record(k->sf, rec, k->record);
+    struct_key_encode(&k->field, k->record, key);
+}
+
+static int reader_init(struct merge_reader *r, int fd, int size)
+{
+    r->fd = fd;
+    r->buf = malloc(size);
+    r->size = size;
+    r->start = 0;
+    r->end = 0;
+    r->eof = 0;
+    return (r->buf != NULL) ? 0 : -1;
+}
+
+/*
+ * the next record of a run, NULL at its end. *len is set to the length
+ * of the record, or to -1 if the run is malformed or a read failed.
+ */
+static const unsigned char *reader_next(struct merge_reader *r,
+        const struct_format *sf, int *len)
+{
+    const unsigned char *rec;
+    int max = struct_format_calcsize(sf);
+    int avail;
+    ssize_t n;
+
+    for (;;) {
+        avail = r->end - r->start;
+        *len = struct_format_length(sf, r->buf + r->start,
+                (avail < max) ? avail : max);
+        if (*len > 0) {
+            rec = r->buf + r->start;
+            r->start += *len;
+            return rec;
+        }
+        if (avail >= max || r->eof) {
+            *len = (avail > 0) ? -1 : 0;
+            return NULL;
+        }
+
+        memmove(r->buf, r->buf + r->start, avail);
+        r->start = 0;
+        r->end = avail;
+        n = read(r->fd, r->buf + r->end, r->size - r->end);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *len = -1;
+            return NULL;
+        }
+        r->eof = (n == 0);
+        r->end += n;
+    }
+}
+
+static int writer_flush(struct merge_writer *w)
+{
+    const unsigned char *bp = w->buf;
+    ssize_t n;
+
+    while (w->len > 0) {
+        n = write(w->fd, bp, w->len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bp += n;
+        w->len -= n;
+    }
+    return 0;
+}
+
+static int writer_put(struct merge_writer *w, const void *rec, int len)
+{
+    if (w->len + len > w->size && writer_flush(w) < 0) {
+        return -1;
+    }
+    memcpy(w->buf + w->len, rec, len);
+    w->len += len;
+    return 0;
+}
+
+static int entry_compare(const void *a, const void *b)
+{
+    const struct run_entry *ea = (const struct run_entry *)a;
+    const struct run_entry *eb = (const struct run_entry *)b;
+    int c = memcmp(ea + 1, eb + 1, ea->width);
+
+    if (c != 0) {
+        return c;
+    }
+    return (ea->offset < eb->offset) ? -1 : (ea->offset > eb->offset);
+}
+
+/*
+ * sort the n entries at the end of memory and write their records to a
+ * new run, appended to *runs.
+ */
+static int cut_run(unsigned char *mem, long back, long n, long stride,
+        struct merge_writer *w, struct_run_opener open_run, void *arg,
+        int **runs, long *nruns)
+{
+    const struct run_entry *e;
+    int *more;
+    long i;
+
+    more = realloc(*runs, (*nruns + 1) * sizeof(**runs));
+    if (more == NULL) {
+        return -1;
+    }
+    *runs = more;
+    w->fd = open_run(arg);
+    if (w->fd < 0) {
+        return -1;
+    }
+    (*runs)[(*nruns)++] = w->fd;
+
+    qsort(mem + back, n, stride, entry_compare);
+    for (i = 0; i < n; i++) {
+        e = (const struct run_entry *)(mem + back + i * stride);
+        if (writer_put(w, mem + e->offset, e->len) < 0) {
+            return -1;
+        }
+    }
+    if (writer_flush(w) < 0 || lseek(w->fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+long struct_make_runs(
+    const struct_format *sf,
+    int key,
+    int in_fd,
+    long memory,
+    int bufsize,
+    struct_run_opener open_run,
+    void *arg,
+    int **runs)
+{
+    struct merge_key k;
+    struct merge_reader r;
+    struct merge_writer w;
+    struct run_entry *e;
+    const unsigned char *rec;
+    unsigned char *mem;
+    long stride;
+    long front = 0;
+    long back = memory & ~7L;
+    long n = 0;
+    long nruns = 0;
+    int max;
+    int len;
+
+    *runs = NULL;
+    r.buf = NULL;
+    if (key_init(&k, sf, key) < 0) {
+        return -1;
+    }
+    max = struct_format_calcsize(sf);
+    if (bufsize < max) {
+        bufsize = max;
+    }
+    stride = MERGE_ALIGN(sizeof(struct run_entry) + k.width);
+
+    mem = (memory > 0) ? malloc(memory) : NULL;
+    w.buf = malloc(bufsize);
+    w.size = bufsize;
+    w.len = 0;
+    if (mem == NULL || w.buf == NULL || reader_init(&r, in_fd, bufsize) < 0) {
+        goto fail;
+    }
+
+    for (;;) {
+        rec = reader_next(&r, sf, &len);
+        if (rec == NULL) {
+            if (len < 0 || (n > 0 && cut_run(mem, back, n, stride, &w,
+                            open_run, arg, runs, &nruns) < 0)) {
+                goto fail;
+            }
+            break;
+        }
+
+        if (front + len > back - stride) {
+            /* a single record does not fit */
+            if (n == 0 || cut_run(mem, back, n, stride, &w,
+                        open_run, arg, runs, &nruns) < 0) {
+                goto fail;
+            }
+            front = 0;
+            back = memory & ~7L;
+            n = 0;
+            if (front + len > back - stride) {
+                goto fail;
+            }
+        }
+
+        memcpy(mem + front, rec, len);
+        back -= stride;
+        e = (struct run_entry *)(mem + back);
+        e->offset = front;
+        e->len = len;
+        e->width = k.width;
+        key_encode(&k, rec, (unsigned char *)(e + 1));
+        front += len;
+        n++;
+    }
+
+    free(r.buf);
+    free(w.buf);
+    free(mem);
+    free(k.record);
+    return nruns;
+
+fail:
+    while (nruns > 0) {
+        close((*runs)[--nruns]);
+    }
+    free(*runs);
+    *runs = NULL;
+    free(r.buf);
+    free(w.buf);
+    free(mem);
+    free(k.record);
+    return -1;
+}
+
+/*
+ * a beats b: it is the virtual leaf k which wins every match (used to
+ * build the tree), or its key is smaller, or they are equal and its run
+ * comes first. an ended run loses every match.
+ */
+static int beats(const struct merge_tree *t, int a, int b)
+{
+    int c;
+
+    if (a == t->k || b == t->k) {
+        return (a == t->k);
+    }
+    if (t->runs[a].rec == NULL || t->runs[b].rec == NULL) {
+        return (t->runs[b].rec == NULL && t->runs[a].rec != NULL);
+    }
+    c = memcmp(t->runs[a].key, t->runs[b].key, t->width);
+    return (c < 0 || (c == 0 && a < b));
+}
+
+/*
+ * replay the matches of leaf s up to the root after its record changed.
+ */
+static void adjust(struct merge_tree *t, int s)
+{
+    int i;
+    int tmp;
+
+    for (i = (s + t->k) / 2; i > 0; i /= 2) {
+        if (beats(t, t->nodes[i], s)) {
+            tmp = t->nodes[i];
+            t->nodes[i] = s;
+            s = tmp;
+        }
+    }
+    t->nodes[0] = s;
+}
+
+static int advance(struct merge_run *run, struct merge_key *k)
+{
+    run->rec = reader_next(&run->reader, k->sf, &run->len);
+    if (run->rec != NULL) {
+        key_encode(k, run->rec, run->key);
+    }
+    return (run->len < 0) ? -1 : 0;
+}
+
+long struct_merge_runs(
+    const struct_format *sf,
+    int key,
+    const int *runs,
+    int nruns,
+    int out_fd,
+    int bufsize)
+{
+    struct merge_key k;
+    struct merge_tree t;
+    struct merge_writer w;
+    struct merge_run *run;
+    unsigned char *keys = NULL;
+    long count = 0;
+    int max;
+    int i;
+
+    if (nruns < 0 || key_init(&k, sf, key) < 0) {
+        return -1;
+    }
+    max = struct_format_calcsize(sf);
+    if (bufsize < max) {
+        bufsize = max;
+    }
+
+    t.k = nruns;
+    t.width = k.width;
+    t.runs = calloc(nruns + 1, sizeof(*t.runs));
+    t.nodes = malloc((nruns + 1) * sizeof(*t.nodes));
+    keys = malloc((nruns + 1) * (long)k.width);
+    w.fd = out_fd;
+    w.buf = malloc(bufsize);
+    w.size = bufsize;
+    w.len = 0;
+    if (t.runs == NULL || t.nodes == NULL || keys == NULL || w.buf == NULL) {
+        count = -1;
+        goto out;
+    }
+
+    for (i = 0; i < nruns; i++) {
+        t.runs[i].key = keys + i * (long)k.width;
+        if (reader_init(&t.runs[i].reader, runs[i], bufsize) < 0 ||
+                advance(&t.runs[i], &k) < 0) {
+            count = -1;
+            goto out;
+        }
+    }
+    for (i = 0; i < nruns; i++) {
+        t.nodes[i] = nruns;
+    }
+    for (i = nruns - 1; i >= 0; i--) {
+        adjust(&t, i);
+    }
+
+    while (nruns > 0 && (run = &t.runs[t.nodes[0]])->rec != NULL) {
+        if (writer_put(&w, run->rec, run->len) < 0 ||
+                advance(run, &k) < 0) {
+            count = -1;
+            goto out;
+        }
+        count++;
+        adjust(&t, t.nodes[0]);
+    }
+    if (writer_flush(&w) < 0) {
+        count = -1;
+    }
+
+out:
+    if (t.runs != NULL) {
+        for (i = 0; i < nruns; i++) {
+            free(t.runs[i].reader.buf);
+        }
+    }
+    free(t.runs);
+    free(t.nodes);
+    free(keys);
+    free(w.buf);
+    free(k.record);
+    return count;
+}
+
+long struct_external_sort(
+    const struct_format *sf,
+    int key,
+    int in_fd,
+    int out_fd,
+    long memory,
+    int bufsize,
+    struct_run_opener open_run,
+    void *arg)
+{
+    int *runs;
+    long nruns;
+    long fan_in;
+    long count;
+    long out;
+    long n;
+    long i;
+    long j;
+    int fd;
+
+    nruns = struct_make_runs(sf, key, in_fd, memory, bufsize, open_run, arg,
+            &runs);
+    if (nruns < 0) {
+        return -1;
+    }
+
+    fan_in = (bufsize > 0) ? memory / bufsize - 1 : 0;
+    if (fan_in < 2) {
+        fan_in = 2;
+    }
+    while (nruns > fan_in) {
+        /*
+         * one pass: every group of fan_in adjacent runs is merged into a
+         * run which takes its place, in order, so that every record is
+         * read and written once per pass and equal keys keep their order.
+         */
+        out = 0;
+        for (i = 0; i < nruns; i += n) {
+            n = (nruns - i < fan_in) ? nruns - i : fan_in;
+            if (n == 1) {
+                runs[out++] = runs[i];
+                continue;
+            }
+            fd = open_run(arg);
+            if (fd < 0 || struct_merge_runs(sf, key, runs + i, n, fd,
+                        bufsize) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                for (j = 0; j < out; j++) {
+                    close(runs[j]);
+                }
+                for (j = i; j < nruns; j++) {
+                    close(runs[j]);
+                }
+                free(runs);
+                return -1;
+            }
+            for (j = i; j < i + n; j++) {
+                close(runs[j]);
+            }
+            runs[out++] = fd;
+        }
+        nruns = out;
+    }
+
+    count = struct_merge_runs(sf, key, runs, nruns, out_fd, bufsize);
+
+    for (i = 0; i < nruns; i++) {
+        close(runs[i]);
+    }
+    free(runs);
+    return count;
+}
@@ -0,0 +1,153 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "struct_mmsg.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+struct struct_mmsg {
+    int vlen;
+    int bufsize;
+    unsigned char *bufs;        /* vlen buffers of bufsize bytes */
+    struct iovec *iovs;
+    struct mmsghdr *msgs;
+    int *lens;                  /* see struct_mmsg_length() */
+};
+
+struct_mmsg *struct_mmsg_new(int vlen, int bufsize)
+{
+    struct struct_mmsg *mm;
+
+    if (vlen <= 0 || bufsize <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mm = calloc(1, sizeof(*mm));
+    if (mm == NULL) {
+        return NULL;
+    }
+    mm->vlen = vlen;
+    mm->bufsize = bufsize;
+    mm->bufs = malloc((size_t)vlen * bufsize);
+    mm->iovs = calloc(vlen, sizeof(*mm->iovs));
+    mm->msgs = calloc(vlen, sizeof(*mm->msgs));
+    mm->lens = calloc(vlen, sizeof(*mm->lens));
+    if (mm->bufs == NULL || mm->iovs == NULL || mm->msgs == NULL ||
+            mm->lens == NULL) {
+        struct_mmsg_free(mm);
+        return NULL;
+    }
+    return mm;
+}
+
+void struct_mmsg_free(struct_mmsg *mm)
+{
+    if (mm == NULL) {
+        return;
+    }
+    free(mm->bufs);
+    free(mm->iovs);
+    free(mm->msgs);
+    free(mm->lens);
+    free(mm);
+}
+
+/*
+ * point message i at buffer i.
+ */
+static void mmsg_prepare(struct_mmsg *mm, int i, size_t len,
+        const struct sockaddr *addr, socklen_t addrlen)
+{
+    mm->iovs[i].iov_base = mm->bufs + (size_t)i * mm->bufsize;
+    mm->iovs[i].iov_len = len;
+    memset(&mm->msgs[i].msg_hdr, 0, sizeof(mm->msgs[i].msg_hdr));
+    mm->msgs[i].msg_hdr.msg_iov = &mm->iovs[i];
+    mm->msgs[i].msg_hdr.msg_iovlen = 1;
+    mm->msgs[i].msg_hdr.msg_name = (void *)addr;
+    mm->msgs[i].msg_hdr.msg_namelen = addrlen;
+    mm->msgs[i].msg_len = 0;
+}
+
+int struct_mmsg_recv(
+    struct_mmsg *mm,
+    int fd,
+    const struct_format *sf,
+    void *records,
+    int flags)
+{
+    unsigned char *rp = (unsigned char *)records;
+    int record_size = struct_format_record_size(sf);
+    int n;
+    int i;
+
+    if (struct_format_calcsize(sf) > mm->bufsize) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < mm->vlen; i++) {
+        mmsg_prepare(mm, i, mm->bufsize, NULL, 0);
+    }
+
+    n = recvmmsg(fd, mm->msgs, mm->vlen, flags, NULL);
+    if (n < 0) {
+        return -1;
+    }
+
+    /*
+     * every buffer holds at least struct_format_calcsize() bytes, so a short
+     * datagram never makes the decoder read outside of its buffer.
+     */
+    for (i = 0; i < n; i++, rp += record_size) {
+        mm->lens[i] = mm->msgs[i].msg_len;
+        if (struct_format_unpack_record(sf, mm->iovs[i].iov_base, rp) >
+                mm->lens[i] || (mm->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+            mm->lens[i] = -1;
+        }
+    }
+    return n;
+}
+
+int struct_mmsg_length(const struct_mmsg *mm, int i)
+{
+    return mm->lens[i];
+}
+
+int struct_mmsg_send(
+    struct_mmsg *mm,
+    int fd,
+    const struct_format *sf,
+    const void *records,
+    int nrecords,
+    const struct sockaddr *addr,
+    socklen_t addrlen,
+    int flags)
+{
+    const unsigned char *rp = (const unsigned char *)records;
+    int record_size = struct_format_record_size(sf);
+    int len;
+    int i;
+
+    if (struct_format_calcsize(sf) > mm->bufsize) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nrecords > mm->vlen) {
+        nrecords = mm->vlen;
+    }
+    for (i = 0; i < nrecords; i++, rp += record_size) {
+        len = struct_format_pack_record(
+                sf, mm->bufs + (size_t)i * mm->bufsize, rp);
+        mmsg_prepare(mm, i, len, addr, addrlen);
+    }
+    return sendmmsg(fd, mm->msgs, nrecords, flags);
+}
+
+#endif /* __linux__ */
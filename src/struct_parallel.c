@@ -0,0 +1,336 @@
+#include "struct_parallel.h"
+#include "struct_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * one chunk of records handled by one thread.
+ */
+struct pack_job {
+    const struct_format *sf;
+    unsigned char *buf;         /* where the chunk is packed */
+    const unsigned char *records;
+    long nrecords;
+    long size;                  /* packed size of the chunk */
+};
+
+/*
+ * one chunk of a packed stream scanned by one thread.
+ */
+struct index_job {
+    const struct_format *sf;
+    const unsigned char *buf;
+    long len;                   /* length of the whole stream */
+    long lo;                    /* the chunk is [lo, hi) */
+    long hi;
+    long *offsets;              /* record starts found in the chunk */
+    long noffsets;
+    long end;                   /* end of the last record, -1 if malformed */
+    int nomem;
+};
+
+void struct_run_jobs(void *jobs, size_t job_size, int njobs,
+        void *(*fn)(void *))
+{
+    pthread_t *threads = malloc(njobs * sizeof(*threads));
+    char *started = calloc(njobs, 1);
+    int i;
+
+    for (i = 1; i < njobs; i++) {
+        if (threads != NULL && started != NULL &&
+                pthread_create(&threads[i], NULL, fn,
+                    (char *)jobs + i * job_size) == 0) {
+            started[i] = 1;
+        }
+    }
+    fn(jobs);
+    for (i = 1; i < njobs; i++) {
+        if (started != NULL && started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            fn((char *)jobs + i * job_size);
+        }
+    }
+    free(started);
+    free(threads);
+}
+
+static void *size_chunk(void *arg)
+{
+    struct pack_job *job = (struct pack_job *)arg;
+    int record_size = struct_format_record_size(job->sf);
+    long i;
+
+    job->size = 0;
+    for (i = 0; i < job->nrecords; i++) {
+        job->size += struct_format_calcsize_record(
+                job->sf, job->records + i * record_size);
+    }
+    return NULL;
+}
+
+static void *pack_chunk(void *arg)
+{
+    struct pack_job *job = (struct pack_job *)arg;
+    int record_size = struct_format_record_size(job->sf);
+    unsigned char *bp = job->buf;
+    long i;
+
+    for (i = 0; i < job->nrecords; i++) {
+        bp += struct_format_pack_record(
+                job->sf, bp, job->records + i * record_size);
+    }
+    job->size = bp - job->buf;
+    return NULL;
+}
+
+long struct_pack_records_parallel(
+    const struct_format *sf,
+    void *buf,
+    const void *records,
+    long nrecords,
+    int nthreads)
+{
+    struct pack_job *jobs;
+    long offset = 0;
+    long lo = 0;
+    int i;
+
+    if (nrecords < 0 || nthreads <= 0) {
+        return -1;
+    }
+    if (nthreads > nrecords) {
+        nthreads = (nrecords > 0) ? (int)nrecords : 1;
+    }
+
+    jobs = malloc(nthreads * sizeof(*jobs));
+    if (jobs == NULL) {
+        return -1;
+    }
+    for (i = 0; i < nthreads; i++) {
+        jobs[i].sf = sf;
+        jobs[i].records = (const unsigned char *)records +
+            lo * struct_format_record_size(sf);
+        jobs[i].nrecords = nrecords * (i + 1) / nthreads - lo;
+        lo += jobs[i].nrecords;
+    }
+
+    /* exact chunk sizes, then their prefix sum */
+    if (!struct_format_is_fixed(sf)) {
+        struct_run_jobs(jobs, sizeof(*jobs), nthreads, size_chunk);
+    } else {
+        for (i = 0; i < nthreads; i++) {
+            jobs[i].size = jobs[i].nrecords * struct_format_calcsize(sf);
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        jobs[i].buf = (unsigned char *)buf + offset;
+        offset += jobs[i].size;
+    }
+
+    struct_run_jobs(jobs, sizeof(*jobs), nthreads, pack_chunk);
+
+    free(jobs);
+    return offset;
+}
+
+/*
+ * the length of the record at offset, -1 if it is malformed or truncated.
+ */
+static long record_length(const struct_format *sf, const unsigned char *buf,
+        long len, long offset)
+{
+    long avail = len - offset;
+
+    if (avail > struct_format_calcsize(sf)) {
+        avail = struct_format_calcsize(sf);
+    }
+    return struct_format_length(sf, buf + offset, (int)avail);
+}
+
+/*
+ * make room for need offsets in *out.
+ */
+static int reserve(long **out, long *cap, long need)
+{
+    long *offsets;
+
+    if (need <= *cap) {
+        return 0;
+    }
+    *cap = (need > *cap * 2) ? need : *cap * 2;
+    offsets = realloc(*out, *cap * sizeof(*offsets));
+    if (offsets == NULL) {
+        return -1;
+    }
+    *out = offsets;
+    return 0;
+}
+
+/*
+ * parse the chunk as if a record started at lo. this is right for the
+ * first chunk; the others are checked by index_stitch().
+ */
+static void *index_chunk(void *arg)
+{
+    struct index_job *job = (struct index_job *)arg;
+    long offset = job->lo;
+    long cap = 0;
+    long n;
+
+    while (offset < job->hi) {
+        n = record_length(job->sf, job->buf, job->len, offset);
+        if (n < 0) {
+            job->end = -1;
+            return NULL;
+        }
+        if (reserve(&job->offsets, &cap, job->noffsets + 1) < 0) {
+            job->nomem = 1;
+            return NULL;
+        }
+        job->offsets[job->noffsets++] = offset;
+        offset += n;
+    }
+    job->end = offset;
+    return NULL;
+}
+
+/*
+ * the index of offset in the record starts of a job, -1 if it is not one.
+ */
+static long index_find(const struct index_job *job, long offset)
+{
+    long lo = 0;
+    long hi = job->noffsets;
+    long mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (job->offsets[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < job->noffsets && job->offsets[lo] == offset) ? lo : -1;
+}
+
+long struct_index_records_parallel(
+    const struct_format *sf,
+    const void *buf,
+    long len,
+    long **offsets,
+    int nthreads)
+{
+    const unsigned char *bp = (const unsigned char *)buf;
+    struct index_job *jobs;
+    struct index_job *job;
+    long *out = NULL;
+    long nout = 0;
+    long cap = 0;
+    long offset;
+    long n;
+    long k;
+    int i;
+
+    *offsets = NULL;
+    /* records of an empty format take no bytes and can not be counted */
+    if (len < 0 || nthreads <= 0 || struct_format_calcsize(sf) <= 0) {
+        return -1;
+    }
+
+    if (struct_format_is_fixed(sf)) {
+        n = len / struct_format_calcsize(sf);
+        out = malloc((n > 0 ? n : 1) * sizeof(*out));
+        if (out == NULL) {
+            return -1;
+        }
+        for (k = 0; k < n; k++) {
+            out[k] = k * struct_format_calcsize(sf);
+        }
+        *offsets = out;
+        return n;
+    }
+
+    if (nthreads > len / struct_format_calcsize(sf)) {
+        nthreads = (int)(len / struct_format_calcsize(sf));
+        if (nthreads < 1) {
+            nthreads = 1;
+        }
+    }
+    jobs = calloc(nthreads, sizeof(*jobs));
+    if (jobs == NULL) {
+        return -1;
+    }
+    for (i = 0; i < nthreads; i++) {
+        jobs[i].sf = sf;
+        jobs[i].buf = bp;
+        jobs[i].len = len;
+        jobs[i].lo = len * i / nthreads;
+        jobs[i].hi = len * (i + 1) / nthreads;
+    }
+
+    struct_run_jobs(jobs, sizeof(*jobs), nthreads, index_chunk);
+
+    /*
+     * stitch the chunks together. offset is the true start of the next
+     * record. parsing is deterministic, so once it reaches a record start
+     * found by the speculative parse of a chunk, the rest of that chunk
+     * is right. until it does, records are parsed here.
+     */
+    offset = 0;
+    for (i = 0; i < nthreads && offset >= 0; i++) {
+        job = &jobs[i];
+        if (job->nomem) {
+            goto nomem;
+        }
+        while (offset < job->hi && (k = index_find(job, offset)) < 0) {
+            n = record_length(sf, bp, len, offset);
+            if (n < 0) {
+                offset = -1;
+                break;
+            }
+            if (reserve(&out, &cap, nout + 1) < 0) {
+                goto nomem;
+            }
+            out[nout++] = offset;
+            offset += n;
+        }
+        if (offset < 0 || offset >= job->hi) {
+            continue;
+        }
+
+        /* in sync with the speculative parse from here on */
+        n = job->noffsets - k;
+        if (reserve(&out, &cap, nout + n) < 0) {
+            goto nomem;
+        }
+        memcpy(out + nout, job->offsets + k, n * sizeof(*out));
+        nout += n;
+        offset = job->end;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        free(jobs[i].offsets);
+    }
+    free(jobs);
+    if (out == NULL) {
+        out = malloc(sizeof(*out));
+        if (out == NULL) {
+            return -1;
+        }
+    }
+    *offsets = out;
+    return nout;
+
+nomem:
+    for (i = 0; i < nthreads; i++) {
+        free(jobs[i].offsets);
+    }
+    free(jobs);
+    free(out);
+    *offsets = NULL;
+    return -1;
+}
@@ -0,0 +1,173 @@
+#include "struct_partition.h"
+#include "struct_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET      0xCBF29CE484222325ULL
+#define FNV_PRIME       0x100000001B3ULL
+
+/* the finalizer of MurmurHash3 */
+static uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t key_hash(const struct struct_field *field,
+        const unsigned char *record)
+{
+    const unsigned char *member = record + field->offset;
+    union struct_value val;
+    uint64_t h;
+    int i;
+
+    switch (field->code) {
+    case 's': /* fall through */
+    case 'p':
+        h = FNV_OFFSET;
+        for (i = 0; i < field->size; i++) {
+            h = (h ^ member[i]) * FNV_PRIME;
+        }
+        return mix64(h);
+    case 'f': /* fall through */
+    case 'd':
+        struct_record_value(field->code, member, &val);
+        if (val.d == 0) {
+            val.d = 0;          /* -0.0 == 0.0 */
+        }
+        memcpy(&h, &val.d, sizeof(h));
+        return mix64(h);
+    default:
+        struct_record_value(field->code, member, &val);
+        return mix64(val.Q);
+    }
+}
+
+/* make room for size more bytes, exactly or with geometric growth */
+static int shard_reserve(struct struct_shard *shard, long size, int exact)
+{
+    unsigned char *buf;
+    long cap = shard->cap;
+
+    if (shard->len + size <= cap) {
+        return 0;
+    }
+    if (exact) {
+        cap = shard->len + size;
+    } else {
+        if (cap < 256) {
+            cap = 256;
+        }
+        while (cap < shard->len + size) {
+            cap *= 2;
+        }
+    }
+
+    buf = realloc(shard->buf, cap);
+    if (buf == NULL) {
+        return -1;
+    }
+    shard->buf = buf;
+    shard->cap = cap;
+    return 0;
+}
+
+int struct_partition_of(
+    const struct_format *sf,
+    int key,
+    const void *record,
+    int nparts)
+{
+    struct struct_field field;
+
+    if (nparts <= 0 || struct_format_field(sf, key, &field) < 0) {
+        return -1;
+    }
+    return key_hash(&field, (const unsigned char *)record) % nparts;
+}
+
+int struct_pack_partitioned(
+    const struct_format *sf,
+    int key,
+    const void *records,
+    long nrecords,
+    struct struct_shard *shards,
+    int nparts,
+    int mode)
+{
+    const unsigned char *rp = (const unsigned char *)records;
+    int record_size = struct_format_record_size(sf);
+    struct struct_field field;
+    struct struct_shard *shard;
+    long *need = NULL;
+    int *parts = NULL;
+    int size;
+    int p;
+    long i;
+
+    if (nparts <= 0 || nrecords < 0 ||
+            struct_format_field(sf, key, &field) < 0) {
+        return -1;
+    }
+
+    if (mode == STRUCT_PARTITION_EXACT) {
+        need = calloc(nparts, sizeof(*need));
+        parts = malloc((nrecords > 0 ? nrecords : 1) * sizeof(*parts));
+        if (need == NULL || parts == NULL) {
+            free(need);
+            free(parts);
+            return -1;
+        }
+
+        /* histogram of the bytes going to each shard */
+        for (i = 0; i < nrecords; i++, rp += record_size) {
+            parts[i] = key_hash(&field, rp) % nparts;
+            need[parts[i]] += struct_format_calcsize_record(sf, rp);
+        }
+        for (p = 0; p < nparts; p++) {
+            if (shard_reserve(&shards[p], need[p], 1) < 0) {
+                free(need);
+                free(parts);
+                return -1;
+            }
+        }
+
+        rp = (const unsigned char *)records;
+        for (i = 0; i < nrecords; i++, rp += record_size) {
+            shard = &shards[parts[i]];
+            shard->len += struct_format_pack_record(sf,
+                    shard->buf + shard->len, rp);
+            shard->count++;
+        }
+        free(need);
+        free(parts);
+        return 0;
+    }
+
+    for (i = 0; i < nrecords; i++, rp += record_size) {
+        shard = &shards[key_hash(&field, rp) % nparts];
+        size = struct_format_calcsize_record(sf, rp);
+        if (shard_reserve(shard, size, 0) < 0) {
+            return -1;
+        }
+        shard->len += struct_format_pack_record(sf,
+                shard->buf + shard->len, rp);
+        shard->count++;
+    }
+    return 0;
+}
+
+void struct_shards_free(struct struct_shard *shards, int nparts)
+{
+    int p;
+
+    for (p = 0; p < nparts; p++) {
+        free(shards[p].buf);
+        memset(&shards[p], 0, sizeof(shards[p]));
+    }
+}
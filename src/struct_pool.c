@@ -0,0 +1,365 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "struct_pool.h"
+#include "struct_internal.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define POOL_MIN_SHIFT  6           /* 64 bytes */
+#define POOL_CLASSES    25          /* up to 1 GB */
+#define POOL_LARGE      (-1)        /* not pooled */
+
+/*
+ * every buffer is preceded by a header: its class, and the next free
+ * buffer while it is in a cache or in the depot. the header is 16 bytes
+ * long so the buffer is as aligned as malloc(3) makes it.
+ */
+struct pool_header {
+    struct pool_header *next;
+    int cls;
+};
+
+#define POOL_HEADER     16
+
+struct pool_list {
+    struct pool_header *head;
+    long n;
+};
+
+/*
+ * the cache of one thread. the counters are only written by the thread,
+ * with relaxed stores, so that struct_pool_stats() may read them.
+ */
+struct pool_cache {
+    struct pool_cache *prev;
+    struct pool_cache *next;
+    struct struct_pool *pool;
+    long acquired;
+    long cache_hits;
+    long depot_hits;
+    long allocated;
+    struct pool_list lists[POOL_CLASSES];
+};
+
+struct struct_pool {
+    int nclasses;
+    int cache;
+    pthread_key_t key;
+
+    pthread_mutex_t lock;       /* guards everything below */
+    struct pool_list depot[POOL_CLASSES];
+    struct pool_cache *caches;  /* of every live thread */
+    struct struct_pool_stats gone;  /* counters of exited threads */
+};
+
+#define COUNT(c, field) \
+    __atomic_store_n(&(c)->field, (c)->field + 1, __ATOMIC_RELAXED)
+
+static int class_of(int size)
+{
+    if (size <= (1 << POOL_MIN_SHIFT)) {
+        return 0;
+    }
+    /* ceil(log2(size)) - POOL_MIN_SHIFT */
+    return 32 - __builtin_clz((unsigned int)size - 1) - POOL_MIN_SHIFT;
+}
+
+static long class_size(int cls)
+{
+    return 1L << (cls + POOL_MIN_SHIFT);
+}
+
+/* move at most n buffers from the head of src to dst */
+static long move_list(struct pool_list *dst, struct pool_list *src, long n)
+{
+    struct pool_header *h;
+    long moved = 0;
+
+    while (moved < n && (h = src->head) != NULL) {
+        src->head = h->next;
+        h->next = dst->head;
+        dst->head = h;
+        moved++;
+    }
+    __atomic_store_n(&src->n, src->n - moved, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->n, dst->n + moved, __ATOMIC_RELAXED);
+    return moved;
+}
+
+/* flush a cache into the depot when its thread exits */
+static void cache_destroy(void *arg)
+{
+    struct pool_cache *c = (struct pool_cache *)arg;
+    struct struct_pool *pool = c->pool;
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < pool->nclasses; i++) {
+        move_list(&pool->depot[i], &c->lists[i], c->lists[i].n);
+    }
+    pool->gone.acquired += c->acquired;
+    pool->gone.cache_hits += c->cache_hits;
+    pool->gone.depot_hits += c->depot_hits;
+    pool->gone.allocated += c->allocated;
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        pool->caches = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(c);
+}
+
+static struct pool_cache *get_cache(struct struct_pool *pool)
+{
+    struct pool_cache *c = pthread_getspecific(pool->key);
+
+    if (c != NULL) {
+        return c;
+    }
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->pool = pool;
+    if (pthread_setspecific(pool->key, c) != 0) {
+        free(c);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    c->next = pool->caches;
+    if (c->next != NULL) {
+        c->next->prev = c;
+    }
+    pool->caches = c;
+    pthread_mutex_unlock(&pool->lock);
+    return c;
+}
+
+static void free_list(struct pool_list *list)
+{
+    struct pool_header *h;
+
+    while ((h = list->head) != NULL) {
+        list->head = h->next;
+        free(h);
+    }
+    list->n = 0;
+}
+
+struct_pool *struct_pool_new(int max_size, int cache)
+{
+    struct struct_pool *pool;
+
+    if (max_size <= 0 || class_of(max_size) >= POOL_CLASSES) {
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->nclasses = class_of(max_size) + 1;
+    pool->cache = (cache > 0) ? cache : 1;
+
+    if (pthread_key_create(&pool->key, cache_destroy) != 0) {
+        free(pool);
+        return NULL;
+    }
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        pthread_key_delete(pool->key);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void struct_pool_free(struct_pool *pool)
+{
+    struct pool_cache *c;
+    int i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_key_delete(pool->key);
+    while ((c = pool->caches) != NULL) {
+        pool->caches = c->next;
+        for (i = 0; i < pool->nclasses; i++) {
+            free_list(&c->lists[i]);
+        }
+        free(c);
+    }
+    for (i = 0; i < pool->nclasses; i++) {
+        free_list(&pool->depot[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void *struct_pool_acquire(struct_pool *pool, int size)
+{
+    struct pool_cache *c;
+    struct pool_list *list;
+    struct pool_header *h;
+    int cls;
+
+    if (size < 0) {
+        return NULL;
+    }
+
+    cls = class_of(size);
+    c = (cls < pool->nclasses) ? get_cache(pool) : NULL;
+    if (c == NULL) {
+        /* too large to be pooled, or no cache */
+        h = malloc(POOL_HEADER + ((cls < pool->nclasses) ?
+                    class_size(cls) : size));
+        if (h == NULL) {
+            return NULL;
+        }
+        h->cls = (cls < pool->nclasses) ? cls : POOL_LARGE;
+        return (unsigned char *)h + POOL_HEADER;
+    }
+
+    COUNT(c, acquired);
+    list = &c->lists[cls];
+    if (list->head != NULL) {
+        COUNT(c, cache_hits);
+    } else {
+        /* refill half of the cache from the depot */
+        pthread_mutex_lock(&pool->lock);
+        move_list(list, &pool->depot[cls], (pool->cache + 1) / 2);
+        pthread_mutex_unlock(&pool->lock);
+        if (list->head == NULL) {
+            h = malloc(POOL_HEADER + class_size(cls));
+            if (h == NULL) {
+                return NULL;
+            }
+            COUNT(c, allocated);
+            h->cls = cls;
+            return (unsigned char *)h + POOL_HEADER;
+        }
+        COUNT(c, depot_hits);
+    }
+
+    h = list->head;
+    list->head = h->next;
+    __atomic_store_n(&list->n, list->n - 1, __ATOMIC_RELAXED);
+    return (unsigned char *)h + POOL_HEADER;
+}
+
+void struct_pool_release(struct_pool *pool, void *buf)
+{
+    struct pool_header *h;
+    struct pool_cache *c;
+    struct pool_list *list;
+
+    if (buf == NULL) {
+        return;
+    }
+
+    h = (struct pool_header *)((unsigned char *)buf - POOL_HEADER);
+    if (h->cls == POOL_LARGE) {
+        free(h);
+        return;
+    }
+
+    c = get_cache(pool);
+    if (c == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        h->next = pool->depot[h->cls].head;
+        pool->depot[h->cls].head = h;
+        __atomic_store_n(&pool->depot[h->cls].n,
+                pool->depot[h->cls].n + 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    list = &c->lists[h->cls];
+    h->next = list->head;
+    list->head = h;
+    __atomic_store_n(&list->n, list->n + 1, __ATOMIC_RELAXED);
+    if (list->n > pool->cache) {
+        /* give half of the cache back to the depot */
+        pthread_mutex_lock(&pool->lock);
+        move_list(&pool->depot[h->cls], list, list->n / 2);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void *struct_pool_pack(
+    struct_pool *pool,
+    int *len,
+    const char *fmt, ...)
+{
+    va_list args;
+    void *buf;
+    int size = struct_calcsize(fmt);
+
+    if (size < 0) {
+        return NULL;
+    }
+    buf = struct_pool_acquire(pool, size);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    va_start(args, fmt);
+    *len = struct_pack_va_list(buf, 0, fmt, args);
+    va_end(args);
+    return buf;
+}
+
+void *struct_pool_pack_record(
+    struct_pool *pool,
+    const struct_format *sf,
+    const void *record,
+    int *len)
+{
+    void *buf = struct_pool_acquire(pool,
+            struct_format_calcsize_record(sf, record));
+
+    if (buf == NULL) {
+        return NULL;
+    }
+    *len = struct_format_pack_record(sf, buf, record);
+    return buf;
+}
+
+void struct_pool_stats(
+    struct_pool *pool,
+    struct struct_pool_stats *stats)
+{
+    const struct pool_cache *c;
+    long held = 0;
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->gone;
+    for (i = 0; i < pool->nclasses; i++) {
+        held += pool->depot[i].n * class_size(i);
+    }
+    for (c = pool->caches; c != NULL; c = c->next) {
+        stats->acquired += __atomic_load_n(&c->acquired, __ATOMIC_RELAXED);
+        stats->cache_hits +=
+            __atomic_load_n(&c->cache_hits, __ATOMIC_RELAXED);
+        stats->depot_hits +=
+            __atomic_load_n(&c->depot_hits, __ATOMIC_RELAXED);
+        stats->allocated +=
+            __atomic_load_n(&c->allocated, __ATOMIC_RELAXED);
+        for (i = 0; i < pool->nclasses; i++) {
+            held += __atomic_load_n(&c->lists[i].n, __ATOMIC_RELAXED) *
+                class_size(i);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    stats->held = held;
+}
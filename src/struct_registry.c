@@ -0,0 +1,320 @@
+#include "struct_registry.h"
+#include "struct_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DENSE_TAGS      256
+#define FIBONACCI       0x9E3779B97F4A7C15ULL
+
+struct reg_entry {
+    uint64_t tag;
+    struct_format *sf;
+    struct_handler handler;
+    void *arg;
+    void *record;               /* the body is decoded here */
+};
+
+/*
+ * the entries of tags below DENSE_TAGS are indexed by tag, the others
+ * are in an open addressing hash table (linear probing, Fibonacci
+ * hashing) kept at most half full.
+ */
+struct struct_registry {
+    struct_format *tag_sf;
+    int tag_code;
+    struct reg_entry *dense[DENSE_TAGS];
+    struct reg_entry **table;
+    int shift;                  /* 64 - log2(table size) */
+    unsigned long size;
+    unsigned long count;
+};
+
+/* the record of the tag format, a single integer member */
+union tag_member {
+    int8_t b;
+    int16_t h;
+    int32_t i;
+    int64_t q;
+};
+
+static unsigned long slot_of(const struct struct_registry *reg, uint64_t tag)
+{
+    return (unsigned long)((tag * FIBONACCI) >> reg->shift);
+}
+
+static struct reg_entry *lookup(const struct struct_registry *reg,
+        uint64_t tag)
+{
+    struct reg_entry *e;
+    unsigned long i;
+
+    if (tag < DENSE_TAGS) {
+        return reg->dense[tag];
+    }
+    if (reg->table == NULL) {
+        return NULL;
+    }
+
+    for (i = slot_of(reg, tag); (e = reg->table[i]) != NULL;
+            i = (i + 1) & (reg->size - 1)) {
+        if (e->tag == tag) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void insert(struct struct_registry *reg, struct reg_entry *e)
+{
+    unsigned long i = slot_of(reg, e->tag);
+
+    while (reg->table[i] != NULL) {
+        i = (i + 1) & (reg->size - 1);
+    }
+    reg->table[i] = e;
+}
+
+static int grow(struct struct_registry *reg)
+{
+    struct reg_entry **old = reg->table;
+    unsigned long old_size = reg->size;
+    unsigned long i;
+
+    reg->table = calloc(old_size * 2, sizeof(*reg->table));
+    if (reg->table == NULL) {
+        reg->table = old;
+        return -1;
+    }
+    reg->size = old_size * 2;
+    reg->shift--;
+    for (i = 0; i < old_size; i++) {
+        if (old[i] != NULL) {
+            insert(reg, old[i]);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void entry_free(struct reg_entry *e)
+{
+    struct_format_free(e->sf);
+    free(e->record);
+    free(e);
+}
+
+/*
+ * the length of the packed data of sf at bp, -1 if it is truncated, -2 if
+ * it is malformed: it does not end although the worst case length, with
+ * every varint 10 bytes long, is available.
+ */
+static int body_length(const struct_format *sf, const unsigned char *bp,
+        long len)
+{
+    int n = (len < 0x7FFFFFFF) ? len : 0x7FFFFFFF;
+    int ret;
+
+    if (struct_format_is_fixed(sf)) {
+        return (struct_format_calcsize(sf) <= n) ?
+            struct_format_calcsize(sf) : -1;
+    }
+    ret = struct_format_length(sf, bp, n);
+    if (ret < 0 && struct_format_calcsize(sf) <= n) {
+        return -2;
+    }
+    return ret;
+}
+
+struct_registry *struct_registry_new(const char *tag_fmt)
+{
+    struct struct_registry *reg;
+    struct struct_field field;
+
+    reg = calloc(1, sizeof(*reg));
+    if (reg == NULL) {
+        return NULL;
+    }
+
+    reg->tag_sf = struct_compile(tag_fmt);
+    if (reg->tag_sf == NULL || struct_format_nfields(reg->tag_sf) != 1 ||
+            struct_format_field(reg->tag_sf, 0, &field) < 0 ||
+            strchr("BHILQV", field.code) == NULL) {
+        struct_format_free(reg->tag_sf);
+        free(reg);
+        return NULL;
+    }
+    reg->tag_code = field.code;
+    return reg;
+}
+
+void struct_registry_free(struct_registry *reg)
+{
+    unsigned long i;
+
+    if (reg == NULL) {
+        return;
+    }
+    for (i = 0; i < DENSE_TAGS; i++) {
+        if (reg->dense[i] != NULL) {
+            entry_free(reg->dense[i]);
+        }
+    }
+    for (i = 0; i < reg->size; i++) {
+        if (reg->table[i] != NULL) {
+            entry_free(reg->table[i]);
+        }
+    }
+    free(reg->table);
+    struct_format_free(reg->tag_sf);
+    free(reg);
+}
+
+int struct_registry_add(
+    struct_registry *reg,
+    uint64_t tag,
+    const char *fmt,
+    struct_handler handler,
+    void *arg)
+{
+    struct reg_entry *e = lookup(reg, tag);
+    int tag_size = struct_format_calcsize(reg->tag_sf);
+    struct_format *sf;
+    void *record;
+
+    /* a tag the tag format can not hold would be packed truncated */
+    if (struct_format_is_fixed(reg->tag_sf) && tag_size < 8 &&
+            (tag >> (8 * tag_size)) != 0) {
+        return -1;
+    }
+
+    sf = struct_compile(fmt);
+    if (sf == NULL) {
+        return -1;
+    }
+    record = malloc(struct_format_record_size(sf) + 1);
+    if (record == NULL) {
+        struct_format_free(sf);
+        return -1;
+    }
+
+    if (e != NULL) {
+        struct_format_free(e->sf);
+        free(e->record);
+    } else {
+        if (tag >= DENSE_TAGS) {
+            if (reg->table == NULL) {
+                reg->table = calloc(16, sizeof(*reg->table));
+                if (reg->table != NULL) {
+                    reg->size = 16;
+                    reg->shift = 64 - 4;
+                }
+            } else if ((reg->count + 1) * 2 > reg->size) {
+                grow(reg);
+            }
+        }
+        e = malloc(sizeof(*e));
+        if (e == NULL || (tag >= DENSE_TAGS &&
+                    (reg->count + 1) * 2 > reg->size)) {
+            free(e);
+            free(record);
+            struct_format_free(sf);
+            return -1;
+        }
+        e->tag = tag;
+        if (tag < DENSE_TAGS) {
+            reg->dense[tag] = e;
+        } else {
+            insert(reg, e);
+            reg->count++;
+        }
+    }
+
+    e->sf = sf;
+    e->record = record;
+    e->handler = handler;
+    e->arg = arg;
+    return 0;
+}
+
+const struct_format *struct_registry_format(
+    const struct_registry *reg,
+    uint64_t tag)
+{
+    const struct reg_entry *e = lookup(reg, tag);
+
+    return (e != NULL) ? e->sf : NULL;
+}
+
+int struct_registry_pack_record(
+    const struct_registry *reg,
+    void *buf,
+    uint64_t tag,
+    const void *record)
+{
+    const struct reg_entry *e = lookup(reg, tag);
+    unsigned char *bp = (unsigned char *)buf;
+
+    if (e == NULL) {
+        return -1;
+    }
+
+    switch (reg->tag_code) {
+    case 'q': case 'Q': case 'v': case 'V':
+        bp += struct_format_pack(reg->tag_sf, bp, tag);
+        break;
+    default:
+        bp += struct_format_pack(reg->tag_sf, bp, (unsigned int)tag);
+    }
+    bp += struct_format_pack_record(e->sf, bp, record);
+    return (bp - (unsigned char *)buf);
+}
+
+int struct_registry_dispatch(
+    struct_registry *reg,
+    const void *buf,
+    long len,
+    long *consumed)
+{
+    const unsigned char *bp = (const unsigned char *)buf;
+    const unsigned char *end = bp + len;
+    const struct reg_entry *e;
+    union tag_member member;
+    union struct_value tag;
+    int tag_len;
+    int body_len;
+    int ret = 0;
+
+    while (bp < end) {
+        tag_len = body_length(reg->tag_sf, bp, end - bp);
+        if (tag_len < 0) {
+            ret = (tag_len == -2) ? STRUCT_REGISTRY_MALFORMED : 0;
+            break;
+        }
+        struct_format_unpack_record(reg->tag_sf, bp, &member);
+        struct_record_value(reg->tag_code, &member, &tag);
+
+        e = lookup(reg, tag.Q);
+        if (e == NULL) {
+            ret = STRUCT_REGISTRY_UNKNOWN;
+            break;
+        }
+        body_len = body_length(e->sf, bp + tag_len, end - bp - tag_len);
+        if (body_len < 0) {
+            ret = (body_len == -2) ? STRUCT_REGISTRY_MALFORMED : 0;
+            break;
+        }
+
+        struct_format_unpack_record(e->sf, bp + tag_len, e->record);
+        bp += tag_len + body_len;
+        if (e->handler != NULL) {
+            ret = e->handler(tag.Q, e->record, e->arg);
+            if (ret != 0) {
+                break;
+            }
+        }
+    }
+
+    *consumed = bp - (const unsigned char *)buf;
+    return ret;
+}
@@ -0,0 +1,215 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "struct_ring.h"
+#include "struct_internal.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE      64
+
+/*
+ * header of a record: its length, or RING_WRAP if the rest of the ring
+ * up to the end is unused and the next record is at the beginning.
+ */
+#define RING_WRAP       0xFFFFFFFFU
+#define RING_HEADER     sizeof(uint32_t)
+#define RING_ALIGN(n)   (((n) + 7) & ~(uint64_t)7)
+
+/*
+ * the indices grow forever and are masked into the ring.
+ * every group of fields written by one side has a cache line of its own.
+ */
+struct struct_ring {
+    /* shared, written by the producer */
+    uint64_t head;
+    char pad0[CACHE_LINE - sizeof(uint64_t)];
+
+    /* shared, written by the consumer */
+    uint64_t tail;
+    char pad1[CACHE_LINE - sizeof(uint64_t)];
+
+    /* producer */
+    uint64_t p_head;            /* private head */
+    uint64_t p_tail;            /* last tail seen */
+    uint64_t p_slot;            /* position of the reserved slot */
+    int p_pending;              /* records not published yet */
+    char pad2[CACHE_LINE - 3 * sizeof(uint64_t) - sizeof(int)];
+
+    /* consumer */
+    uint64_t c_tail;            /* private tail */
+    uint64_t c_head;            /* last head seen */
+    int c_pending;              /* records not published yet */
+    char pad3[CACHE_LINE - 2 * sizeof(uint64_t) - sizeof(int)];
+
+    /* read-only */
+    unsigned char *buf;
+    uint64_t capacity;
+    uint64_t mask;
+    int batch;
+};
+
+struct_ring *struct_ring_new(int capacity, int batch)
+{
+    struct struct_ring *r;
+    void *mem;
+
+    if (capacity < 16 || (capacity & (capacity - 1)) != 0) {
+        return NULL;
+    }
+
+    if (posix_memalign(&mem, CACHE_LINE, sizeof(*r)) != 0) {
+        return NULL;
+    }
+    r = mem;
+    memset(r, 0, sizeof(*r));
+    if (posix_memalign(&mem, CACHE_LINE, capacity) != 0) {
+        free(r);
+        return NULL;
+    }
+    r->buf = mem;
+    r->capacity = capacity;
+    r->mask = capacity - 1;
+    r->batch = (batch > 0) ? batch : 1;
+    return r;
+}
+
+void struct_ring_free(struct_ring *r)
+{
+    if (r == NULL) {
+        return;
+    }
+    free(r->buf);
+    free(r);
+}
+
+void *struct_ring_reserve(struct_ring *r, int size)
+{
+    uint64_t need = RING_ALIGN(RING_HEADER + (uint64_t)size);
+    uint64_t pos = r->p_head & r->mask;
+    uint64_t contig = r->capacity - pos;
+    uint64_t total = (contig < need) ? contig + need : need;
+
+    if (size < 0 || need > r->capacity) {
+        return NULL;
+    }
+
+    if (r->capacity - (r->p_head - r->p_tail) < total) {
+        r->p_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (r->capacity - (r->p_head - r->p_tail) < total) {
+            /* let the consumer see everything before we wait for it */
+            struct_ring_publish(r);
+            return NULL;
+        }
+    }
+
+    if (contig < need) {
+        *(uint32_t *)(r->buf + pos) = RING_WRAP;
+        r->p_head += contig;
+        pos = 0;
+    }
+    r->p_slot = pos;
+    return r->buf + pos + RING_HEADER;
+}
+
+void struct_ring_commit(struct_ring *r, int len)
+{
+    *(uint32_t *)(r->buf + r->p_slot) = len;
+    r->p_head += RING_ALIGN(RING_HEADER + (uint64_t)len);
+    if (++r->p_pending >= r->batch) {
+        struct_ring_publish(r);
+    }
+}
+
+void struct_ring_publish(struct_ring *r)
+{
+    __atomic_store_n(&r->head, r->p_head, __ATOMIC_RELEASE);
+    r->p_pending = 0;
+}
+
+int struct_ring_pack(struct_ring *r, const char *fmt, ...)
+{
+    va_list args;
+    unsigned char *slot;
+    int size;
+    int len;
+
+    /* the exact size of the values, as struct_ring_pack_record() */
+    va_start(args, fmt);
+    size = struct_calcsize_va_list(fmt, args);
+    if (size < 0 || RING_ALIGN(RING_HEADER + (uint64_t)size) > r->capacity) {
+        va_end(args);
+        return -1;
+    }
+    slot = struct_ring_reserve(r, size);
+    if (slot == NULL) {
+        va_end(args);
+        return 0;
+    }
+    len = struct_pack_va_list(slot, 0, fmt, args);
+    va_end(args);
+
+    struct_ring_commit(r, len);
+    return len;
+}
+
+int struct_ring_pack_record(
+    struct_ring *r,
+    const struct_format *sf,
+    const void *record)
+{
+    unsigned char *slot;
+    int size = struct_format_calcsize_record(sf, record);
+    int len;
+
+    if (RING_ALIGN(RING_HEADER + (uint64_t)size) > r->capacity) {
+        return -1;
+    }
+    slot = struct_ring_reserve(r, size);
+    if (slot == NULL) {
+        return 0;
+    }
+
+    len = struct_format_pack_record(sf, slot, record);
+    struct_ring_commit(r, len);
+    return len;
+}
+
+const void *struct_ring_peek(struct_ring *r, int *len)
+{
+    uint64_t pos;
+    uint32_t header;
+
+    for (;;) {
+        if (r->c_tail == r->c_head) {
+            r->c_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            if (r->c_tail == r->c_head) {
+                /* give the producer back everything we have read */
+                __atomic_store_n(&r->tail, r->c_tail, __ATOMIC_RELEASE);
+                r->c_pending = 0;
+                return NULL;
+            }
+        }
+
+        pos = r->c_tail & r->mask;
+        header = *(uint32_t *)(r->buf + pos);
+        if (header != RING_WRAP) {
+            *len = header;
+            return r->buf + pos + RING_HEADER;
+        }
+        r->c_tail += r->capacity - pos;
+    }
+}
+
+void struct_ring_release(struct_ring *r)
+{
+    uint32_t len = *(uint32_t *)(r->buf + (r->c_tail & r->mask));
+
+    r->c_tail += RING_ALIGN(RING_HEADER + (uint64_t)len);
+    if (++r->c_pending >= r->batch) {
+        __atomic_store_n(&r->tail, r->c_tail, __ATOMIC_RELEASE);
+        r->c_pending = 0;
+    }
+}
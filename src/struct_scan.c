@@ -0,0 +1,483 @@
+#include "struct_scan.h"
+#include "struct_internal.h"
+#include "struct_endian.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOSWAP(x)       (x)
+#define SWAP16(x)       __builtin_bswap16(x)
+#define SWAP32(x)       __builtin_bswap32(x)
+#define SWAP64(x)       __builtin_bswap64(x)
+
+/* the IEEE 754 bits of an order preserving ('^') float */
+#define UNORDER32(x) \
+    (((x) & 0x80000000U) ? (x) ^ 0x80000000U : ~(x))
+#define UNORDER64(x) \
+    (((x) & 0x8000000000000000ULL) ? (x) ^ 0x8000000000000000ULL : ~(x))
+#define ORDERED32(x)        UNORDER32(NOSWAP(x))
+#define ORDERED64(x)        UNORDER64(NOSWAP(x))
+#define SWAP_ORDERED32(x)   UNORDER32(SWAP32(x))
+#define SWAP_ORDERED64(x)   UNORDER64(SWAP64(x))
+
+/*
+ * expand loop with the byte order conversion conv of the field:
+ * swapped or plain, so that the loop has no branch on it.
+ */
+#define SWAP_OR_NOT(loop, swapped, plain, ...) \
+    do {                                        \
+        if (swap) {                             \
+            loop(swapped, __VA_ARGS__);         \
+        } else {                                \
+            loop(plain, __VA_ARGS__);           \
+        }                                       \
+    } while (0)
+
+/*
+ * the values are read as utype, converted, flipped (the sign bit of the
+ * order preserving byte order) and taken as vtype.
+ */
+#define SCAN_SIGNED(conv, utype, vtype)                         \
+    for (i = 0; i < n; i++) {                                   \
+        utype raw;                                              \
+        int64_t v;                                              \
+        memcpy(&raw, bp + i * stride, sizeof(raw));             \
+        v = (vtype)(utype)(conv(raw) ^ (utype)flip);            \
+        usum += (uint64_t)v;                                    \
+        imin = (v < imin) ? v : imin;                           \
+        imax = (v > imax) ? v : imax;                           \
+    }
+
+#define SCAN_UNSIGNED(conv, utype)                              \
+    for (i = 0; i < n; i++) {                                   \
+        utype raw;                                              \
+        uint64_t v;                                             \
+        memcpy(&raw, bp + i * stride, sizeof(raw));             \
+        v = (utype)conv(raw);                                   \
+        usum += v;                                              \
+        umin = (v < umin) ? v : umin;                           \
+        umax = (v > umax) ? v : umax;                           \
+    }
+
+#define SCAN_FLOATS(conv, utype, ftype)                         \
+    for (i = 0; i < n; i++) {                                   \
+        utype raw;                                              \
+        ftype f;                                                \
+        memcpy(&raw, bp + i * stride, sizeof(raw));             \
+        raw = conv(raw);                                        \
+        memcpy(&f, &raw, sizeof(f));                            \
+        dsum += f;                                              \
+        dmin = (f < dmin) ? f : dmin;                           \
+        dmax = (f > dmax) ? f : dmax;                           \
+    }
+
+/*
+ * find field of a fixed size format: whether it must be byte swapped,
+ * and whether it is in the order preserving byte order.
+ */
+static int scan_field(const struct_format *sf, int field,
+        struct struct_field *f, int *swap, int *ordered)
+{
+    if (!struct_format_is_fixed(sf) ||
+            struct_format_field(sf, field, f) < 0 ||
+            strchr("sp", f->code) != NULL) {
+        return -1;
+    }
+    *ordered = (f->endian == STRUCT_ENDIAN_ORDERED);
+    /* the order preserving byte order is big-endian */
+    *swap = (f->endian != struct_get_endian() &&
+            !(*ordered && struct_get_endian() == STRUCT_ENDIAN_BIG));
+    return 0;
+}
+
+int struct_scan_aggregate(
+    const struct_format *sf,
+    const void *buf,
+    long nrecords,
+    int field,
+    struct struct_aggregate *agg)
+{
+    struct struct_field f;
+    const unsigned char *bp;
+    long stride = struct_format_calcsize(sf);
+    long n = nrecords;
+    long i;
+    uint64_t usum = 0;
+    uint64_t umin = UINT64_MAX;
+    uint64_t umax = 0;
+    int64_t imin = INT64_MAX;
+    int64_t imax = INT64_MIN;
+    double dsum = 0;
+    double dmin = HUGE_VAL;
+    double dmax = -HUGE_VAL;
+    uint64_t flip = 0;
+    int ordered;
+    int swap;
+
+    if (nrecords < 0 || scan_field(sf, field, &f, &swap, &ordered) < 0) {
+        return -1;
+    }
+    bp = (const unsigned char *)buf + f.position;
+    if (ordered) {
+        flip = (uint64_t)1 << (f.size * 8 - 1);
+    }
+
+    switch (f.code) {
+    case 'b':
+        SCAN_SIGNED(NOSWAP, uint8_t, int8_t);
+        break;
+    case 'h':
+        SWAP_OR_NOT(SCAN_SIGNED, SWAP16, NOSWAP, uint16_t, int16_t);
+        break;
+    case 'i': /* fall through */
+    case 'l':
+        SWAP_OR_NOT(SCAN_SIGNED, SWAP32, NOSWAP, uint32_t, int32_t);
+        break;
+    case 'q':
+        SWAP_OR_NOT(SCAN_SIGNED, SWAP64, NOSWAP, uint64_t, int64_t);
+        break;
+    case 'B':
+        SCAN_UNSIGNED(NOSWAP, uint8_t);
+        break;
+    case 'H':
+        SWAP_OR_NOT(SCAN_UNSIGNED, SWAP16, NOSWAP, uint16_t);
+        break;
+    case 'I': /* fall through */
+    case 'L':
+        SWAP_OR_NOT(SCAN_UNSIGNED, SWAP32, NOSWAP, uint32_t);
+        break;
+    case 'Q':
+        SWAP_OR_NOT(SCAN_UNSIGNED, SWAP64, NOSWAP, uint64_t);
+        break;
+    case 'f':
+        if (ordered) {
+            SWAP_OR_NOT(SCAN_FLOATS, SWAP_ORDERED32, ORDERED32,
+                    uint32_t, float);
+        } else {
+            SWAP_OR_NOT(SCAN_FLOATS, SWAP32, NOSWAP, uint32_t, float);
+        }
+        break;
+    case 'd':
+        if (ordered) {
+            SWAP_OR_NOT(SCAN_FLOATS, SWAP_ORDERED64, ORDERED64,
+                    uint64_t, double);
+        } else {
+            SWAP_OR_NOT(SCAN_FLOATS, SWAP64, NOSWAP, uint64_t, double);
+        }
+        break;
+    }
+
+    agg->count = nrecords;
+    switch (f.code) {
+    case 'b': case 'h': case 'i': case 'l': case 'q':
+        agg->sum.i = (int64_t)usum;
+        agg->min.i = imin;
+        agg->max.i = imax;
+        break;
+    case 'f': /* fall through */
+    case 'd':
+        agg->sum.d = dsum;
+        agg->min.d = dmin;
+        agg->max.d = dmax;
+        break;
+    default:
+        agg->sum.u = usum;
+        agg->min.u = umin;
+        agg->max.u = umax;
+    }
+    return 0;
+}
+
+/*
+ * filters compare keys: unsigned integers of the same order as the
+ * values of the field, see key_of().
+ */
+#define SCAN_BLOCK      1024
+#define KEY_SIGN        0x8000000000000000ULL
+
+/* the key of a double, -0.0 being 0.0 */
+#define DOUBLE_KEY(d, bits)                                     \
+    (memcpy(&(bits), &(d), sizeof(bits)),                       \
+     (bits) = ((d) == 0) ? 0 : (bits),                          \
+     (bits) ^ ((0 - ((bits) >> 63)) | KEY_SIGN))
+
+#define LOAD_SIGNED(conv, utype, vtype)                         \
+    for (i = 0; i < n; i++) {                                   \
+        utype raw;                                              \
+        memcpy(&raw, bp + i * stride, sizeof(raw));             \
+        keys[i] = (uint64_t)(int64_t)(vtype)(utype)             \
+            (conv(raw) ^ (utype)flip) ^ KEY_SIGN;               \
+    }
+
+#define LOAD_UNSIGNED(conv, utype)                              \
+    for (i = 0; i < n; i++) {                                   \
+        utype raw;                                              \
+        memcpy(&raw, bp + i * stride, sizeof(raw));             \
+        keys[i] = (utype)conv(raw);                             \
+    }
+
+#define LOAD_FLOATS(conv, utype, ftype)                         \
+    for (i = 0; i < n; i++) {                                   \
+        utype raw;                                              \
+        ftype f;                                                \
+        double d;                                               \
+        uint64_t bits;                                          \
+        memcpy(&raw, bp + i * stride, sizeof(raw));             \
+        raw = conv(raw);                                        \
+        memcpy(&f, &raw, sizeof(f));                            \
+        d = f;                                                  \
+        keys[i] = DOUBLE_KEY(d, bits);                          \
+    }
+
+#define COMPARE(expr)                                           \
+    for (i = 0; i < n; i++) {                                   \
+        mask[i] &= (expr);                                      \
+    }
+
+/*
+ * a predicate of a filter.
+ */
+struct scan_predicate {
+    struct struct_field field;
+    int op;
+    int swap;
+    int ordered;
+    uint64_t key;               /* of the value */
+};
+
+static uint64_t key_of(int code, const union struct_number *value)
+{
+    double d;
+    uint64_t bits;
+
+    switch (code) {
+    case 'b': case 'h': case 'i': case 'l': case 'q':
+        return (uint64_t)value->i ^ KEY_SIGN;
+    case 'f':
+        /* as the float a field holds */
+        d = (float)value->d;
+        return DOUBLE_KEY(d, bits);
+    case 'd':
+        d = value->d;
+        return DOUBLE_KEY(d, bits);
+    default:
+        return value->u;
+    }
+}
+
+/*
+ * the keys of the field of n records at bp.
+ */
+static void load_keys(const struct scan_predicate *p,
+        const unsigned char *bp, long stride, long n, uint64_t *keys)
+{
+    uint64_t flip = 0;
+    int swap = p->swap;
+    long i;
+
+    if (p->ordered) {
+        flip = (uint64_t)1 << (p->field.size * 8 - 1);
+    }
+    bp += p->field.position;
+
+    switch (p->field.code) {
+    case 'b':
+        LOAD_SIGNED(NOSWAP, uint8_t, int8_t);
+        break;
+    case 'h':
+        SWAP_OR_NOT(LOAD_SIGNED, SWAP16, NOSWAP, uint16_t, int16_t);
+        break;
+    case 'i': /* fall through */
+    case 'l':
+        SWAP_OR_NOT(LOAD_SIGNED, SWAP32, NOSWAP, uint32_t, int32_t);
+        break;
+    case 'q':
+        SWAP_OR_NOT(LOAD_SIGNED, SWAP64, NOSWAP, uint64_t, int64_t);
+        break;
+    case 'B':
+        LOAD_UNSIGNED(NOSWAP, uint8_t);
+        break;
+    case 'H':
+        SWAP_OR_NOT(LOAD_UNSIGNED, SWAP16, NOSWAP, uint16_t);
+        break;
+    case 'I': /* fall through */
+    case 'L':
+        SWAP_OR_NOT(LOAD_UNSIGNED, SWAP32, NOSWAP, uint32_t);
+        break;
+    case 'Q':
+        SWAP_OR_NOT(LOAD_UNSIGNED, SWAP64, NOSWAP, uint64_t);
+        break;
+    case 'f':
+        if (p->ordered) {
+            SWAP_OR_NOT(LOAD_FLOATS, SWAP_ORDERED32, ORDERED32,
+                    uint32_t, float);
+        } else {
+            SWAP_OR_NOT(LOAD_FLOATS, SWAP32, NOSWAP, uint32_t, float);
+        }
+        break;
+    case 'd':
+        if (p->ordered) {
+            SWAP_OR_NOT(LOAD_FLOATS, SWAP_ORDERED64, ORDERED64,
+                    uint64_t, double);
+        } else {
+            SWAP_OR_NOT(LOAD_FLOATS, SWAP64, NOSWAP, uint64_t, double);
+        }
+        break;
+    }
+}
+
+/*
+ * and the mask of n records with a predicate.
+ */
+static void compare_keys(const struct scan_predicate *p,
+        const uint64_t *keys, long n, unsigned char *mask)
+{
+    uint64_t c = p->key;
+    long i;
+
+    switch (p->op) {
+    case STRUCT_SCAN_EQ:
+        COMPARE(keys[i] == c);
+        break;
+    case STRUCT_SCAN_NE:
+        COMPARE(keys[i] != c);
+        break;
+    case STRUCT_SCAN_LT:
+        COMPARE(keys[i] < c);
+        break;
+    case STRUCT_SCAN_LE:
+        COMPARE(keys[i] <= c);
+        break;
+    case STRUCT_SCAN_GT:
+        COMPARE(keys[i] > c);
+        break;
+    case STRUCT_SCAN_GE:
+        COMPARE(keys[i] >= c);
+        break;
+    }
+}
+
+/*
+ * filter nrecords records by blocks, calling emit with the mask of each
+ * block. returns the number of records matching, -1 on failure.
+ */
+static long filter(const struct_format *sf, const void *buf, long nrecords,
+        const struct struct_predicate *preds, int npreds,
+        long (*emit)(const unsigned char *mask, long base, long n,
+            void *out), void *out)
+{
+    struct scan_predicate *p;
+    uint64_t keys[SCAN_BLOCK];
+    unsigned char mask[SCAN_BLOCK];
+    long stride = struct_format_calcsize(sf);
+    long count = 0;
+    long base;
+    long n;
+    int k;
+
+    if (!struct_format_is_fixed(sf) || nrecords < 0 || npreds < 0) {
+        return -1;
+    }
+    p = malloc((npreds + 1) * sizeof(*p));
+    if (p == NULL) {
+        return -1;
+    }
+    for (k = 0; k < npreds; k++) {
+        if (scan_field(sf, preds[k].field, &p[k].field, &p[k].swap,
+                    &p[k].ordered) < 0 ||
+                preds[k].op < STRUCT_SCAN_EQ || preds[k].op > STRUCT_SCAN_GE) {
+            free(p);
+            return -1;
+        }
+        p[k].op = preds[k].op;
+        p[k].key = key_of(p[k].field.code, &preds[k].value);
+    }
+
+    for (base = 0; base < nrecords; base += n) {
+        n = (nrecords - base < SCAN_BLOCK) ? nrecords - base : SCAN_BLOCK;
+        memset(mask, 1, n);
+        for (k = 0; k < npreds; k++) {
+            load_keys(&p[k], (const unsigned char *)buf + base * stride,
+                    stride, n, keys);
+            compare_keys(&p[k], keys, n, mask);
+        }
+        count += emit(mask, base, n, out);
+    }
+
+    free(p);
+    return count;
+}
+
+static long emit_selection(const unsigned char *mask, long base, long n,
+        void *out)
+{
+    long *sel = *(long **)out;
+    long count = 0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        sel[count] = base + i;
+        count += mask[i];
+    }
+    *(long **)out = sel + count;
+    return count;
+}
+
+static long emit_bitmap(const unsigned char *mask, long base, long n,
+        void *out)
+{
+    unsigned char *bitmap = (unsigned char *)out + base / 8;
+    long count = 0;
+    long i;
+
+    /* base is a multiple of 8 */
+    memset(bitmap, 0, (n + 7) / 8);
+    for (i = 0; i < n; i++) {
+        bitmap[i / 8] |= mask[i] << (i % 8);
+        count += mask[i];
+    }
+    return count;
+}
+
+long struct_scan_select(
+    const struct_format *sf,
+    const void *buf,
+    long nrecords,
+    const struct struct_predicate *preds,
+    int npreds,
+    long *sel)
+{
+    return filter(sf, buf, nrecords, preds, npreds, emit_selection, &sel);
+}
+
+long struct_scan_bitmap(
+    const struct_format *sf,
+    const void *buf,
+    long nrecords,
+    const struct struct_predicate *preds,
+    int npreds,
+    unsigned char *bitmap)
+{
+    return filter(sf, buf, nrecords, preds, npreds, emit_bitmap, bitmap);
+}
+
+long struct_scan_gather(
+    const struct_format *sf,
+    const void *buf,
+    const long *sel,
+    long nsel,
+    void *out)
+{
+    long size = struct_format_calcsize(sf);
+    long i;
+
+    if (!struct_format_is_fixed(sf) || nsel < 0) {
+        return -1;
+    }
+    for (i = 0; i < nsel; i++) {
+        memcpy((unsigned char *)out + i * size,
+                (const unsigned char *)buf + sel[i] * size, size);
+    }
+    return nsel * size;
+}
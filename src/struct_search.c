@@ -0,0 +1,476 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "struct_search.h"
+#include "struct_internal.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SEARCH_BUFSIZE  4096
+#define INDEX_MAGIC     "SIDX"
+#define INDEX_HEADER    "!4sBIIQQ"  /* magic, code, width, every, counts */
+
+/*
+ * a sequential reader of the records of a file from an offset.
+ */
+struct search_scan {
+    int fd;
+    const struct_format *sf;
+    unsigned char *buf;
+    int size;
+    long pos;                   /* file offset of buf[0] */
+    int start;                  /* the unread data is [start, end) */
+    int end;
+    int eof;
+};
+
+struct struct_index {
+    const struct_format *sf;
+    struct struct_field field;
+    int width;
+    int every;
+    long nrecords;
+    long nentries;
+    long cap;
+    long *offsets;              /* of the entries */
+    unsigned char *keys;        /* width bytes per entry */
+    unsigned char *record;      /* scratch record */
+    unsigned char *key;         /* scratch keys: probe, record */
+};
+
+static int scan_init(struct search_scan *sc, const struct_format *sf,
+        int fd, long pos)
+{
+    sc->fd = fd;
+    sc->sf = sf;
+    sc->size = (struct_format_calcsize(sf) > SEARCH_BUFSIZE) ?
+        struct_format_calcsize(sf) : SEARCH_BUFSIZE;
+    sc->buf = malloc(sc->size);
+    sc->pos = pos;
+    sc->start = 0;
+    sc->end = 0;
+    sc->eof = 0;
+    return (sc->buf != NULL) ? 0 : -1;
+}
+
+/*
+ * the next record, NULL at the end of the file. *offset is set to its
+ * offset and *len to its length, or to -1 if the file is malformed or a
+ * read failed.
+ */
+static const unsigned char *scan_next(struct search_scan *sc, long *offset,
+        int *len)
+{
+    const unsigned char *rec;
+    int max = struct_format_calcsize(sc->sf);
+    int avail;
+    ssize_t n;
+
+    for (;;) {
+        avail = sc->end - sc->start;
+        *len = struct_format_length(sc->sf, sc->buf + sc->start,
+                (avail < max) ? avail : max);
+        if (*len > 0) {
+            rec = sc->buf + sc->start;
+            *offset = sc->pos + sc->start;
+            sc->start += *len;
+            return rec;
+        }
+        if (avail >= max || sc->eof) {
+            *len = (avail > 0) ? -1 : 0;
+            return NULL;
+        }
+
+        memmove(sc->buf, sc->buf + sc->start, avail);
+        sc->pos += sc->start;
+        sc->start = 0;
+        sc->end = avail;
+        n = pread(sc->fd, sc->buf + sc->end, sc->size - sc->end,
+                sc->pos + sc->end);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *len = -1;
+            return NULL;
+        }
+        sc->eof = (n == 0);
+        sc->end += n;
+    }
+}
+
+static int read_full(int fd, void *buf, long len, long offset)
+{
+    unsigned char *bp = (unsigned char *)buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = (offset >= 0) ? pread(fd, bp, len, offset) : read(fd, bp, len);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bp += n;
+        len -= n;
+        if (offset >= 0) {
+            offset += n;
+        }
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, long len)
+{
+    const unsigned char *bp = (const unsigned char *)buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, bp, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bp += n;
+        len -= n;
+    }
+    return 0;
+}
+
+long struct_search_fixed(
+    const struct_format *sf,
+    int key,
+    int fd,
+    const void *probe,
+    void *record)
+{
+    struct struct_field field;
+    struct stat st;
+    unsigned char *mem;
+    unsigned char *buf;
+    unsigned char *scratch;
+    unsigned char *probe_key;
+    unsigned char *rec_key;
+    long size = struct_format_calcsize(sf);
+    long lo = 0;
+    long hi;
+    long mid;
+    long found = -1;
+    int width;
+
+    if (!struct_format_is_fixed(sf) || size <= 0 ||
+            struct_format_field(sf, key, &field) < 0 ||
+            fstat(fd, &st) < 0) {
+        return -1;
+    }
+    width = struct_key_width(&field);
+    mem = malloc(size + struct_format_record_size(sf) + 1 + 2 * width);
+    if (mem == NULL) {
+        return -1;
+    }
+    buf = mem;
+    scratch = buf + size;
+    probe_key = scratch + struct_format_record_size(sf) + 1;
+    rec_key = probe_key + width;
+    struct_key_encode(&field, probe, probe_key);
+
+    /* the first record whose key is not less than the probe */
+    hi = st.st_size / size;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (read_full(fd, buf, size, mid * size) < 0) {
+            goto out;
+        }
+        struct_format_unpack_record(sf, buf, scratch);
+        struct_key_encode(&field, scratch, rec_key);
+        if (memcmp(rec_key, probe_key, width) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < st.st_size / size && read_full(fd, buf, size, lo * size) == 0) {
+        struct_format_unpack_record(sf, buf, scratch);
+        struct_key_encode(&field, scratch, rec_key);
+        if (memcmp(rec_key, probe_key, width) == 0) {
+            if (record != NULL) {
+                memcpy(record, scratch, struct_format_record_size(sf));
+            }
+            found = lo * size;
+        }
+    }
+
+out:
+    free(mem);
+    return found;
+}
+
+static struct struct_index *index_new(const struct_format *sf, int key)
+{
+    struct struct_index *idx = calloc(1, sizeof(*idx));
+
+    if (idx == NULL) {
+        return NULL;
+    }
+    if (struct_format_calcsize(sf) <= 0 ||
+            struct_format_field(sf, key, &idx->field) < 0) {
+        free(idx);
+        return NULL;
+    }
+    idx->sf = sf;
+    idx->width = struct_key_width(&idx->field);
+    idx->record = malloc(struct_format_record_size(sf) + 1);
+    idx->key = malloc(2 * idx->width + 1);
+    if (idx->record == NULL || idx->key == NULL) {
+        struct_index_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+/*
+ * make room for n entries.
+ */
+static int index_reserve(struct struct_index *idx, long n)
+{
+    long *offsets;
+    unsigned char *keys;
+    long cap;
+
+    if (n <= idx->cap) {
+        return 0;
+    }
+    cap = (n > idx->cap * 2) ? n : idx->cap * 2;
+    offsets = realloc(idx->offsets, cap * sizeof(*offsets));
+    if (offsets == NULL) {
+        return -1;
+    }
+    idx->offsets = offsets;
+    keys = realloc(idx->keys, cap * idx->width + 1);
+    if (keys == NULL) {
+        return -1;
+    }
+    idx->keys = keys;
+    idx->cap = cap;
+    return 0;
+}
+
+struct_index *struct_index_build(
+    const struct_format *sf,
+    int key,
+    int fd,
+    int every)
+{
+    struct struct_index *idx;
+    struct search_scan sc;
+    const unsigned char *rec;
+    long offset;
+    int len;
+
+    if (every <= 0) {
+        return NULL;
+    }
+    idx = index_new(sf, key);
+    if (idx == NULL) {
+        return NULL;
+    }
+    idx->every = every;
+    if (scan_init(&sc, sf, fd, 0) < 0) {
+        struct_index_free(idx);
+        return NULL;
+    }
+
+    while ((rec = scan_next(&sc, &offset, &len)) != NULL) {
+        if (idx->nrecords++ % every != 0) {
+            continue;
+        }
+        if (index_reserve(idx, idx->nentries + 1) < 0) {
+            len = -1;
+            break;
+        }
+        struct_format_unpack_record(sf, rec, idx->record);
+        idx->offsets[idx->nentries] = offset;
+        struct_key_encode(&idx->field, idx->record,
+                idx->keys + idx->nentries * idx->width);
+        idx->nentries++;
+    }
+
+    free(sc.buf);
+    if (len < 0) {
+        struct_index_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+int struct_index_save(const struct_index *idx, int fd)
+{
+    long entry = 8 + idx->width;
+    int header = struct_calcsize(INDEX_HEADER);
+    unsigned char *buf;
+    long i;
+    int ret;
+
+    buf = malloc(header + idx->nentries * entry);
+    if (buf == NULL) {
+        return -1;
+    }
+    struct_pack(buf, INDEX_HEADER, INDEX_MAGIC, idx->field.code,
+            idx->width, idx->every, (uint64_t)idx->nrecords,
+            (uint64_t)idx->nentries);
+    for (i = 0; i < idx->nentries; i++) {
+        struct_pack(buf + header + i * entry, "!Q",
+                (uint64_t)idx->offsets[i]);
+        memcpy(buf + header + i * entry + 8, idx->keys + i * idx->width,
+                idx->width);
+    }
+
+    ret = write_full(fd, buf, header + idx->nentries * entry);
+    free(buf);
+    return ret;
+}
+
+struct_index *struct_index_load(
+    const struct_format *sf,
+    int key,
+    int fd)
+{
+    struct struct_index *idx = index_new(sf, key);
+    unsigned char header[64];
+    unsigned char entry[8];
+    char magic[5];
+    unsigned char code;
+    unsigned int width;
+    unsigned int every;
+    uint64_t nrecords;
+    uint64_t nentries;
+    uint64_t offset;
+    uint64_t i;
+
+    if (idx == NULL) {
+        return NULL;
+    }
+    if (read_full(fd, header, struct_calcsize(INDEX_HEADER), -1) < 0) {
+        goto fail;
+    }
+    struct_unpack(header, INDEX_HEADER, magic, &code, &width, &every,
+            &nrecords, &nentries);
+    /* an entry every every records, the first one at the first record */
+    if (memcmp(magic, INDEX_MAGIC, 4) != 0 || code != idx->field.code ||
+            (int)width != idx->width || every == 0 || every > INT_MAX ||
+            nrecords > LONG_MAX ||
+            nentries != (nrecords + every - 1) / every) {
+        goto fail;
+    }
+    idx->every = every;
+    idx->nrecords = (long)nrecords;
+
+    /*
+     * the arrays grow with the entries read, so a corrupted count does not
+     * allocate more than the file holds. the offsets must increase.
+     */
+    for (i = 0; i < nentries; i++) {
+        if (index_reserve(idx, (long)i + 1) < 0 ||
+                read_full(fd, entry, 8, -1) < 0 ||
+                read_full(fd, idx->keys + i * width, width, -1) < 0) {
+            goto fail;
+        }
+        struct_unpack(entry, "!Q", &offset);
+        if (offset > LONG_MAX || (i == 0 && offset != 0) ||
+                (i > 0 && (long)offset <= idx->offsets[i - 1])) {
+            goto fail;
+        }
+        idx->offsets[i] = (long)offset;
+    }
+    idx->nentries = (long)nentries;
+    return idx;
+
+fail:
+    struct_index_free(idx);
+    return NULL;
+}
+
+long struct_index_search(
+    struct_index *idx,
+    int fd,
+    const void *probe,
+    void *record)
+{
+    struct search_scan sc;
+    const unsigned char *rec;
+    unsigned char *rec_key = idx->key + idx->width;
+    long lo = 0;
+    long hi = idx->nentries;
+    long mid;
+    long offset;
+    long found = -1;
+    int len;
+    int c;
+
+    if (idx->nentries == 0) {
+        return -1;
+    }
+    struct_key_encode(&idx->field, probe, idx->key);
+
+    /* the first entry whose key is not less than the probe */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (memcmp(idx->keys + mid * idx->width, idx->key,
+                    idx->width) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* the first record of the key is after the previous entry */
+    if (scan_init(&sc, idx->sf, fd,
+                idx->offsets[(lo > 0) ? lo - 1 : 0]) < 0) {
+        free(sc.buf);
+        return -1;
+    }
+    while ((rec = scan_next(&sc, &offset, &len)) != NULL) {
+        struct_format_unpack_record(idx->sf, rec, idx->record);
+        struct_key_encode(&idx->field, idx->record, rec_key);
+        c = memcmp(rec_key, idx->key, idx->width);
+        if (c < 0) {
+            continue;
+        }
+        if (c == 0) {
+            if (record != NULL) {
+                memcpy(record, idx->record,
+                        struct_format_record_size(idx->sf));
+            }
+            found = offset;
+        }
+        break;
+    }
+
+    free(sc.buf);
+    return found;
+}
+
+long struct_index_nrecords(const struct_index *idx)
+{
+    return idx->nrecords;
+}
+
+void struct_index_free(struct_index *idx)
+{
+    if (idx == NULL) {
+        return;
+    }
+    free(idx->offsets);
+    free(idx->keys);
+    free(idx->record);
+    free(idx->key);
+    free(idx);
+}
@@ -0,0 +1,324 @@
+#include "struct_sort.h"
+#include "struct_internal.h"
+#include "struct_endian.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SORT_RADIX      256
+#define SORT_CHUNK      8           /* key bytes sorted at once */
+#define SORT_WIDE       16          /* wider records are sorted as items */
+
+/*
+ * a record (its index in the array) and a chunk of its key.
+ */
+struct sort_item {
+    uint64_t key;
+    long index;
+};
+
+/*
+ * one chunk of the elements, records or items, handled by one thread.
+ */
+struct sort_job {
+    const struct struct_field *field;
+    const unsigned char *records;   /* for the keys of items */
+    int record_size;
+    int items;                  /* the elements are items */
+    int esize;                  /* element size */
+    int from;                   /* key bytes [from, from + width) */
+    int width;
+    int digit;                  /* the byte counted, -1 for every one */
+    const unsigned char *src;
+    unsigned char *dst;
+    long lo;                    /* the chunk is [lo, hi) */
+    long hi;
+    long count[SORT_CHUNK][SORT_RADIX];
+    long offset[SORT_RADIX];
+};
+
+/*
+ * the key bytes [from, from + width) of the record at rec as an unsigned
+ * integer of the same order as the key.
+ */
+static uint64_t key_value(const struct struct_field *field,
+        const unsigned char *rec, int from, int width)
+{
+    const unsigned char *bp = rec + field->position + from;
+    uint64_t sign = (uint64_t)1 << (width * 8 - 1);
+    uint64_t val = 0;
+    int i;
+
+    if (field->endian == STRUCT_ENDIAN_LITTLE && field->code != 's') {
+        for (i = width - 1; i >= 0; i--) {
+            val = (val << 8) | bp[i];
+        }
+    } else {
+        for (i = 0; i < width; i++) {
+            val = (val << 8) | bp[i];
+        }
+    }
+
+    /* the order preserving byte order ('^') is already in key order */
+    if (field->endian == STRUCT_ENDIAN_ORDERED) {
+        return val;
+    }
+
+    switch (field->code) {
+    case 'b': case 'h': case 'i': case 'l': case 'q':
+        return val ^ sign;
+    case 'f': /* fall through */
+    case 'd':
+        return (val & sign) ? ~val & (sign | (sign - 1)) : val | sign;
+    default:
+        return val;
+    }
+}
+
+static uint64_t element_value(const struct sort_job *job,
+        const unsigned char *e)
+{
+    if (job->items) {
+        return ((const struct sort_item *)e)->key;
+    }
+    return key_value(job->field, e, job->from, job->width);
+}
+
+/*
+ * count the byte digit of the keys of the chunk, or every byte of them
+ * (setting the keys of items first).
+ */
+static void *count_chunk(void *arg)
+{
+    struct sort_job *job = (struct sort_job *)arg;
+    struct sort_item *item;
+    const unsigned char *e;
+    uint64_t val;
+    long i;
+    int d;
+
+    if (job->digit >= 0) {
+        memset(job->count[job->digit], 0, sizeof(job->count[0]));
+    } else {
+        memset(job->count, 0, sizeof(job->count));
+    }
+
+    for (i = job->lo; i < job->hi; i++) {
+        e = job->src + i * job->esize;
+        if (job->digit >= 0) {
+            val = element_value(job, e);
+            job->count[job->digit][(val >> (job->digit * 8)) & 0xFF]++;
+            continue;
+        }
+
+        if (job->items) {
+            item = (struct sort_item *)e;
+            item->key = key_value(job->field,
+                    job->records + item->index * job->record_size,
+                    job->from, job->width);
+        }
+        val = element_value(job, e);
+        for (d = 0; d < job->width; d++) {
+            job->count[d][(val >> (d * 8)) & 0xFF]++;
+        }
+    }
+    return NULL;
+}
+
+static void *scatter_chunk(void *arg)
+{
+    struct sort_job *job = (struct sort_job *)arg;
+    const unsigned char *e;
+    long i;
+    int b;
+
+    for (i = job->lo; i < job->hi; i++) {
+        e = job->src + i * job->esize;
+        b = (element_value(job, e) >> (job->digit * 8)) & 0xFF;
+        memcpy(job->dst + job->offset[b]++ * job->esize, e, job->esize);
+    }
+    return NULL;
+}
+
+/*
+ * sort the elements of *src by the key bytes [from, from + width), one
+ * pass per byte from the least significant one; *src and *dst are
+ * swapped after each pass.
+ */
+static void sort_chunk(struct sort_job *jobs, int njobs, long n,
+        int from, int width, unsigned char **src, unsigned char **dst)
+{
+    unsigned char *tmp;
+    long total;
+    long running;
+    int counted = 1;
+    int d;
+    int b;
+    int t;
+
+    for (t = 0; t < njobs; t++) {
+        jobs[t].from = from;
+        jobs[t].width = width;
+        jobs[t].digit = -1;
+        jobs[t].src = *src;
+    }
+    struct_run_jobs(jobs, sizeof(*jobs), njobs, count_chunk);
+
+    for (d = 0; d < width; d++) {
+        /* skip a byte which is the same in every key */
+        for (b = 0; b < SORT_RADIX; b++) {
+            total = 0;
+            for (t = 0; t < njobs; t++) {
+                total += jobs[t].count[d][b];
+            }
+            if (total != 0) {
+                break;
+            }
+        }
+        if (total == n) {
+            continue;
+        }
+
+        for (t = 0; t < njobs; t++) {
+            jobs[t].digit = d;
+            jobs[t].src = *src;
+            jobs[t].dst = *dst;
+        }
+        /* the chunks of the threads changed with the previous pass */
+        if (!counted) {
+            struct_run_jobs(jobs, sizeof(*jobs), njobs, count_chunk);
+        }
+
+        running = 0;
+        for (b = 0; b < SORT_RADIX; b++) {
+            for (t = 0; t < njobs; t++) {
+                jobs[t].offset[b] = running;
+                running += jobs[t].count[d][b];
+            }
+        }
+        struct_run_jobs(jobs, sizeof(*jobs), njobs, scatter_chunk);
+
+        tmp = *src;
+        *src = *dst;
+        *dst = tmp;
+        counted = (njobs == 1);
+    }
+}
+
+/*
+ * move every record to its place, following the cycles of the
+ * permutation of the sorted items.
+ */
+static void permute(unsigned char *buf, int size, struct sort_item *items,
+        long n, unsigned char *scratch)
+{
+    long i;
+    long j;
+    long k;
+
+    for (i = 0; i < n; i++) {
+        if (items[i].index == i) {
+            continue;
+        }
+        memcpy(scratch, buf + i * size, size);
+        j = i;
+        while ((k = items[j].index) != i) {
+            memcpy(buf + j * size, buf + k * size, size);
+            items[j].index = j;
+            j = k;
+        }
+        memcpy(buf + j * size, scratch, size);
+        items[j].index = j;
+    }
+}
+
+int struct_sort_packed(
+    const struct_format *sf,
+    void *buf,
+    long nrecords,
+    int key,
+    int nthreads)
+{
+    struct struct_field field;
+    struct sort_job *jobs;
+    struct sort_item *items = NULL;
+    unsigned char *mem;
+    unsigned char *src;
+    unsigned char *dst;
+    int size;
+    int esize;
+    int from;
+    long lo = 0;
+    long i;
+    int t;
+
+    if (!struct_format_is_fixed(sf) || nrecords < 0 || nthreads <= 0 ||
+            struct_format_field(sf, key, &field) < 0 ||
+            strchr("pvV", field.code) != NULL) {
+        return -1;
+    }
+    if (nrecords < 2 || field.size == 0) {
+        return 0;
+    }
+    if (nthreads > nrecords) {
+        nthreads = (int)nrecords;
+    }
+
+    size = struct_format_calcsize(sf);
+    esize = (size > SORT_WIDE) ? (int)sizeof(*items) : size;
+    /* both arrays of items, or the scratch copy of the records */
+    mem = malloc(nrecords * (long)esize * ((size > SORT_WIDE) ? 2 : 1) +
+            size);
+    jobs = malloc(nthreads * sizeof(*jobs));
+    if (mem == NULL || jobs == NULL) {
+        free(mem);
+        free(jobs);
+        return -1;
+    }
+
+    if (size > SORT_WIDE) {
+        items = (struct sort_item *)mem;
+        for (i = 0; i < nrecords; i++) {
+            items[i].index = i;
+        }
+        src = mem;
+        dst = mem + nrecords * esize;
+    } else {
+        src = buf;
+        dst = mem;
+    }
+
+    for (t = 0; t < nthreads; t++) {
+        jobs[t].field = &field;
+        jobs[t].records = buf;
+        jobs[t].record_size = size;
+        jobs[t].items = (items != NULL);
+        jobs[t].esize = esize;
+        jobs[t].lo = lo;
+        jobs[t].hi = nrecords * (t + 1) / nthreads;
+        lo = jobs[t].hi;
+    }
+
+    if (field.code == 's') {
+        /* the chunks of the string, from the last one */
+        for (from = (field.size - 1) / SORT_CHUNK * SORT_CHUNK; from >= 0;
+                from -= SORT_CHUNK) {
+            sort_chunk(jobs, nthreads, nrecords, from,
+                    (field.size - from < SORT_CHUNK) ?
+                    field.size - from : SORT_CHUNK, &src, &dst);
+        }
+    } else {
+        sort_chunk(jobs, nthreads, nrecords, 0, field.size, &src, &dst);
+    }
+
+    if (items != NULL) {
+        permute(buf, size, (struct sort_item *)src, nrecords,
+                mem + nrecords * esize * 2);
+    } else if (src != (unsigned char *)buf) {
+        memcpy(buf, src, nrecords * (long)size);
+    }
+
+    free(jobs);
+    free(mem);
+    return 0;
+}
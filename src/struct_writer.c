@@ -0,0 +1,286 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "struct_writer.h"
+#include "struct_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * the producer owns cur and packs into it without locking. the lock only
+ * guards the hand-over of a full buffer (pending) to the thread, and the
+ * thread asks for a hand-over after flush_ms through swap.
+ */
+struct struct_writer {
+    int fd;
+    int bufsize;
+    int flush_ms;
+    int policy;
+
+    unsigned char *cur;         /* active buffer, owned by the producer */
+    int cur_len;
+    unsigned char *other;       /* pending buffer, owned by the thread */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* pending_len > 0 or closing */
+    pthread_cond_t done;        /* pending_len == 0 */
+    int pending_len;
+    int closing;
+    int error;                  /* errno of a failed write */
+    int swap;                   /* set by the thread after flush_ms */
+    long dropped;
+};
+
+static int write_all(int fd, const unsigned char *bp, int len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, bp, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        bp += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *writer_main(void *arg)
+{
+    struct struct_writer *w = (struct struct_writer *)arg;
+    struct timespec deadline;
+    int error;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->pending_len == 0 && !w->closing) {
+            if (w->flush_ms <= 0) {
+                pthread_cond_wait(&w->work, &w->lock);
+                continue;
+            }
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += w->flush_ms / 1000;
+            deadline.tv_nsec += (w->flush_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&w->work, &w->lock, &deadline) ==
+                    ETIMEDOUT) {
+                __atomic_store_n(&w->swap, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (w->pending_len == 0) {
+            break; /* closing */
+        }
+
+        pthread_mutex_unlock(&w->lock);
+        error = write_all(w->fd, w->other, w->pending_len);
+        pthread_mutex_lock(&w->lock);
+
+        if (error != 0) {
+            __atomic_store_n(&w->error, error, __ATOMIC_RELAXED);
+        }
+        w->pending_len = 0;
+        pthread_cond_broadcast(&w->done);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/*
+ * hand the active buffer over to the thread.
+ * returns 0 on success, -1 if the buffer is dropped by STRUCT_WRITER_DROP
+ * (only when drop is set).
+ */
+static int writer_swap(struct struct_writer *w, int drop)
+{
+    unsigned char *tmp;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->pending_len > 0) {
+        if (drop) {
+            pthread_mutex_unlock(&w->lock);
+            return -1;
+        }
+        pthread_cond_wait(&w->done, &w->lock);
+    }
+    if (w->cur_len > 0) {
+        tmp = w->other;
+        w->other = w->cur;
+        w->cur = tmp;
+        w->pending_len = w->cur_len;
+        w->cur_len = 0;
+        pthread_cond_signal(&w->work);
+    }
+    __atomic_store_n(&w->swap, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+/*
+ * make room for size bytes in the active buffer.
+ * returns 1 if there is room, 0 if the record must be dropped,
+ * -1 on failure.
+ */
+static int writer_reserve(struct struct_writer *w, int size)
+{
+    if (size < 0 || size > w->bufsize ||
+            __atomic_load_n(&w->error, __ATOMIC_RELAXED) != 0) {
+        return -1;
+    }
+    if (__atomic_load_n(&w->swap, __ATOMIC_RELAXED)) {
+        writer_swap(w, 0);
+    }
+    if (w->cur_len + size > w->bufsize &&
+            writer_swap(w, w->policy == STRUCT_WRITER_DROP) < 0) {
+        w->dropped++;
+        return 0;
+    }
+    return 1;
+}
+
+struct_writer *struct_writer_new(
+    int fd,
+    int bufsize,
+    int flush_ms,
+    int policy)
+{
+    struct struct_writer *w;
+
+    if (bufsize <= 0) {
+        return NULL;
+    }
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        return NULL;
+    }
+    w->fd = fd;
+    w->bufsize = bufsize;
+    w->flush_ms = flush_ms;
+    w->policy = policy;
+    w->cur = malloc(bufsize);
+    w->other = malloc(bufsize);
+    if (w->cur == NULL || w->other == NULL) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->done, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        pthread_cond_destroy(&w->done);
+        pthread_cond_destroy(&w->work);
+        pthread_mutex_destroy(&w->lock);
+        goto fail;
+    }
+    return w;
+
+fail:
+    free(w->cur);
+    free(w->other);
+    free(w);
+    return NULL;
+}
+
+int struct_writer_pack(struct_writer *w, const char *fmt, ...)
+{
+    va_list args;
+    va_list copy;
+    int ret;
+
+    /* a pending time swap or a failed write */
+    ret = writer_reserve(w, 0);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    /* pack into the room left, the format being parsed once */
+    va_start(args, fmt);
+    va_copy(copy, args);
+    ret = struct_pack_va_list_checked(w->cur, w->cur_len, w->bufsize, fmt,
+            args);
+    if (ret > w->bufsize) {
+        /* it does not fit: swap the buffers and pack it again */
+        ret = writer_reserve(w, ret - w->cur_len);
+        if (ret > 0) {
+            ret = struct_pack_va_list(w->cur, w->cur_len, fmt, copy);
+        }
+    }
+    va_end(copy);
+    va_end(args);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    ret -= w->cur_len;
+    w->cur_len += ret;
+    return ret;
+}
+
+int struct_writer_pack_record(
+    struct_writer *w,
+    const struct_format *sf,
+    const void *record)
+{
+    int ret;
+
+    ret = writer_reserve(w, struct_format_calcsize(sf));
+    if (ret <= 0) {
+        return ret;
+    }
+
+    ret = struct_format_pack_record(sf, w->cur + w->cur_len, record);
+    w->cur_len += ret;
+    return ret;
+}
+
+int struct_writer_flush(struct_writer *w)
+{
+    int error;
+
+    writer_swap(w, 0);
+
+    pthread_mutex_lock(&w->lock);
+    while (w->pending_len > 0) {
+        pthread_cond_wait(&w->done, &w->lock);
+    }
+    error = w->error;
+    pthread_mutex_unlock(&w->lock);
+
+    return (error == 0) ? 0 : -1;
+}
+
+long struct_writer_dropped(const struct_writer *w)
+{
+    return w->dropped;
+}
+
+int struct_writer_close(struct_writer *w)
+{
+    int ret = struct_writer_flush(w);
+
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->work);
+    pthread_mutex_destroy(&w->lock);
+    free(w->cur);
+    free(w->other);
+    free(w);
+    return ret;
+}
@@ -0,0 +1,200 @@
+/*
+ * struct_log_test.cpp
+ *
+ * multi-producer append log of packed records
+ */
+
+#include "struct_log.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+TEST(StructLog, ReserveCommitNextValid)
+{
+	struct_log *log = struct_log_new(64);
+	const void *rec;
+	void *slot;
+	int32_t o = 0;
+	long pos = 0;
+	int len = 0;
+
+	ASSERT_TRUE(log != NULL);
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+	slot = struct_log_reserve(log, 4);
+	ASSERT_TRUE(slot != NULL);
+	EXPECT_EQ(16, struct_log_size(log));
+
+	/* reserved, not committed yet */
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+	EXPECT_EQ(0, pos);
+
+	struct_log_commit(log, slot, struct_pack(slot, "!i", 0x12345678));
+	rec = struct_log_next(log, &pos, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(4, len);
+	EXPECT_EQ(16, pos);
+	EXPECT_EQ(4, struct_unpack(rec, "!i", &o));
+	EXPECT_EQ(0x12345678, o);
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+	struct_log_free(log);
+}
+
+TEST(StructLog, PackReservesExactSize)
+{
+	struct_log *log = struct_log_new(64);
+	uint64_t seq = 0;
+	uint32_t id = 0;
+	long pos = 0;
+	int len = 0;
+	const void *rec;
+
+	ASSERT_TRUE(log != NULL);
+	/* 4 + 1 bytes, not the 4 + 10 of struct_calcsize("!IV") */
+	EXPECT_EQ(5, struct_log_pack(log, "!IV", 7, (uint64_t)1));
+	EXPECT_EQ(16, struct_log_size(log));
+	EXPECT_EQ(5, struct_log_pack(log, "!IV", 8, (uint64_t)2));
+	EXPECT_EQ(5, struct_log_pack(log, "!IV", 9, (uint64_t)3));
+	EXPECT_EQ(6, struct_log_pack(log, "!IV", 10, (uint64_t)300));
+	EXPECT_EQ(64, struct_log_size(log));
+	EXPECT_EQ(0, struct_log_pack(log, "!IV", 11, (uint64_t)4));
+
+	rec = struct_log_next(log, &pos, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(5, len);
+	EXPECT_EQ(5, struct_unpack(rec, "!IV", &id, &seq));
+	EXPECT_EQ(7U, id);
+	EXPECT_EQ(1U, seq);
+	struct_log_free(log);
+}
+
+TEST(StructLog, ReaderStopsAtUncommitted)
+{
+	struct_log *log = struct_log_new(256);
+	void *s1, *s2;
+	int16_t o;
+	long pos = 0;
+	int len;
+
+	ASSERT_TRUE(log != NULL);
+	s1 = struct_log_reserve(log, 2);
+	s2 = struct_log_reserve(log, 2);
+	ASSERT_TRUE(s1 != NULL);
+	ASSERT_TRUE(s2 != NULL);
+
+	struct_log_commit(log, s2, struct_pack(s2, "!h", 2));
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+
+	struct_log_commit(log, s1, struct_pack(s1, "!h", 1));
+	struct_unpack(struct_log_next(log, &pos, &len), "!h", &o);
+	EXPECT_EQ(1, o);
+	struct_unpack(struct_log_next(log, &pos, &len), "!h", &o);
+	EXPECT_EQ(2, o);
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+	struct_log_free(log);
+}
+
+TEST(StructLog, FullAndReset)
+{
+	struct_log *log = struct_log_new(64);
+	int64_t o;
+	long pos = 0;
+	int len;
+	int i;
+
+	ASSERT_TRUE(log != NULL);
+	/* 16 bytes per record: 4 fit */
+	for (i = 0; i < 4; i++) {
+		EXPECT_EQ(8, struct_log_pack(log, "<q", (int64_t)i));
+	}
+	EXPECT_EQ(0, struct_log_pack(log, "<q", (int64_t)4));
+	EXPECT_EQ(-1, struct_log_pack(log, "<64s", "x"));
+	EXPECT_EQ(64, struct_log_size(log));
+	for (i = 0; i < 4; i++) {
+		ASSERT_TRUE(struct_log_next(log, &pos, &len) != NULL);
+	}
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+
+	struct_log_reset(log);
+	EXPECT_EQ(0, struct_log_size(log));
+	pos = 0;
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+	EXPECT_EQ(8, struct_log_pack(log, "<q", (int64_t)5));
+	struct_unpack(struct_log_next(log, &pos, &len), "<q", &o);
+	EXPECT_EQ(5, o);
+	struct_log_free(log);
+}
+
+struct Record {
+	uint32_t thread;
+	uint32_t seq;
+	char s[5];
+};
+
+TEST(StructLog, ConcurrentProducers)
+{
+	const int nthreads = 4;
+	const uint32_t count = 20000;
+	struct_log *log = struct_log_new(nthreads * count * 24);
+	struct_format *sf = struct_compile("<II5s");
+	std::vector<std::thread> producers;
+	std::vector<uint32_t> next(nthreads, 0);
+	Record rec;
+	const void *p;
+	long pos = 0;
+	uint32_t total = 0;
+	int len;
+	int t;
+
+	ASSERT_TRUE(log != NULL);
+	ASSERT_TRUE(sf != NULL);
+
+	for (t = 0; t < nthreads; t++) {
+		producers.push_back(std::thread([=]() {
+			Record r;
+			uint32_t i;
+			r.thread = t;
+			memcpy(r.s, "hello", 5);
+			for (i = 0; i < count; i++) {
+				r.seq = i;
+				struct_log_pack_record(log, sf, &r);
+			}
+		}));
+	}
+
+	/* read concurrently until every record has been seen */
+	while (total < nthreads * count) {
+		p = struct_log_next(log, &pos, &len);
+		if (p == NULL) {
+			std::this_thread::yield();
+			continue;
+		}
+		ASSERT_EQ(13, len);
+		ASSERT_EQ(len, struct_format_unpack_record(sf, p, &rec));
+		ASSERT_LT(rec.thread, (uint32_t)nthreads);
+		/* records of one thread keep their order */
+		ASSERT_EQ(next[rec.thread], rec.seq);
+		ASSERT_EQ(0, memcmp(rec.s, "hello", 5));
+		next[rec.thread]++;
+		total++;
+	}
+	for (t = 0; t < nthreads; t++) {
+		producers[t].join();
+	}
+	EXPECT_TRUE(struct_log_next(log, &pos, &len) == NULL);
+	EXPECT_EQ(struct_log_size(log), pos);
+	struct_format_free(sf);
+	struct_log_free(log);
+}
+
+TEST(StructLog, InvalidCapacity)
+{
+	EXPECT_TRUE(struct_log_new(4) == NULL);
+}
+
+} // namespace
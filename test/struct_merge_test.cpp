@@ -0,0 +1,232 @@
+/*
+ * struct_merge_test.cpp
+ *
+ * external sort of packed record files
+ */
+
+#include "struct_merge.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Record {
+	uint64_t id;
+	int64_t v;
+	uint64_t u;
+	char name[8];
+	double d;
+};
+
+static int open_run(void *arg)
+{
+	char path[] = "/tmp/struct_merge_testXXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd >= 0) {
+		unlink(path);
+		(*(int *)arg)++;
+	}
+	return fd;
+}
+
+static std::vector<Record> make_records(int n)
+{
+	std::vector<Record> records(n);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		records[i].id = i;
+		records[i].v = (int64_t)(i * 7919 % 1000) - 500;
+		records[i].u = (uint64_t)(i * 104729 % 5000) << (i % 40);
+		snprintf(records[i].name, sizeof(records[i].name), "n%06d",
+				i * 31 % 997);
+		records[i].d = (i * 13 % 101) / 4.0 - 10.0;
+	}
+	return records;
+}
+
+/* a rewound temporary file holding the packed records */
+static int pack_file(struct_format *sf, const std::vector<Record> &records)
+{
+	unsigned char buf[64];
+	int runs = 0;
+	int fd = open_run(&runs);
+	size_t i;
+	int len;
+
+	for (i = 0; i < records.size(); i++) {
+		len = struct_format_pack_record(sf, buf, &records[i]);
+		EXPECT_EQ(len, write(fd, buf, len));
+	}
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+static std::vector<Record> unpack_file(struct_format *sf, int fd)
+{
+	std::vector<Record> records;
+	std::vector<unsigned char> data;
+	unsigned char buf[4096];
+	Record rec;
+	size_t pos = 0;
+	ssize_t n;
+
+	lseek(fd, 0, SEEK_SET);
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	while (pos < data.size()) {
+		pos += struct_format_unpack_record(sf, &data[pos], &rec);
+		records.push_back(rec);
+	}
+	EXPECT_EQ(data.size(), pos);
+	return records;
+}
+
+static bool by_v(const Record &a, const Record &b)
+{
+	return a.v < b.v;
+}
+
+static bool by_u(const Record &a, const Record &b)
+{
+	return a.u < b.u;
+}
+
+static bool by_name(const Record &a, const Record &b)
+{
+	return memcmp(a.name, b.name, sizeof(a.name)) < 0;
+}
+
+static bool by_d(const Record &a, const Record &b)
+{
+	return a.d < b.d;
+}
+
+static void check_external_sort(const char *fmt, int key,
+		bool (*less)(const Record &, const Record &),
+		long memory, int bufsize)
+{
+	struct_format *sf = struct_compile(fmt);
+	std::vector<Record> records = make_records(20000);
+	std::vector<Record> sorted;
+	int nruns = 0;
+	int in_fd;
+	int out_fd;
+	size_t i;
+
+	ASSERT_TRUE(sf != NULL);
+	in_fd = pack_file(sf, records);
+	out_fd = open_run(&nruns);
+	nruns = 0;
+	EXPECT_EQ((long)records.size(), struct_external_sort(sf, key, in_fd,
+				out_fd, memory, bufsize, open_run, &nruns));
+	EXPECT_GT(nruns, 1);
+
+	/* stable: equal keys keep the order of their ids */
+	std::stable_sort(records.begin(), records.end(), less);
+	sorted = unpack_file(sf, out_fd);
+	ASSERT_EQ(records.size(), sorted.size());
+	for (i = 0; i < records.size(); i++) {
+		ASSERT_EQ(records[i].id, sorted[i].id) << fmt << " at " << i;
+	}
+	close(in_fd);
+	close(out_fd);
+	struct_format_free(sf);
+}
+
+TEST(StructMerge, ExternalSortVariable)
+{
+	/* about 40 runs, merged 15 at a time */
+	check_external_sort("!QvV8sd", 1, by_v, 16384, 1024);
+	check_external_sort("<QvV8sd", 2, by_u, 16384, 1024);
+	check_external_sort("!QvV8sd", 3, by_name, 16384, 1024);
+}
+
+TEST(StructMerge, ExternalSortManyPasses)
+{
+	/* hundreds of runs merged 2 or 3 at a time, odd groups carried over */
+	check_external_sort("!QvV8sd", 1, by_v, 3 * 512, 512);
+	check_external_sort("<QqQxx8sd", 2, by_u, 4 * 700, 700);
+}
+
+TEST(StructMerge, ExternalSortFixed)
+{
+	check_external_sort("<QqQxx8sd", 4, by_d, 65536, 4096);
+	check_external_sort("^QqQ8sd", 1, by_v, 65536, 100);
+}
+
+TEST(StructMerge, MergeRuns)
+{
+	struct_format *sf = struct_compile("!QvV8sd");
+	std::vector<Record> records = make_records(30);
+	std::vector<Record> runs[3];
+	std::vector<Record> sorted;
+	int fds[3];
+	int nruns = 0;
+	int out_fd;
+	size_t i;
+
+	ASSERT_TRUE(sf != NULL);
+	for (i = 0; i < records.size(); i++) {
+		runs[i % 3].push_back(records[i]);
+	}
+	for (i = 0; i < 3; i++) {
+		std::stable_sort(runs[i].begin(), runs[i].end(), by_v);
+		fds[i] = pack_file(sf, runs[i]);
+	}
+	out_fd = open_run(&nruns);
+
+	EXPECT_EQ(30, struct_merge_runs(sf, 1, fds, 3, out_fd, 16));
+	sorted = unpack_file(sf, out_fd);
+	ASSERT_EQ(30U, sorted.size());
+	for (i = 1; i < sorted.size(); i++) {
+		EXPECT_LE(sorted[i - 1].v, sorted[i].v);
+	}
+
+	/* nothing to merge */
+	EXPECT_EQ(0, struct_merge_runs(sf, 1, fds, 0, out_fd, 16));
+	for (i = 0; i < 3; i++) {
+		close(fds[i]);
+	}
+	close(out_fd);
+	struct_format_free(sf);
+}
+
+TEST(StructMerge, TruncatedAndInvalid)
+{
+	struct_format *sf = struct_compile("!QvV8sd");
+	std::vector<Record> records = make_records(10);
+	int nruns = 0;
+	int *runs = NULL;
+	int in_fd = pack_file(sf, records);
+	int out_fd = open_run(&nruns);
+	off_t size = lseek(in_fd, 0, SEEK_END);
+
+	/* the last record is cut */
+	ASSERT_EQ(0, ftruncate(in_fd, size - 1));
+	lseek(in_fd, 0, SEEK_SET);
+	EXPECT_EQ(-1, struct_external_sort(sf, 1, in_fd, out_fd, 4096, 256,
+				open_run, &nruns));
+
+	lseek(in_fd, 0, SEEK_SET);
+	EXPECT_EQ(-1, struct_make_runs(sf, 5, in_fd, 4096, 256, open_run,
+				&nruns, &runs));
+	EXPECT_TRUE(runs == NULL);
+	/* a record and its entry do not fit */
+	EXPECT_EQ(-1, struct_make_runs(sf, 1, in_fd, 16, 256, open_run,
+				&nruns, &runs));
+	close(in_fd);
+	close(out_fd);
+	struct_format_free(sf);
+}
+
+} // namespace
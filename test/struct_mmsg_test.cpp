@@ -0,0 +1,128 @@
+/*
+ * struct_mmsg_test.cpp
+ *
+ * batched datagram pack/unpack over loopback
+ */
+
+#include "struct_mmsg.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace {
+
+struct Quote {
+	uint32_t id;
+	int64_t price;
+	uint64_t size;
+};
+
+class StructMmsg:public ::testing::Test {
+protected:
+  StructMmsg() : rfd(-1), sfd(-1), sf(NULL), mm(NULL) {}
+  virtual ~StructMmsg() {}
+
+  virtual void SetUp()
+  {
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    rfd = socket(AF_INET, SOCK_DGRAM, 0);
+    sfd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_LE(0, rfd);
+    ASSERT_LE(0, sfd);
+    ASSERT_EQ(0, bind(rfd, (struct sockaddr *)&addr, sizeof(addr)));
+    ASSERT_EQ(0, getsockname(rfd, (struct sockaddr *)&addr, &len));
+
+    sf = struct_compile("!IqV");
+    mm = struct_mmsg_new(8, 64);
+    ASSERT_TRUE(sf != NULL);
+    ASSERT_TRUE(mm != NULL);
+  }
+
+  virtual void TearDown()
+  {
+    struct_mmsg_free(mm);
+    struct_format_free(sf);
+    close(rfd);
+    close(sfd);
+  }
+
+  int rfd;
+  int sfd;
+  struct sockaddr_in addr;
+  struct_format *sf;
+  struct_mmsg *mm;
+};
+
+TEST_F(StructMmsg, SendRecvValid)
+{
+	Quote in[8];
+	Quote out[8];
+	int n = 0;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		in[i].id = i;
+		in[i].price = -100000 * i;
+		in[i].size = (uint64_t)1 << (7 * i);
+	}
+	memset(out, 0, sizeof(out));
+
+	EXPECT_EQ(8, struct_mmsg_send(mm, sfd, sf, in, 8,
+				(struct sockaddr *)&addr, sizeof(addr), 0));
+	while (n < 8) {
+		i = struct_mmsg_recv(mm, rfd, sf, out + n, MSG_WAITFORONE);
+		ASSERT_LT(0, i);
+		n += i;
+	}
+	for (i = 0; i < 8; i++) {
+		EXPECT_EQ(in[i].id, out[i].id);
+		EXPECT_EQ(in[i].price, out[i].price);
+		EXPECT_EQ(in[i].size, out[i].size);
+	}
+}
+
+TEST_F(StructMmsg, SendAtMostVlen)
+{
+	Quote in[10];
+
+	memset(in, 0, sizeof(in));
+	EXPECT_EQ(8, struct_mmsg_send(mm, sfd, sf, in, 10,
+				(struct sockaddr *)&addr, sizeof(addr), 0));
+}
+
+TEST_F(StructMmsg, ShortDatagramInvalid)
+{
+	Quote out[8];
+	unsigned char buf[16];
+	int len = struct_pack(buf, "!IqV", 1, (int64_t)2, (uint64_t)3);
+
+	ASSERT_EQ(len - 1, sendto(sfd, buf, len - 1, 0,
+				(struct sockaddr *)&addr, sizeof(addr)));
+	ASSERT_EQ(len, sendto(sfd, buf, len, 0,
+				(struct sockaddr *)&addr, sizeof(addr)));
+	ASSERT_EQ(2, struct_mmsg_recv(mm, rfd, sf, out, MSG_WAITFORONE));
+	EXPECT_EQ(-1, struct_mmsg_length(mm, 0));
+	EXPECT_EQ(len, struct_mmsg_length(mm, 1));
+	EXPECT_EQ(3U, out[1].size);
+}
+
+TEST_F(StructMmsg, BufferTooSmall)
+{
+	Quote out[8];
+	struct_mmsg *small = struct_mmsg_new(8, 4);
+
+	ASSERT_TRUE(small != NULL);
+	EXPECT_EQ(-1, struct_mmsg_recv(small, rfd, sf, out, MSG_DONTWAIT));
+	struct_mmsg_free(small);
+}
+
+} // namespace
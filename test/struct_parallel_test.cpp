@@ -0,0 +1,199 @@
+/*
+ * struct_parallel_test.cpp
+ *
+ * multi-threaded batch operations
+ */
+
+#include "struct_parallel.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+namespace {
+
+struct Record {
+	uint32_t id;
+	int64_t v;
+	uint64_t V;
+	double d;
+};
+
+class StructParallel:public ::testing::Test {
+protected:
+  StructParallel() {}
+  virtual ~StructParallel() {}
+
+  virtual void SetUp()
+  {
+    int i;
+
+    records.resize(1001);
+    for (i = 0; i < (int)records.size(); i++) {
+      records[i].id = i;
+      records[i].v = (i % 2) ? -((int64_t)1 << (i % 63)) : i;
+      records[i].V = (uint64_t)1 << (i % 64);
+      records[i].d = i / 3.0;
+    }
+  }
+
+  virtual void TearDown() {}
+
+  /* pack with the sequential path and compare. */
+  void expectSameAsSequential(const char *fmt, long nrecords, int nthreads)
+  {
+    struct_format *sf = struct_compile(fmt);
+    std::vector<unsigned char> seq(nrecords * struct_format_calcsize(sf) + 1);
+    std::vector<unsigned char> par(seq.size());
+    long len = 0;
+    long i;
+
+    for (i = 0; i < nrecords; i++) {
+      len += struct_format_pack_record(sf, &seq[len], &records[i]);
+    }
+    EXPECT_EQ(len, struct_pack_records_parallel(
+          sf, &par[0], &records[0], nrecords, nthreads));
+    EXPECT_EQ(0, memcmp(&seq[0], &par[0], len));
+    struct_format_free(sf);
+  }
+
+  /* pack the records back to back, remembering where each one starts. */
+  std::vector<unsigned char> packStream(struct_format *sf,
+      std::vector<long> &starts)
+  {
+    std::vector<unsigned char> v(records.size() * struct_format_calcsize(sf));
+    long len = 0;
+    size_t i;
+
+    for (i = 0; i < records.size(); i++) {
+      starts.push_back(len);
+      len += struct_format_pack_record(sf, &v[len], &records[i]);
+    }
+    v.resize(len);
+    return v;
+  }
+
+  void expectIndex(struct_format *sf, const std::vector<unsigned char> &v,
+      long len, const std::vector<long> &starts, int nthreads)
+  {
+    long *offsets = NULL;
+    long n = struct_index_records_parallel(sf, &v[0], len, &offsets,
+        nthreads);
+    long i;
+
+    ASSERT_EQ((long)starts.size(), n);
+    ASSERT_TRUE(offsets != NULL);
+    for (i = 0; i < n; i++) {
+      EXPECT_EQ(starts[i], offsets[i]);
+    }
+    free(offsets);
+  }
+
+  std::vector<Record> records;
+};
+
+TEST_F(StructParallel, FixedSameAsSequential)
+{
+	expectSameAsSequential("!IqQd", 1001, 1);
+	expectSameAsSequential("!IqQd", 1001, 4);
+	expectSameAsSequential("!IqQd", 1001, 7);
+}
+
+TEST_F(StructParallel, VarintSameAsSequential)
+{
+	expectSameAsSequential("!IvVd", 1001, 1);
+	expectSameAsSequential("!IvVd", 1001, 4);
+	expectSameAsSequential("<IvVd", 1001, 7);
+}
+
+TEST_F(StructParallel, MoreThreadsThanRecords)
+{
+	expectSameAsSequential("!IvVd", 3, 8);
+	expectSameAsSequential("!IvVd", 0, 8);
+}
+
+TEST_F(StructParallel, InvalidArguments)
+{
+	struct_format *sf = struct_compile("!IvVd");
+	unsigned char buf[64];
+
+	EXPECT_EQ(-1, struct_pack_records_parallel(sf, buf, &records[0], 1, 0));
+	EXPECT_EQ(-1, struct_pack_records_parallel(sf, buf, &records[0], -1, 1));
+	struct_format_free(sf);
+}
+
+TEST_F(StructParallel, IndexEmptyFormatInvalid)
+{
+	struct_format *sf = struct_compile("");
+	unsigned char buf[16] = { 0 };
+	long *offsets = (long *)buf;
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_EQ(0, struct_format_calcsize(sf));
+	EXPECT_EQ(-1, struct_index_records_parallel(sf, buf, sizeof(buf),
+				&offsets, 4));
+	EXPECT_TRUE(offsets == NULL);
+	EXPECT_EQ(-1, struct_index_records_parallel(sf, buf, 0, &offsets, 1));
+	struct_format_free(sf);
+}
+
+TEST_F(StructParallel, IndexVarintValid)
+{
+	struct_format *sf = struct_compile("!vVbV");
+	std::vector<long> starts;
+	std::vector<unsigned char> v = packStream(sf, starts);
+	int nthreads;
+
+	for (nthreads = 1; nthreads <= 9; nthreads++) {
+		expectIndex(sf, v, v.size(), starts, nthreads);
+	}
+	struct_format_free(sf);
+}
+
+TEST_F(StructParallel, IndexTruncatedTail)
+{
+	struct_format *sf = struct_compile("!IvVd");
+	std::vector<long> starts;
+	std::vector<unsigned char> v = packStream(sf, starts);
+
+	starts.pop_back();
+	expectIndex(sf, v, v.size() - 1, starts, 1);
+	expectIndex(sf, v, v.size() - 1, starts, 5);
+	struct_format_free(sf);
+}
+
+TEST_F(StructParallel, IndexMalformedVarint)
+{
+	struct_format *sf = struct_compile("V");
+	std::vector<unsigned char> v(64, 0x01);
+	std::vector<long> starts;
+	int i;
+
+	/* a varint which does not end within 10 bytes stops the index. */
+	for (i = 20; i < 31; i++) {
+		v[i] = 0x80;
+	}
+	for (i = 0; i < 20; i++) {
+		starts.push_back(i);
+	}
+	expectIndex(sf, v, v.size(), starts, 1);
+	expectIndex(sf, v, v.size(), starts, 4);
+	struct_format_free(sf);
+}
+
+TEST_F(StructParallel, IndexFixedValid)
+{
+	struct_format *sf = struct_compile("!IqQd");
+	std::vector<long> starts;
+	std::vector<unsigned char> v = packStream(sf, starts);
+
+	expectIndex(sf, v, v.size(), starts, 3);
+	starts.pop_back();
+	expectIndex(sf, v, v.size() - 1, starts, 3);
+	struct_format_free(sf);
+}
+
+} // namespace
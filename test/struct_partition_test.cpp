@@ -0,0 +1,151 @@
+/*
+ * struct_partition_test.cpp
+ *
+ * hash-partitioned packing of records
+ */
+
+#include "struct_partition.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+namespace {
+
+struct Record {
+	uint64_t key;
+	int64_t v;
+	char name[4];
+	double d;
+};
+
+static std::vector<Record> make_records(int n)
+{
+	std::vector<Record> records(n);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		records[i].key = (uint64_t)i * 7919;
+		records[i].v = (int64_t)i * ((i % 2) ? -1000 : 1000);
+		memcpy(records[i].name, (i % 3) ? "abcd" : "wxyz", 4);
+		records[i].d = i / 2.0;
+	}
+	return records;
+}
+
+static void check_shards(struct_format *sf, int key,
+		const std::vector<Record> &records,
+		struct struct_shard *shards, int nparts)
+{
+	std::vector<int> seen(records.size(), 0);
+	Record rec;
+	long total = 0;
+	long pos;
+	long n;
+	int p;
+
+	for (p = 0; p < nparts; p++) {
+		pos = 0;
+		for (n = 0; n < shards[p].count; n++) {
+			ASSERT_LT(pos, shards[p].len);
+			pos += struct_format_unpack_record(sf, shards[p].buf + pos, &rec);
+			ASSERT_EQ(p, struct_partition_of(sf, key, &rec, nparts));
+			ASSERT_EQ(0U, rec.key % 7919);
+			ASSERT_LT(rec.key / 7919, records.size());
+			seen[rec.key / 7919]++;
+		}
+		EXPECT_EQ(shards[p].len, pos);
+		total += shards[p].count;
+	}
+	EXPECT_EQ((long)records.size(), total);
+	for (size_t i = 0; i < records.size(); i++) {
+		EXPECT_EQ(1, seen[i]);
+	}
+}
+
+TEST(StructPartition, GrowValid)
+{
+	struct_format *sf = struct_compile("!Qv4sd");
+	struct struct_shard shards[8];
+	std::vector<Record> records = make_records(5000);
+	int p;
+
+	ASSERT_TRUE(sf != NULL);
+	memset(shards, 0, sizeof(shards));
+	ASSERT_EQ(0, struct_pack_partitioned(sf, 0, &records[0], 5000,
+				shards, 8, STRUCT_PARTITION_GROW));
+	check_shards(sf, 0, records, shards, 8);
+	for (p = 0; p < 8; p++) {
+		/* a good hash spreads the keys */
+		EXPECT_GT(shards[p].count, 5000 / 8 / 2);
+	}
+	struct_shards_free(shards, 8);
+	EXPECT_TRUE(shards[0].buf == NULL);
+	struct_format_free(sf);
+}
+
+TEST(StructPartition, ExactSizing)
+{
+	struct_format *sf = struct_compile("!Qv4sd");
+	struct struct_shard shards[5];
+	std::vector<Record> records = make_records(3000);
+	int p;
+
+	ASSERT_TRUE(sf != NULL);
+	memset(shards, 0, sizeof(shards));
+	ASSERT_EQ(0, struct_pack_partitioned(sf, 1, &records[0], 3000,
+				shards, 5, STRUCT_PARTITION_EXACT));
+	check_shards(sf, 1, records, shards, 5);
+	for (p = 0; p < 5; p++) {
+		EXPECT_EQ(shards[p].len, shards[p].cap);
+	}
+
+	/* shards keep their contents across calls */
+	ASSERT_EQ(0, struct_pack_partitioned(sf, 1, &records[0], 3000,
+				shards, 5, STRUCT_PARTITION_EXACT));
+	EXPECT_EQ(6000, shards[0].count + shards[1].count + shards[2].count +
+			shards[3].count + shards[4].count);
+	struct_shards_free(shards, 5);
+	struct_format_free(sf);
+}
+
+TEST(StructPartition, StringAndDoubleKeys)
+{
+	struct_format *sf = struct_compile("!Qv4sd");
+	Record a, b;
+
+	ASSERT_TRUE(sf != NULL);
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	memcpy(a.name, "abcd", 4);
+	memcpy(b.name, "abcd", 4);
+	a.key = 1;
+	b.key = 2;
+	a.d = 0.0;
+	b.d = -0.0;
+	EXPECT_EQ(struct_partition_of(sf, 2, &a, 13),
+			struct_partition_of(sf, 2, &b, 13));
+	EXPECT_EQ(struct_partition_of(sf, 3, &a, 13),
+			struct_partition_of(sf, 3, &b, 13));
+	struct_format_free(sf);
+}
+
+TEST(StructPartition, Invalid)
+{
+	struct_format *sf = struct_compile("!Q2xv");
+	struct struct_shard shards[2];
+	Record rec;
+
+	ASSERT_TRUE(sf != NULL);
+	memset(shards, 0, sizeof(shards));
+	memset(&rec, 0, sizeof(rec));
+	EXPECT_EQ(-1, struct_partition_of(sf, 2, &rec, 2));
+	EXPECT_EQ(-1, struct_partition_of(sf, 0, &rec, 0));
+	EXPECT_EQ(-1, struct_pack_partitioned(sf, 5, &rec, 1, shards, 2,
+				STRUCT_PARTITION_GROW));
+	struct_format_free(sf);
+}
+
+} // namespace
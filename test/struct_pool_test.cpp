@@ -0,0 +1,183 @@
+/*
+ * struct_pool_test.cpp
+ *
+ * pool of output buffers
+ */
+
+#include "struct_pool.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+TEST(StructPool, AcquireReleaseReuse)
+{
+	struct_pool *pool = struct_pool_new(4096, 8);
+	struct struct_pool_stats stats;
+	void *b1, *b2;
+
+	ASSERT_TRUE(pool != NULL);
+	b1 = struct_pool_acquire(pool, 100);
+	ASSERT_TRUE(b1 != NULL);
+	memset(b1, 0xAA, 128);
+	struct_pool_release(pool, b1);
+
+	/* same class: the cached buffer comes back */
+	b2 = struct_pool_acquire(pool, 120);
+	EXPECT_EQ(b1, b2);
+	struct_pool_release(pool, b2);
+
+	struct_pool_stats(pool, &stats);
+	EXPECT_EQ(2, stats.acquired);
+	EXPECT_EQ(1, stats.cache_hits);
+	EXPECT_EQ(0, stats.depot_hits);
+	EXPECT_EQ(1, stats.allocated);
+	EXPECT_EQ(128, stats.held);
+	struct_pool_free(pool);
+}
+
+TEST(StructPool, LargeBuffersNotPooled)
+{
+	struct_pool *pool = struct_pool_new(1024, 8);
+	struct struct_pool_stats stats;
+	void *buf;
+
+	ASSERT_TRUE(pool != NULL);
+	buf = struct_pool_acquire(pool, 5000);
+	ASSERT_TRUE(buf != NULL);
+	memset(buf, 0, 5000);
+	struct_pool_release(pool, buf);
+
+	struct_pool_stats(pool, &stats);
+	EXPECT_EQ(0, stats.acquired);
+	EXPECT_EQ(0, stats.held);
+	struct_pool_free(pool);
+}
+
+TEST(StructPool, CacheOverflowGoesToDepot)
+{
+	struct_pool *pool = struct_pool_new(1024, 4);
+	struct struct_pool_stats stats;
+	void *bufs[8];
+	int i;
+
+	ASSERT_TRUE(pool != NULL);
+	for (i = 0; i < 8; i++) {
+		bufs[i] = struct_pool_acquire(pool, 64);
+	}
+	for (i = 0; i < 8; i++) {
+		struct_pool_release(pool, bufs[i]);
+	}
+	struct_pool_stats(pool, &stats);
+	EXPECT_EQ(8, stats.allocated);
+	EXPECT_EQ(8 * 64, stats.held);
+
+	/* the cache empties, then is refilled from the depot */
+	for (i = 0; i < 8; i++) {
+		bufs[i] = struct_pool_acquire(pool, 64);
+	}
+	struct_pool_stats(pool, &stats);
+	EXPECT_EQ(8, stats.allocated);
+	EXPECT_GT(stats.depot_hits, 0);
+	EXPECT_EQ(8, stats.cache_hits + stats.depot_hits);
+	EXPECT_EQ(0, stats.held);
+	for (i = 0; i < 8; i++) {
+		struct_pool_release(pool, bufs[i]);
+	}
+	struct_pool_free(pool);
+}
+
+TEST(StructPool, PackValid)
+{
+	struct_pool *pool = struct_pool_new(1024, 8);
+	struct_format *sf = struct_compile("!IV");
+	struct {
+		uint32_t id;
+		uint64_t seq;
+	} rec = { 7, 300 }, out;
+	uint32_t id = 0;
+	uint64_t seq = 0;
+	void *buf;
+	int len = 0;
+
+	ASSERT_TRUE(pool != NULL);
+	buf = struct_pool_pack(pool, &len, "!IV", 0x01020304, (uint64_t)1);
+	ASSERT_TRUE(buf != NULL);
+	EXPECT_EQ(5, len);
+	EXPECT_EQ(5, struct_unpack(buf, "!IV", &id, &seq));
+	EXPECT_EQ(0x01020304U, id);
+	EXPECT_EQ(1U, seq);
+	struct_pool_release(pool, buf);
+
+	buf = struct_pool_pack_record(pool, sf, &rec, &len);
+	ASSERT_TRUE(buf != NULL);
+	EXPECT_EQ(6, len);
+	EXPECT_EQ(6, struct_format_unpack_record(sf, buf, &out));
+	EXPECT_EQ(7U, out.id);
+	EXPECT_EQ(300U, out.seq);
+	struct_pool_release(pool, buf);
+
+	struct_format_free(sf);
+	struct_pool_free(pool);
+}
+
+TEST(StructPool, ManyThreads)
+{
+	const int nthreads = 4;
+	const int count = 20000;
+	struct_pool *pool = struct_pool_new(4096, 16);
+	struct struct_pool_stats stats;
+	std::vector<std::thread> threads;
+	std::vector<void *> handoff[nthreads];
+	int t;
+
+	ASSERT_TRUE(pool != NULL);
+	for (t = 0; t < nthreads; t++) {
+		threads.push_back(std::thread([=, &handoff]() {
+			int i, len;
+			void *buf;
+			for (i = 0; i < count; i++) {
+				buf = struct_pool_pack(pool, &len, "!I20s", i,
+						"01234567890123456789");
+				ASSERT_TRUE(buf != NULL);
+				ASSERT_EQ(24, len);
+				if (i % 100 == 0) {
+					/* released later by another thread */
+					handoff[t].push_back(buf);
+				} else {
+					struct_pool_release(pool, buf);
+				}
+			}
+		}));
+	}
+	for (t = 0; t < nthreads; t++) {
+		threads[t].join();
+	}
+	for (t = 0; t < nthreads; t++) {
+		for (size_t i = 0; i < handoff[t].size(); i++) {
+			struct_pool_release(pool, handoff[t][i]);
+		}
+	}
+
+	/* the caches of the exited threads went to the depot */
+	struct_pool_stats(pool, &stats);
+	EXPECT_EQ(nthreads * count, stats.acquired);
+	EXPECT_EQ(stats.acquired,
+			stats.cache_hits + stats.depot_hits + stats.allocated);
+	EXPECT_EQ(stats.allocated * 64, stats.held);
+	EXPECT_LT(stats.allocated, nthreads * count / 10);
+	struct_pool_free(pool);
+}
+
+TEST(StructPool, Invalid)
+{
+	EXPECT_TRUE(struct_pool_new(0, 8) == NULL);
+	EXPECT_TRUE(struct_pool_new(0x7FFFFFFF, 8) == NULL);
+}
+
+} // namespace
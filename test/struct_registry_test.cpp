@@ -0,0 +1,268 @@
+/*
+ * struct_registry_test.cpp
+ *
+ * tag-based dispatch of mixed messages
+ */
+
+#include "struct_registry.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Login {
+	uint32_t id;
+	uint64_t seq;
+};
+
+struct Chat {
+	uint32_t id;
+	char text[8];
+};
+
+struct Log {
+	std::vector<uint64_t> tags;
+	std::vector<uint32_t> ids;
+	std::vector<uint64_t> seqs;
+	std::vector<std::string> texts;
+	int stop_at;
+};
+
+static int on_login(uint64_t tag, const void *record, void *arg)
+{
+	const Login *login = (const Login *)record;
+	Log *log = (Log *)arg;
+
+	log->tags.push_back(tag);
+	log->ids.push_back(login->id);
+	log->seqs.push_back(login->seq);
+	return ((int)log->tags.size() == log->stop_at) ? 7 : 0;
+}
+
+static int on_chat(uint64_t tag, const void *record, void *arg)
+{
+	const Chat *chat = (const Chat *)record;
+	Log *log = (Log *)arg;
+
+	log->tags.push_back(tag);
+	log->ids.push_back(chat->id);
+	log->texts.push_back(std::string(chat->text, 8));
+	return ((int)log->tags.size() == log->stop_at) ? 7 : 0;
+}
+
+TEST(StructRegistry, DispatchMixed)
+{
+	struct_registry *reg = struct_registry_new("B");
+	unsigned char buf[256];
+	Login login = { 1, 300 };
+	Chat chat = { 2, { 'h', 'e', 'l', 'l', 'o', ' ', ' ', ' ' } };
+	Log log;
+	long consumed = 0;
+	int len = 0;
+
+	log.stop_at = 0;
+	ASSERT_TRUE(reg != NULL);
+	ASSERT_EQ(0, struct_registry_add(reg, 1, "!IV", on_login, &log));
+	ASSERT_EQ(0, struct_registry_add(reg, 2, "!I8s", on_chat, &log));
+
+	len += struct_registry_pack_record(reg, buf + len, 1, &login);
+	len += struct_registry_pack_record(reg, buf + len, 2, &chat);
+	login.id = 3;
+	login.seq = 1ULL << 40;
+	len += struct_registry_pack_record(reg, buf + len, 1, &login);
+	/* tag, I and V (300, then 1 << 40) or 8s */
+	EXPECT_EQ(7 + 13 + 11, len);
+
+	EXPECT_EQ(0, struct_registry_dispatch(reg, buf, len, &consumed));
+	EXPECT_EQ(len, consumed);
+	ASSERT_EQ(3U, log.tags.size());
+	EXPECT_EQ(1U, log.tags[0]);
+	EXPECT_EQ(2U, log.tags[1]);
+	EXPECT_EQ(1U, log.tags[2]);
+	EXPECT_EQ(1U, log.ids[0]);
+	EXPECT_EQ(2U, log.ids[1]);
+	EXPECT_EQ(3U, log.ids[2]);
+	EXPECT_EQ(300U, log.seqs[0]);
+	EXPECT_EQ(1ULL << 40, log.seqs[1]);
+	EXPECT_EQ("hello   ", log.texts[0]);
+	struct_registry_free(reg);
+}
+
+TEST(StructRegistry, IncompleteUnknownAndStop)
+{
+	struct_registry *reg = struct_registry_new("B");
+	unsigned char buf[64];
+	Login login = { 1, 300 };
+	Log log;
+	long consumed = 0;
+	int len = 0;
+	int first;
+
+	log.stop_at = 0;
+	ASSERT_TRUE(reg != NULL);
+	ASSERT_EQ(0, struct_registry_add(reg, 1, "!IV", on_login, &log));
+	first = struct_registry_pack_record(reg, buf, 1, &login);
+	len = first + struct_registry_pack_record(reg, buf + first, 1, &login);
+
+	/* the second message is cut */
+	EXPECT_EQ(0, struct_registry_dispatch(reg, buf, len - 1, &consumed));
+	EXPECT_EQ(first, consumed);
+	EXPECT_EQ(1U, log.tags.size());
+
+	/* a handler stops the loop */
+	log.tags.clear();
+	log.stop_at = 1;
+	EXPECT_EQ(7, struct_registry_dispatch(reg, buf, len, &consumed));
+	EXPECT_EQ(first, consumed);
+
+	/* unknown tag */
+	log.tags.clear();
+	log.stop_at = 0;
+	buf[first] = 9;
+	EXPECT_EQ(STRUCT_REGISTRY_UNKNOWN,
+			struct_registry_dispatch(reg, buf, len, &consumed));
+	EXPECT_EQ(first, consumed);
+	EXPECT_EQ(-1, struct_registry_pack_record(reg, buf, 9, &login));
+	struct_registry_free(reg);
+}
+
+TEST(StructRegistry, WideTags)
+{
+	struct_registry *reg = struct_registry_new("!V");
+	unsigned char buf[16];
+	Login login = { 5, 6 };
+	Log log;
+	long consumed;
+	uint64_t tag;
+	int len;
+
+	log.stop_at = 0;
+	ASSERT_TRUE(reg != NULL);
+	/* grow the hash table a few times */
+	for (tag = 1000; tag < 1200; tag++) {
+		ASSERT_EQ(0, struct_registry_add(reg, tag * 1000003,
+					"!IV", on_login, &log));
+	}
+	for (tag = 1000; tag < 1200; tag++) {
+		ASSERT_TRUE(struct_registry_format(reg, tag * 1000003) != NULL);
+	}
+	EXPECT_TRUE(struct_registry_format(reg, 999) == NULL);
+
+	len = struct_registry_pack_record(reg, buf, 1100 * 1000003ULL, &login);
+	ASSERT_GT(len, 0);
+	EXPECT_EQ(0, struct_registry_dispatch(reg, buf, len, &consumed));
+	EXPECT_EQ(len, consumed);
+	ASSERT_EQ(1U, log.tags.size());
+	EXPECT_EQ(1100 * 1000003ULL, log.tags[0]);
+	EXPECT_EQ(5U, log.ids[0]);
+	EXPECT_EQ(6U, log.seqs[0]);
+
+	/* replace a format */
+	ASSERT_EQ(0, struct_registry_add(reg, 1100 * 1000003ULL, "!I8s",
+				on_chat, &log));
+	EXPECT_EQ(12, struct_format_calcsize(
+				struct_registry_format(reg, 1100 * 1000003ULL)));
+	struct_registry_free(reg);
+}
+
+TEST(StructRegistry, Invalid)
+{
+	EXPECT_TRUE(struct_registry_new("BB") == NULL);
+	EXPECT_TRUE(struct_registry_new("4s") == NULL);
+	EXPECT_TRUE(struct_registry_new("d") == NULL);
+	EXPECT_TRUE(struct_registry_new("Z") == NULL);
+	EXPECT_TRUE(struct_registry_new("b") == NULL);
+	EXPECT_TRUE(struct_registry_new("!h") == NULL);
+	EXPECT_TRUE(struct_registry_new("i") == NULL);
+	EXPECT_TRUE(struct_registry_new("q") == NULL);
+	EXPECT_TRUE(struct_registry_new("v") == NULL);
+}
+
+TEST(StructRegistry, HighByteTags)
+{
+	struct_registry *reg = struct_registry_new("B");
+	unsigned char buf[64];
+	Login login = { 5, 6 };
+	Log log;
+	long consumed = 0;
+	int len;
+
+	log.stop_at = 0;
+	ASSERT_TRUE(reg != NULL);
+	ASSERT_EQ(0, struct_registry_add(reg, 200, "!IV", on_login, &log));
+	ASSERT_EQ(0, struct_registry_add(reg, 0xFF, "!IV", on_login, &log));
+	len = struct_registry_pack_record(reg, buf, 200, &login);
+	EXPECT_EQ(0xC8, buf[0]);
+	len += struct_registry_pack_record(reg, buf + len, 0xFF, &login);
+
+	EXPECT_EQ(0, struct_registry_dispatch(reg, buf, len, &consumed));
+	EXPECT_EQ(len, consumed);
+	ASSERT_EQ(2U, log.tags.size());
+	EXPECT_EQ(200U, log.tags[0]);
+	EXPECT_EQ(0xFFU, log.tags[1]);
+	struct_registry_free(reg);
+}
+
+TEST(StructRegistry, TagTooWideInvalid)
+{
+	struct_registry *reg = struct_registry_new("B");
+
+	ASSERT_TRUE(reg != NULL);
+	EXPECT_EQ(-1, struct_registry_add(reg, 300, "!IV", NULL, NULL));
+	EXPECT_EQ(-1, struct_registry_add(reg, 0x100, "!IV", NULL, NULL));
+	EXPECT_TRUE(struct_registry_format(reg, 300) == NULL);
+	EXPECT_TRUE(struct_registry_format(reg, 300 & 0xFF) == NULL);
+	struct_registry_free(reg);
+
+	reg = struct_registry_new("!I");
+	ASSERT_TRUE(reg != NULL);
+	EXPECT_EQ(0, struct_registry_add(reg, 0xFFFFFFFFULL, "!IV", NULL, NULL));
+	EXPECT_EQ(-1, struct_registry_add(reg, 0x100000000ULL, "!IV", NULL,
+				NULL));
+	struct_registry_free(reg);
+}
+
+TEST(StructRegistry, MalformedVarint)
+{
+	struct_registry *reg = struct_registry_new("B");
+	unsigned char buf[64];
+	Login login = { 1, 300 };
+	Log log;
+	long consumed = -1;
+	int first;
+
+	log.stop_at = 0;
+	ASSERT_TRUE(reg != NULL);
+	ASSERT_EQ(0, struct_registry_add(reg, 1, "!IV", on_login, &log));
+	first = struct_registry_pack_record(reg, buf, 1, &login);
+
+	/* the varint of the second message never ends */
+	buf[first] = 1;
+	memset(buf + first + 1, 0, 4);
+	memset(buf + first + 5, 0x80, 9);
+	EXPECT_EQ(0, struct_registry_dispatch(reg, buf, first + 14, &consumed));
+	EXPECT_EQ(first, consumed);
+	buf[first + 14] = 0x80;
+	EXPECT_EQ(STRUCT_REGISTRY_MALFORMED,
+			struct_registry_dispatch(reg, buf, first + 15, &consumed));
+	EXPECT_EQ(first, consumed);
+	EXPECT_EQ(2U, log.tags.size());
+
+	/* a malformed varint tag */
+	struct_registry_free(reg);
+	reg = struct_registry_new("V");
+	ASSERT_TRUE(reg != NULL);
+	memset(buf, 0x80, 10);
+	EXPECT_EQ(0, struct_registry_dispatch(reg, buf, 9, &consumed));
+	EXPECT_EQ(STRUCT_REGISTRY_MALFORMED,
+			struct_registry_dispatch(reg, buf, 10, &consumed));
+	EXPECT_EQ(0, consumed);
+	struct_registry_free(reg);
+}
+
+} // namespace
@@ -0,0 +1,199 @@
+/*
+ * struct_ring_test.cpp
+ *
+ * single-producer/single-consumer ring of packed records
+ */
+
+#include "struct_ring.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <thread>
+
+namespace {
+
+TEST(StructRing, ReserveCommitPeekValid)
+{
+	struct_ring *r = struct_ring_new(64, 1);
+	const void *rec;
+	void *slot;
+	int32_t o = 0;
+	int len = 0;
+
+	ASSERT_TRUE(r != NULL);
+	EXPECT_TRUE(struct_ring_peek(r, &len) == NULL);
+	slot = struct_ring_reserve(r, 4);
+	ASSERT_TRUE(slot != NULL);
+	struct_ring_commit(r, struct_pack(slot, "!i", 0x12345678));
+
+	rec = struct_ring_peek(r, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(4, len);
+	EXPECT_EQ(4, struct_unpack(rec, "!i", &o));
+	EXPECT_EQ(0x12345678, o);
+	struct_ring_release(r);
+	EXPECT_TRUE(struct_ring_peek(r, &len) == NULL);
+	struct_ring_free(r);
+}
+
+TEST(StructRing, BatchedPublication)
+{
+	struct_ring *r = struct_ring_new(256, 4);
+	int len;
+	int i;
+
+	ASSERT_TRUE(r != NULL);
+	for (i = 0; i < 3; i++) {
+		EXPECT_EQ(2, struct_ring_pack(r, "!h", i));
+	}
+	EXPECT_TRUE(struct_ring_peek(r, &len) == NULL);
+	struct_ring_publish(r);
+	for (i = 0; i < 3; i++) {
+		ASSERT_TRUE(struct_ring_peek(r, &len) != NULL);
+		struct_ring_release(r);
+	}
+	EXPECT_TRUE(struct_ring_peek(r, &len) == NULL);
+	struct_ring_free(r);
+}
+
+TEST(StructRing, FullAndWrapAround)
+{
+	struct_ring *r = struct_ring_new(64, 1);
+	const void *rec;
+	int64_t o1, o2, o3;
+	int len;
+	int i;
+
+	ASSERT_TRUE(r != NULL);
+	/* 16 bytes per record: 4 fit */
+	for (i = 0; i < 4; i++) {
+		EXPECT_EQ(8, struct_ring_pack(r, "<q", (int64_t)i));
+	}
+	EXPECT_EQ(0, struct_ring_pack(r, "<q", (int64_t)4));
+	EXPECT_EQ(-1, struct_ring_pack(r, "<64s", "x"));
+	for (i = 0; i < 4; i++) {
+		ASSERT_TRUE(struct_ring_peek(r, &len) != NULL);
+		struct_ring_release(r);
+	}
+	EXPECT_EQ(8, struct_ring_pack(r, "<q", (int64_t)0));
+	EXPECT_EQ(8, struct_ring_pack(r, "<q", (int64_t)0));
+	EXPECT_EQ(8, struct_ring_pack(r, "<q", (int64_t)0));
+	for (i = 0; i < 3; i++) {
+		ASSERT_TRUE(struct_ring_peek(r, &len) != NULL);
+		struct_ring_release(r);
+	}
+
+	/* 32 bytes do not fit in the last 16 bytes: wrap around. */
+	EXPECT_EQ(24, struct_ring_pack(r, "<qqq", (int64_t)1, (int64_t)2,
+				(int64_t)3));
+	EXPECT_EQ(8, struct_ring_pack(r, "<q", (int64_t)4));
+	EXPECT_EQ(0, struct_ring_pack(r, "<q", (int64_t)5));
+
+	rec = struct_ring_peek(r, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(24, len);
+	struct_unpack(rec, "<qqq", &o1, &o2, &o3);
+	EXPECT_EQ(1, o1);
+	EXPECT_EQ(2, o2);
+	EXPECT_EQ(3, o3);
+	struct_ring_release(r);
+	rec = struct_ring_peek(r, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(8, len);
+	struct_unpack(rec, "<q", &o1);
+	EXPECT_EQ(4, o1);
+	struct_ring_release(r);
+	EXPECT_TRUE(struct_ring_peek(r, &len) == NULL);
+	struct_ring_free(r);
+}
+
+TEST(StructRing, PackReservesExactSize)
+{
+	struct_ring *r = struct_ring_new(32, 1);
+	uint64_t seq = 0;
+	uint32_t id = 0;
+	int len = 0;
+	const void *rec;
+
+	ASSERT_TRUE(r != NULL);
+	/* 16 bytes per record with small varints, not 24 */
+	EXPECT_EQ(5, struct_ring_pack(r, "!IV", 1, (uint64_t)2));
+	EXPECT_EQ(5, struct_ring_pack(r, "!IV", 3, (uint64_t)4));
+	EXPECT_EQ(0, struct_ring_pack(r, "!IV", 5, (uint64_t)6));
+
+	rec = struct_ring_peek(r, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(5, len);
+	EXPECT_EQ(5, struct_unpack(rec, "!IV", &id, &seq));
+	EXPECT_EQ(1U, id);
+	EXPECT_EQ(2U, seq);
+	struct_ring_release(r);
+	rec = struct_ring_peek(r, &len);
+	ASSERT_TRUE(rec != NULL);
+	EXPECT_EQ(5, struct_unpack(rec, "!IV", &id, &seq));
+	EXPECT_EQ(3U, id);
+	struct_ring_free(r);
+}
+
+struct Record {
+	uint32_t seq;
+	uint64_t val;
+	char s[3];
+};
+
+TEST(StructRing, ProducerConsumerThreads)
+{
+	const uint32_t count = 200000;
+	struct_ring *r = struct_ring_new(1024, 16);
+	struct_format *sf = struct_compile("!IV3s");
+
+	ASSERT_TRUE(r != NULL);
+	ASSERT_TRUE(sf != NULL);
+
+	std::thread producer([&]() {
+		Record rec;
+		uint32_t i;
+		memcpy(rec.s, "abc", 3);
+		for (i = 0; i < count; i++) {
+			rec.seq = i;
+			rec.val = (uint64_t)i << (i % 32);
+			while (struct_ring_pack_record(r, sf, &rec) == 0) {
+				std::this_thread::yield();
+			}
+		}
+		struct_ring_publish(r);
+	});
+
+	Record rec;
+	const void *p;
+	uint32_t i = 0;
+	int len;
+
+	while (i < count) {
+		p = struct_ring_peek(r, &len);
+		if (p == NULL) {
+			std::this_thread::yield();
+			continue;
+		}
+		ASSERT_EQ(len, struct_format_unpack_record(sf, p, &rec));
+		ASSERT_EQ(i, rec.seq);
+		ASSERT_EQ((uint64_t)i << (i % 32), rec.val);
+		ASSERT_EQ(0, memcmp(rec.s, "abc", 3));
+		struct_ring_release(r);
+		i++;
+	}
+	producer.join();
+	EXPECT_TRUE(struct_ring_peek(r, &len) == NULL);
+	struct_format_free(sf);
+	struct_ring_free(r);
+}
+
+TEST(StructRing, InvalidCapacity)
+{
+	EXPECT_TRUE(struct_ring_new(100, 1) == NULL);
+	EXPECT_TRUE(struct_ring_new(8, 1) == NULL);
+}
+
+} // namespace
@@ -0,0 +1,384 @@
+/*
+ * struct_scan_test.cpp
+ *
+ * scans and filters over fields of packed records
+ */
+
+#include "struct_scan.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits>
+#include <vector>
+
+namespace {
+
+struct Record {
+	int8_t b;
+	int16_t h;
+	int32_t i;
+	int64_t q;
+	uint8_t B;
+	uint16_t H;
+	uint32_t I;
+	uint64_t Q;
+	float f;
+	double d;
+};
+
+static std::vector<Record> make_records(int n)
+{
+	std::vector<Record> records(n);
+	int k;
+
+	for (k = 0; k < n; k++) {
+		records[k].b = (int8_t)(k * 37 - 100);
+		records[k].h = (int16_t)(k * 1237 - 30000);
+		records[k].i = k * 100003 - 50000000;
+		records[k].q = (int64_t)k * 1000000007LL * ((k % 2) ? -1 : 1);
+		records[k].B = (uint8_t)(k * 13);
+		records[k].H = (uint16_t)(k * 4099);
+		records[k].I = (uint32_t)k * 2654435761U;
+		records[k].Q = (uint64_t)k << (k % 64);
+		records[k].f = (k - 500) / 8.0f;
+		records[k].d = (k % 7 - 3) * 1.5e10;
+	}
+	return records;
+}
+
+template <typename T>
+static void expect_aggregate(struct_format *sf, const unsigned char *buf,
+		const std::vector<Record> &records, int field, T Record::*member,
+		const char *fmt)
+{
+	struct struct_aggregate agg;
+	T min = std::numeric_limits<T>::max();
+	T max = std::numeric_limits<T>::lowest();
+	double dsum = 0;
+	uint64_t usum = 0;
+	size_t k;
+
+	for (k = 0; k < records.size(); k++) {
+		T v = records[k].*member;
+		min = (v < min) ? v : min;
+		max = (v > max) ? v : max;
+		dsum += v;
+		usum += (uint64_t)(int64_t)v;
+	}
+
+	ASSERT_EQ(0, struct_scan_aggregate(sf, buf, records.size(), field, &agg))
+		<< fmt << " field " << field;
+	EXPECT_EQ((long)records.size(), agg.count);
+	if (!std::numeric_limits<T>::is_integer) {
+		EXPECT_DOUBLE_EQ(dsum, agg.sum.d) << fmt << " field " << field;
+		EXPECT_EQ((double)min, agg.min.d) << fmt << " field " << field;
+		EXPECT_EQ((double)max, agg.max.d) << fmt << " field " << field;
+	} else if (std::numeric_limits<T>::is_signed) {
+		EXPECT_EQ((int64_t)usum, agg.sum.i) << fmt << " field " << field;
+		EXPECT_EQ((int64_t)min, agg.min.i) << fmt << " field " << field;
+		EXPECT_EQ((int64_t)max, agg.max.i) << fmt << " field " << field;
+	} else {
+		EXPECT_EQ(usum, agg.sum.u) << fmt << " field " << field;
+		EXPECT_EQ((uint64_t)min, agg.min.u) << fmt << " field " << field;
+		EXPECT_EQ((uint64_t)max, agg.max.u) << fmt << " field " << field;
+	}
+}
+
+TEST(StructScan, AggregateEveryKindAndByteOrder)
+{
+	static const char *fmts[] = {
+		"<bhiqBHIQfd", ">bhiqBHIQfd", "=bhiqBHIQfd", "^bhiqBHIQfd",
+		"<bxhxiqBxHIQfdx"
+	};
+	std::vector<Record> records = make_records(1000);
+	size_t f;
+	size_t k;
+
+	for (f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+		struct_format *sf = struct_compile(fmts[f]);
+		int size;
+		unsigned char *buf;
+
+		ASSERT_TRUE(sf != NULL);
+		size = struct_format_calcsize(sf);
+		buf = (unsigned char *)malloc(records.size() * size);
+		for (k = 0; k < records.size(); k++) {
+			struct_format_pack_record(sf, buf + k * size, &records[k]);
+		}
+
+		expect_aggregate(sf, buf, records, 0, &Record::b, fmts[f]);
+		expect_aggregate(sf, buf, records, 1, &Record::h, fmts[f]);
+		expect_aggregate(sf, buf, records, 2, &Record::i, fmts[f]);
+		expect_aggregate(sf, buf, records, 3, &Record::q, fmts[f]);
+		expect_aggregate(sf, buf, records, 4, &Record::B, fmts[f]);
+		expect_aggregate(sf, buf, records, 5, &Record::H, fmts[f]);
+		expect_aggregate(sf, buf, records, 6, &Record::I, fmts[f]);
+		expect_aggregate(sf, buf, records, 7, &Record::Q, fmts[f]);
+		expect_aggregate(sf, buf, records, 8, &Record::f, fmts[f]);
+		expect_aggregate(sf, buf, records, 9, &Record::d, fmts[f]);
+		free(buf);
+		struct_format_free(sf);
+	}
+}
+
+TEST(StructScan, AggregateEmptyAndInvalid)
+{
+	struct_format *sf = struct_compile("!id4s");
+	struct_format *var = struct_compile("!iV");
+	struct struct_aggregate agg;
+	unsigned char buf[16];
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_TRUE(var != NULL);
+	ASSERT_EQ(0, struct_scan_aggregate(sf, buf, 0, 0, &agg));
+	EXPECT_EQ(0, agg.count);
+	EXPECT_EQ(0, agg.sum.i);
+	EXPECT_EQ(std::numeric_limits<int64_t>::max(), agg.min.i);
+	ASSERT_EQ(0, struct_scan_aggregate(sf, buf, 0, 1, &agg));
+	EXPECT_EQ(std::numeric_limits<double>::infinity(), agg.min.d);
+
+	EXPECT_EQ(-1, struct_scan_aggregate(sf, buf, 1, 2, &agg));
+	EXPECT_EQ(-1, struct_scan_aggregate(sf, buf, 1, 3, &agg));
+	EXPECT_EQ(-1, struct_scan_aggregate(var, buf, 1, 0, &agg));
+	struct_format_free(var);
+	struct_format_free(sf);
+}
+
+template <typename T>
+static bool compare(T v, int op, T c)
+{
+	switch (op) {
+	case STRUCT_SCAN_EQ: return v == c;
+	case STRUCT_SCAN_NE: return v != c;
+	case STRUCT_SCAN_LT: return v < c;
+	case STRUCT_SCAN_LE: return v <= c;
+	case STRUCT_SCAN_GT: return v > c;
+	default: return v >= c;
+	}
+}
+
+/*
+ * select with preds and check against a record by record evaluation.
+ */
+static void expect_filter(struct_format *sf, const unsigned char *buf,
+		const std::vector<Record> &records,
+		const struct struct_predicate *preds, int npreds,
+		const std::vector<bool> &expected, const char *fmt)
+{
+	std::vector<long> sel(records.size() + 1);
+	std::vector<unsigned char> bitmap((records.size() + 7) / 8, 0xff);
+	long count = 0;
+	long nsel;
+	size_t k;
+
+	for (k = 0; k < records.size(); k++) {
+		count += expected[k];
+	}
+	nsel = struct_scan_select(sf, buf, records.size(), preds, npreds,
+			&sel[0]);
+	ASSERT_EQ(count, nsel) << fmt;
+	ASSERT_EQ(count, struct_scan_bitmap(sf, buf, records.size(), preds,
+				npreds, &bitmap[0])) << fmt;
+	count = 0;
+	for (k = 0; k < records.size(); k++) {
+		EXPECT_EQ(expected[k], ((bitmap[k / 8] >> (k % 8)) & 1) != 0)
+			<< fmt << " record " << k;
+		if (expected[k]) {
+			EXPECT_EQ((long)k, sel[count++]) << fmt;
+		}
+	}
+}
+
+TEST(StructScan, SelectEveryKindOpAndByteOrder)
+{
+	static const char *fmts[] = {
+		"<bhiqBHIQfd", ">bhiqBHIQfd", "=bhiqBHIQfd", "^bhiqBHIQfd",
+		"<bxhxiqBxHIQfdx"
+	};
+	std::vector<Record> records = make_records(3000);
+	std::vector<bool> expected(records.size());
+	struct struct_predicate pred;
+	size_t f;
+	size_t k;
+	int op;
+
+	for (f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+		struct_format *sf = struct_compile(fmts[f]);
+		int size;
+		unsigned char *buf;
+
+		ASSERT_TRUE(sf != NULL);
+		size = struct_format_calcsize(sf);
+		buf = (unsigned char *)malloc(records.size() * size);
+		for (k = 0; k < records.size(); k++) {
+			struct_format_pack_record(sf, buf + k * size, &records[k]);
+		}
+
+		for (op = STRUCT_SCAN_EQ; op <= STRUCT_SCAN_GE; op++) {
+			/* compare with the value of record 1234 */
+			const Record &c = records[1234];
+
+#define CHECK_FIELD(index, member, kind)                               \
+			pred.field = index;                                        \
+			pred.op = op;                                              \
+			pred.value.kind = c.member;                                \
+			for (k = 0; k < records.size(); k++) {                     \
+				expected[k] = compare(records[k].member, op, c.member); \
+			}                                                          \
+			expect_filter(sf, buf, records, &pred, 1, expected, fmts[f])
+
+			CHECK_FIELD(0, b, i);
+			CHECK_FIELD(1, h, i);
+			CHECK_FIELD(2, i, i);
+			CHECK_FIELD(3, q, i);
+			CHECK_FIELD(4, B, u);
+			CHECK_FIELD(5, H, u);
+			CHECK_FIELD(6, I, u);
+			CHECK_FIELD(7, Q, u);
+			CHECK_FIELD(8, f, d);
+			CHECK_FIELD(9, d, d);
+#undef CHECK_FIELD
+		}
+		free(buf);
+		struct_format_free(sf);
+	}
+}
+
+TEST(StructScan, SelectConjunction)
+{
+	struct_format *sf = struct_compile("!QdI8s");
+	std::vector<Record> records = make_records(2500);
+	std::vector<bool> expected(records.size());
+	std::vector<unsigned char> buf;
+	struct struct_predicate preds[3];
+	size_t k;
+
+	struct Trade {
+		uint64_t id;
+		double price;
+		uint32_t shares;
+		char venue[8];
+	} trade;
+
+	ASSERT_TRUE(sf != NULL);
+	buf.resize(records.size() * struct_format_calcsize(sf));
+	for (k = 0; k < records.size(); k++) {
+		trade.id = k;
+		trade.price = records[k].f;
+		trade.shares = records[k].I % 5000;
+		memcpy(trade.venue, "XNYS    ", 8);
+		struct_format_pack_record(sf, &buf[k * 28], &trade);
+	}
+
+	/* 10.5 < price <= 40 and shares >= 1000 */
+	preds[0].field = 1;
+	preds[0].op = STRUCT_SCAN_GT;
+	preds[0].value.d = 10.5;
+	preds[1].field = 1;
+	preds[1].op = STRUCT_SCAN_LE;
+	preds[1].value.d = 40;
+	preds[2].field = 2;
+	preds[2].op = STRUCT_SCAN_GE;
+	preds[2].value.u = 1000;
+	for (k = 0; k < records.size(); k++) {
+		expected[k] = records[k].f > 10.5 && records[k].f <= 40 &&
+			records[k].I % 5000 >= 1000;
+	}
+	expect_filter(sf, &buf[0], records, preds, 3, expected, "!QdI8s");
+
+	/* no predicate selects every record */
+	expected.assign(records.size(), true);
+	expect_filter(sf, &buf[0], records, preds, 0, expected, "!QdI8s");
+	struct_format_free(sf);
+}
+
+TEST(StructScan, SelectFloatSpecials)
+{
+	struct_format *sf = struct_compile("<d");
+	double values[] = {
+		-0.0, 0.0, 1.0, -1.0, std::numeric_limits<double>::infinity(),
+		-std::numeric_limits<double>::infinity()
+	};
+	struct struct_predicate pred;
+	long sel[6];
+
+	ASSERT_TRUE(sf != NULL);
+	pred.field = 0;
+	pred.op = STRUCT_SCAN_EQ;
+	pred.value.d = 0.0;
+	ASSERT_EQ(2, struct_scan_select(sf, values, 6, &pred, 1, sel));
+	EXPECT_EQ(0, sel[0]);
+	EXPECT_EQ(1, sel[1]);
+	pred.value.d = -0.0;
+	EXPECT_EQ(2, struct_scan_select(sf, values, 6, &pred, 1, sel));
+
+	pred.op = STRUCT_SCAN_LT;
+	pred.value.d = 0.5;
+	ASSERT_EQ(4, struct_scan_select(sf, values, 6, &pred, 1, sel));
+	EXPECT_EQ(5, sel[3]);
+	pred.op = STRUCT_SCAN_GT;
+	pred.value.d = std::numeric_limits<double>::max();
+	ASSERT_EQ(1, struct_scan_select(sf, values, 6, &pred, 1, sel));
+	EXPECT_EQ(4, sel[0]);
+	struct_format_free(sf);
+}
+
+TEST(StructScan, Gather)
+{
+	struct_format *sf = struct_compile("<iH");
+	unsigned char buf[6 * 100];
+	unsigned char out[6 * 100];
+	struct struct_predicate pred;
+	long sel[100];
+	long nsel;
+	int32_t i;
+	uint16_t H;
+	int k;
+
+	ASSERT_TRUE(sf != NULL);
+	for (k = 0; k < 100; k++) {
+		struct_pack(buf + k * 6, "<iH", k - 50, k % 3);
+	}
+	pred.field = 1;
+	pred.op = STRUCT_SCAN_EQ;
+	pred.value.u = 2;
+	nsel = struct_scan_select(sf, buf, 100, &pred, 1, sel);
+	ASSERT_EQ(33, nsel);
+	ASSERT_EQ(33 * 6, struct_scan_gather(sf, buf, sel, nsel, out));
+	for (k = 0; k < nsel; k++) {
+		struct_unpack(out + k * 6, "<iH", &i, &H);
+		EXPECT_EQ(k * 3 + 2 - 50, i);
+		EXPECT_EQ(2, H);
+	}
+	struct_format_free(sf);
+}
+
+TEST(StructScan, SelectInvalid)
+{
+	struct_format *sf = struct_compile("!id4s");
+	struct_format *var = struct_compile("!iV");
+	struct struct_predicate pred = { 0, STRUCT_SCAN_EQ, { 0 } };
+	unsigned char buf[16] = { 0 };
+	long sel[1];
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_TRUE(var != NULL);
+	EXPECT_EQ(0, struct_scan_select(sf, buf, 0, &pred, 1, sel));
+	EXPECT_EQ(1, struct_scan_select(sf, buf, 1, &pred, 1, sel));
+	EXPECT_EQ(-1, struct_scan_select(var, buf, 1, &pred, 1, sel));
+	EXPECT_EQ(-1, struct_scan_gather(var, buf, sel, 1, buf));
+	pred.op = 6;
+	EXPECT_EQ(-1, struct_scan_select(sf, buf, 1, &pred, 1, sel));
+	pred.op = STRUCT_SCAN_LT;
+	pred.field = 2;
+	EXPECT_EQ(-1, struct_scan_bitmap(sf, buf, 1, &pred, 1, buf));
+	pred.field = 3;
+	EXPECT_EQ(-1, struct_scan_select(sf, buf, 1, &pred, 1, sel));
+	struct_format_free(var);
+	struct_format_free(sf);
+}
+
+} // namespace
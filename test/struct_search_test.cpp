@@ -0,0 +1,234 @@
+/*
+ * struct_search_test.cpp
+ *
+ * lookup in sorted packed record files
+ */
+
+#include "struct_search.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace {
+
+struct Record {
+	int64_t key;
+	uint64_t seq;
+	char name[8];
+};
+
+static int temp_file()
+{
+	char path[] = "/tmp/struct_search_testXXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd >= 0) {
+		unlink(path);
+	}
+	return fd;
+}
+
+/*
+ * n records by groups of three of the same key, 4 apart and even, and
+ * the offset of the first record of each group.
+ */
+static int sorted_file(struct_format *sf, int n, std::vector<long> &offsets)
+{
+	unsigned char buf[64];
+	Record rec;
+	long offset = 0;
+	int fd = temp_file();
+	int i;
+	int len;
+
+	memset(&rec, 0, sizeof(rec));
+	for (i = 0; i < n; i++) {
+		rec.key = 2 * (i / 3 * 2 - n / 2);
+		rec.seq = (uint64_t)i << (i % 50);
+		snprintf(rec.name, sizeof(rec.name), "r%d", i);
+		len = struct_format_pack_record(sf, buf, &rec);
+		EXPECT_EQ(len, write(fd, buf, len));
+		if (i % 3 == 0) {
+			offsets.push_back(offset);
+		}
+		offset += len;
+	}
+	return fd;
+}
+
+TEST(StructSearch, Fixed)
+{
+	struct_format *sf = struct_compile("!qQ8s");
+	std::vector<long> offsets;
+	Record probe;
+	Record rec;
+	size_t i;
+	int fd;
+
+	ASSERT_TRUE(sf != NULL);
+	fd = sorted_file(sf, 3000, offsets);
+	for (i = 0; i < offsets.size(); i++) {
+		probe.key = 2 * ((long)i * 2 - 1500);
+		ASSERT_EQ(offsets[i], struct_search_fixed(sf, 0, fd, &probe, &rec));
+		EXPECT_EQ(probe.key, rec.key);
+		EXPECT_EQ(0, strncmp(rec.name, "r", 1));
+
+		/* odd keys are missing */
+		probe.key++;
+		EXPECT_EQ(-1, struct_search_fixed(sf, 0, fd, &probe, NULL));
+	}
+	probe.key = -1000000;
+	EXPECT_EQ(-1, struct_search_fixed(sf, 0, fd, &probe, NULL));
+	probe.key = 1000000;
+	EXPECT_EQ(-1, struct_search_fixed(sf, 0, fd, &probe, NULL));
+
+	EXPECT_EQ(-1, struct_search_fixed(sf, 3, fd, &probe, NULL));
+	close(fd);
+	struct_format_free(sf);
+}
+
+TEST(StructSearch, SparseIndex)
+{
+	struct_format *sf = struct_compile("!vV8s");
+	std::vector<long> offsets;
+	struct_index *idx;
+	struct_index *loaded;
+	Record probe;
+	Record rec;
+	size_t i;
+	int idx_fd = temp_file();
+	int fd;
+
+	ASSERT_TRUE(sf != NULL);
+	fd = sorted_file(sf, 3000, offsets);
+	idx = struct_index_build(sf, 0, fd, 16);
+	ASSERT_TRUE(idx != NULL);
+	EXPECT_EQ(3000, struct_index_nrecords(idx));
+
+	ASSERT_EQ(0, struct_index_save(idx, idx_fd));
+	lseek(idx_fd, 0, SEEK_SET);
+	loaded = struct_index_load(sf, 0, idx_fd);
+	ASSERT_TRUE(loaded != NULL);
+	EXPECT_EQ(3000, struct_index_nrecords(loaded));
+
+	for (i = 0; i < offsets.size(); i++) {
+		probe.key = 2 * ((long)i * 2 - 1500);
+		ASSERT_EQ(offsets[i], struct_index_search(idx, fd, &probe, &rec));
+		EXPECT_EQ(probe.key, rec.key);
+		EXPECT_EQ((uint64_t)(i * 3) << (i * 3 % 50), rec.seq);
+		ASSERT_EQ(offsets[i], struct_index_search(loaded, fd, &probe,
+					NULL));
+
+		probe.key++;
+		EXPECT_EQ(-1, struct_index_search(idx, fd, &probe, NULL));
+	}
+	probe.key = -1000000;
+	EXPECT_EQ(-1, struct_index_search(loaded, fd, &probe, NULL));
+	probe.key = 1000000;
+	EXPECT_EQ(-1, struct_index_search(loaded, fd, &probe, NULL));
+
+	/* an index of another key kind */
+	lseek(idx_fd, 0, SEEK_SET);
+	EXPECT_TRUE(struct_index_load(sf, 2, idx_fd) == NULL);
+
+	struct_index_free(loaded);
+	struct_index_free(idx);
+	close(idx_fd);
+	close(fd);
+	struct_format_free(sf);
+}
+
+/* load an index file of the given bytes */
+static struct_index *load_bytes(struct_format *sf,
+		const std::vector<unsigned char> &bytes)
+{
+	struct_index *idx;
+	int fd = temp_file();
+
+	EXPECT_EQ((ssize_t)bytes.size(), write(fd, &bytes[0], bytes.size()));
+	lseek(fd, 0, SEEK_SET);
+	idx = struct_index_load(sf, 0, fd);
+	close(fd);
+	return idx;
+}
+
+TEST(StructSearch, CorruptedIndexInvalid)
+{
+	struct_format *sf = struct_compile("!vV8s");
+	std::vector<long> offsets;
+	std::vector<unsigned char> bytes, bad;
+	struct_index *idx;
+	int header = struct_calcsize("!4sBIIQQ");
+	int entry = 8 + 8;
+	int idx_fd = temp_file();
+	int fd;
+	off_t n;
+
+	ASSERT_TRUE(sf != NULL);
+	fd = sorted_file(sf, 100, offsets);
+	idx = struct_index_build(sf, 0, fd, 16);
+	ASSERT_TRUE(idx != NULL);
+	ASSERT_EQ(0, struct_index_save(idx, idx_fd));
+	struct_index_free(idx);
+	n = lseek(idx_fd, 0, SEEK_END);
+	ASSERT_EQ(header + 7 * entry, n);
+	bytes.resize(n);
+	ASSERT_EQ(n, pread(idx_fd, &bytes[0], n, 0));
+	idx = load_bytes(sf, bytes);
+	EXPECT_TRUE(idx != NULL);
+	struct_index_free(idx);
+
+	/* more entries than the records make: nothing is allocated for them */
+	bad = bytes;
+	struct_pack(&bad[header - 8], "!Q", (uint64_t)1 << 60);
+	EXPECT_TRUE(load_bytes(sf, bad) == NULL);
+	bad = bytes;
+	struct_pack(&bad[header - 16], "!Q", (uint64_t)50);
+	EXPECT_TRUE(load_bytes(sf, bad) == NULL);
+
+	/* entries missing from the file */
+	bad = bytes;
+	bad.resize(n - 1);
+	EXPECT_TRUE(load_bytes(sf, bad) == NULL);
+
+	/* offsets which do not increase */
+	bad = bytes;
+	memcpy(&bad[header + 2 * entry], &bad[header + entry], 8);
+	EXPECT_TRUE(load_bytes(sf, bad) == NULL);
+	bad = bytes;
+	struct_pack(&bad[header], "!Q", (uint64_t)1);
+	EXPECT_TRUE(load_bytes(sf, bad) == NULL);
+	bad = bytes;
+	struct_pack(&bad[header + 6 * entry], "!Q", (uint64_t)-1);
+	EXPECT_TRUE(load_bytes(sf, bad) == NULL);
+
+	close(idx_fd);
+	close(fd);
+	struct_format_free(sf);
+}
+
+TEST(StructSearch, Invalid)
+{
+	struct_format *sf = struct_compile("!vV8s");
+	Record probe;
+	int fd = temp_file();
+
+	ASSERT_TRUE(sf != NULL);
+	memset(&probe, 0, sizeof(probe));
+	EXPECT_EQ(-1, struct_search_fixed(sf, 0, fd, &probe, NULL));
+	EXPECT_TRUE(struct_index_build(sf, 0, fd, 0) == NULL);
+	EXPECT_TRUE(struct_index_build(sf, 5, fd, 4) == NULL);
+
+	/* a truncated record */
+	ASSERT_EQ(1, write(fd, "\x80", 1));
+	EXPECT_TRUE(struct_index_build(sf, 0, fd, 4) == NULL);
+	close(fd);
+	struct_format_free(sf);
+}
+
+} // namespace
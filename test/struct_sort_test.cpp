@@ -0,0 +1,193 @@
+/*
+ * struct_sort_test.cpp
+ *
+ * radix sort of packed records
+ */
+
+#include "struct_sort.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Trade {
+	uint64_t id;
+	double price;
+	int16_t qty;
+	char sym[12];
+};
+
+static std::vector<Trade> make_trades(int n)
+{
+	std::vector<Trade> trades(n);
+	unsigned int seed = 1;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		trades[i].id = i;
+		trades[i].price = ((int)(seed >> 8) % 20001 - 10000) / 8.0;
+		trades[i].qty = (int16_t)(seed >> 4);
+		snprintf(trades[i].sym, sizeof(trades[i].sym), "S%010u",
+				(seed >> 3) % 997 * 1000003U);
+	}
+	return trades;
+}
+
+static unsigned char *pack_trades(struct_format *sf,
+		const std::vector<Trade> &trades)
+{
+	int size = struct_format_calcsize(sf);
+	unsigned char *buf = (unsigned char *)malloc(trades.size() * size);
+	size_t i;
+
+	for (i = 0; i < trades.size(); i++) {
+		struct_format_pack_record(sf, buf + i * size, &trades[i]);
+	}
+	return buf;
+}
+
+static std::vector<Trade> unpack_trades(struct_format *sf,
+		const unsigned char *buf, size_t n)
+{
+	int size = struct_format_calcsize(sf);
+	std::vector<Trade> trades(n);
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		struct_format_unpack_record(sf, buf + i * size, &trades[i]);
+	}
+	return trades;
+}
+
+static bool by_price(const Trade &a, const Trade &b)
+{
+	return a.price < b.price;
+}
+
+static bool by_qty(const Trade &a, const Trade &b)
+{
+	return a.qty < b.qty;
+}
+
+static bool by_sym(const Trade &a, const Trade &b)
+{
+	return memcmp(a.sym, b.sym, sizeof(a.sym)) < 0;
+}
+
+static void check_sort(const char *fmt, int key,
+		bool (*less)(const Trade &, const Trade &), int nthreads)
+{
+	struct_format *sf = struct_compile(fmt);
+	std::vector<Trade> trades = make_trades(5000);
+	std::vector<Trade> sorted;
+	unsigned char *buf;
+	size_t i;
+
+	ASSERT_TRUE(sf != NULL);
+	buf = pack_trades(sf, trades);
+	ASSERT_EQ(0, struct_sort_packed(sf, buf, trades.size(), key, nthreads));
+	sorted = unpack_trades(sf, buf, trades.size());
+
+	/* stable: equal keys keep the order of their ids */
+	std::stable_sort(trades.begin(), trades.end(), less);
+	for (i = 0; i < trades.size(); i++) {
+		ASSERT_EQ(trades[i].id, sorted[i].id) << fmt << " at " << i;
+	}
+	free(buf);
+	struct_format_free(sf);
+}
+
+struct Order {
+	uint64_t id;
+	int16_t qty;
+};
+
+static void check_narrow(const char *fmt, int nthreads)
+{
+	struct_format *sf = struct_compile(fmt);
+	std::vector<Trade> trades = make_trades(5000);
+	std::vector<Order> orders(trades.size());
+	unsigned char *buf;
+	Order order;
+	int prev = -32768;
+	size_t i;
+
+	ASSERT_TRUE(sf != NULL);
+	buf = (unsigned char *)malloc(orders.size() * 10);
+	for (i = 0; i < orders.size(); i++) {
+		orders[i].id = trades[i].id;
+		orders[i].qty = trades[i].qty;
+		struct_format_pack_record(sf, buf + i * 10, &orders[i]);
+	}
+	ASSERT_EQ(0, struct_sort_packed(sf, buf, orders.size(), 1, nthreads));
+
+	std::stable_sort(trades.begin(), trades.end(), by_qty);
+	for (i = 0; i < orders.size(); i++) {
+		struct_format_unpack_record(sf, buf + i * 10, &order);
+		ASSERT_EQ(trades[i].id, order.id) << fmt << " at " << i;
+		ASSERT_LE(prev, order.qty);
+		prev = order.qty;
+	}
+	free(buf);
+	struct_format_free(sf);
+}
+
+TEST(StructSort, NarrowRecords)
+{
+	/* 10 bytes, sorted record by record */
+	check_narrow("<Qh", 1);
+	check_narrow("!Qh", 1);
+	check_narrow("^Qh", 1);
+}
+
+TEST(StructSort, WideRecords)
+{
+	/* 30 bytes, sorted as (key, index) items */
+	check_sort("<Qdh12s", 1, by_price, 1);
+	check_sort("!Qdh12s", 2, by_qty, 1);
+	check_sort("=Qdh12s", 3, by_sym, 1);
+	check_sort("^Qdh12s", 1, by_price, 1);
+	check_sort("^Qdh12s", 2, by_qty, 1);
+}
+
+TEST(StructSort, Parallel)
+{
+	check_narrow("<Qh", 4);
+	check_sort("!Qdh12s", 1, by_price, 3);
+	check_sort("<Qdh12s", 3, by_sym, 8);
+}
+
+TEST(StructSort, FewRecordsAndInvalid)
+{
+	struct_format *sf = struct_compile("!Id");
+	struct_format *var = struct_compile("!IV");
+	unsigned char buf[24];
+	uint32_t i;
+	double d;
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_TRUE(var != NULL);
+	EXPECT_EQ(0, struct_sort_packed(sf, buf, 0, 0, 1));
+	struct_format_pack(sf, buf, 5, 0.5);
+	EXPECT_EQ(0, struct_sort_packed(sf, buf, 1, 1, 1));
+	struct_format_pack(sf, buf + 12, 4, -0.5);
+	EXPECT_EQ(0, struct_sort_packed(sf, buf, 2, 1, 16));
+	struct_format_unpack(sf, buf, &i, &d);
+	EXPECT_EQ(4U, i);
+	EXPECT_EQ(-0.5, d);
+
+	EXPECT_EQ(-1, struct_sort_packed(sf, buf, 2, 2, 1));
+	EXPECT_EQ(-1, struct_sort_packed(sf, buf, 2, 0, 0));
+	EXPECT_EQ(-1, struct_sort_packed(var, buf, 2, 0, 1));
+	struct_format_free(var);
+	struct_format_free(sf);
+}
+
+} // namespace
@@ -9,11 +9,13 @@
 #include "gtest/gtest.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
 #include <limits>
 #include <math.h>
+#include <errno.h>
 
 namespace {
 
@@ -1404,6 +1406,1055 @@ TEST_F(Struct, varint_MultiPackUnpackingValid)
 	EXPECT_EQ(i2, o2);
 }
 
+TEST_F(Struct, StringUnpackViewValid)
+{
+	char str[32];
+	char fmt[32];
+	const char *view = NULL;
+	int32_t i = 0x12345678;
+	int32_t o;
+
+	memset(str, 0, sizeof(str));
+	memset(fmt, 0, sizeof(fmt));
+	strcpy(str, "test0");
+	sprintf(fmt, "i%dsi", (int)strlen(str));
+
+	struct_pack(buf, fmt, i, str, i);
+	EXPECT_EQ(struct_calcsize(fmt),
+		struct_unpack_view(buf, fmt, &o, &view, &o));
+	EXPECT_EQ((const char *)buf + sizeof(int32_t), view);
+	EXPECT_EQ(0, memcmp(str, view, strlen(str)));
+	EXPECT_EQ(i, o);
+}
+
+TEST_F(Struct, StringUnpackViewWithOffsetValid)
+{
+	const char *view1 = NULL;
+	const char *view2 = NULL;
+
+	struct_pack_into(1, buf, "4s2p", "test", "ab");
+	EXPECT_EQ(1 + 6, struct_unpack_view_from(1, buf, "4s2p", &view1, &view2));
+	EXPECT_EQ((const char *)buf + 1, view1);
+	EXPECT_EQ((const char *)buf + 5, view2);
+	EXPECT_EQ(0, memcmp("test", view1, 4));
+	EXPECT_EQ(0, memcmp("ab", view2, 2));
+}
+
+TEST_F(Struct, DecoderByteByByteValid)
+{
+	int16_t h = -1234, oh = 0;
+	uint64_t V = 0x1234567887654321LL, oV = 0;
+	double d = 3.141592, od = 0;
+	char str[] = "test", ostr[8] = {0, };
+	int len = struct_pack(buf, "!h4sVxd", h, str, V, d);
+	struct_decoder *dec = struct_decoder_new("!h4sVxd", &oh, ostr, &oV, &od);
+	int i;
+
+	ASSERT_TRUE(dec != NULL);
+	EXPECT_EQ(2 + 4 + 1 + 1 + 8, struct_decoder_needed(dec));
+	for (i = 0; i < len; i++) {
+		EXPECT_LT(0, struct_decoder_needed(dec));
+		EXPECT_EQ(1, struct_decoder_feed(dec, buf + i, 1));
+	}
+	EXPECT_EQ(0, struct_decoder_needed(dec));
+	EXPECT_EQ(0, struct_decoder_feed(dec, buf, len));
+	EXPECT_EQ(h, oh);
+	EXPECT_STREQ(str, ostr);
+	EXPECT_EQ(V, oV);
+	EXPECT_DOUBLE_EQ(d, od);
+	struct_decoder_free(dec);
+}
+
+TEST_F(Struct, DecoderNeededValid)
+{
+	int32_t i = 0x12345678, oi = 0;
+	int64_t v = -18014398573270210LL, ov = 0;
+	struct_decoder *dec = struct_decoder_new("<iv", &oi, &ov);
+	int len = struct_pack(buf, "<iv", i, v);
+
+	ASSERT_TRUE(dec != NULL);
+	EXPECT_EQ(3, struct_decoder_feed(dec, buf, 3));
+	EXPECT_EQ(1 + 1, struct_decoder_needed(dec));
+	EXPECT_EQ(3, struct_decoder_feed(dec, buf + 3, 3));
+	EXPECT_EQ(i, oi);
+	EXPECT_EQ(1, struct_decoder_needed(dec));
+	EXPECT_EQ(len - 6, struct_decoder_feed(dec, buf + 6, sizeof(buf) - 6));
+	EXPECT_EQ(0, struct_decoder_needed(dec));
+	EXPECT_EQ(v, ov);
+	struct_decoder_free(dec);
+}
+
+TEST_F(Struct, DecoderResetValid)
+{
+	uint16_t o1 = 0, o2 = 0;
+	struct_decoder *dec = struct_decoder_new(">H", &o1);
+	int len = struct_pack(buf, ">2H", 0x1234, 0x5678);
+
+	ASSERT_TRUE(dec != NULL);
+	EXPECT_EQ(2, struct_decoder_feed(dec, buf, len));
+	o2 = o1;
+	struct_decoder_reset(dec);
+	EXPECT_EQ(2, struct_decoder_feed(dec, buf + 2, len - 2));
+	EXPECT_EQ(0x1234, o2);
+	EXPECT_EQ(0x5678, o1);
+	struct_decoder_free(dec);
+}
+
+TEST_F(Struct, DecoderNullSkipsValid)
+{
+	int16_t oh = 0;
+	double od = 0;
+	int len = struct_pack(buf, "!h4sViVd", -7, "abcd", (uint64_t)1 << 40,
+			5, (uint64_t)300, 2.5);
+	struct_decoder *dec = struct_decoder_new("!h4sViVd", NULL, NULL, NULL,
+			NULL, NULL, &od);
+	int i;
+
+	ASSERT_TRUE(dec != NULL);
+	for (i = 0; i < len; i++) {
+		EXPECT_EQ(1, struct_decoder_feed(dec, buf + i, 1));
+	}
+	EXPECT_EQ(0, struct_decoder_needed(dec));
+	EXPECT_DOUBLE_EQ(2.5, od);
+	struct_decoder_free(dec);
+
+	od = 0;
+	dec = struct_decoder_new("!h4sViVd", &oh, NULL, NULL, NULL, NULL, &od);
+	ASSERT_TRUE(dec != NULL);
+	EXPECT_EQ(len, struct_decoder_feed(dec, buf, len));
+	EXPECT_EQ(-7, oh);
+	EXPECT_DOUBLE_EQ(2.5, od);
+	struct_decoder_free(dec);
+}
+
+TEST_F(Struct, DecoderInvalidFormat)
+{
+	int32_t o;
+	EXPECT_TRUE(struct_decoder_new("iy", &o) == NULL);
+}
+
+TEST_F(Struct, PackerWindowsValid)
+{
+	unsigned char whole[64];
+	unsigned char window[3];
+	char str[] = "test";
+	int len = struct_pack(whole, "!bh4sVxdv", sc, 0x1234, str,
+			(uint64_t)0x1234567887654321LL, 3.141592,
+			(int64_t)-18014398573270210LL);
+	struct_packer *pk = struct_packer_new("!bh4sVxdv", sc, 0x1234, str,
+			(uint64_t)0x1234567887654321LL, 3.141592,
+			(int64_t)-18014398573270210LL);
+	int off = 0;
+	int n;
+
+	ASSERT_TRUE(pk != NULL);
+	EXPECT_EQ(len, struct_packer_remaining(pk));
+	while (struct_packer_remaining(pk) > 0) {
+		n = struct_packer_pack(pk, window, sizeof(window));
+		memcpy(buf + off, window, n);
+		off += n;
+		EXPECT_EQ(len - off, struct_packer_remaining(pk));
+	}
+	EXPECT_EQ(len, off);
+	EXPECT_EQ(0, memcmp(whole, buf, len));
+	EXPECT_EQ(0, struct_packer_pack(pk, window, sizeof(window)));
+	struct_packer_free(pk);
+}
+
+TEST_F(Struct, PackerResetValid)
+{
+	int32_t o1 = 0, o2 = 0;
+	struct_packer *pk = struct_packer_new("<i", 0x12345678);
+
+	ASSERT_TRUE(pk != NULL);
+	EXPECT_EQ(4, struct_packer_pack(pk, buf, sizeof(buf)));
+	struct_packer_reset(pk);
+	EXPECT_EQ(4, struct_packer_pack(pk, buf + 4, sizeof(buf) - 4));
+	struct_unpack(buf, "<2i", &o1, &o2);
+	EXPECT_EQ(0x12345678, o1);
+	EXPECT_EQ(0x12345678, o2);
+	struct_packer_free(pk);
+}
+
+TEST_F(Struct, PackerInvalidFormat)
+{
+	EXPECT_TRUE(struct_packer_new("iy", 1) == NULL);
+}
+
+struct CompiledRecord {
+	int16_t h;
+	uint64_t V;
+	char s[4];
+	double d;
+	unsigned char B;
+};
+
+TEST_F(Struct, CompiledRecordSizeValid)
+{
+	struct_format *sf = struct_compile("!hV4sxdB");
+
+	ASSERT_TRUE(sf != NULL);
+	EXPECT_EQ((int)sizeof(CompiledRecord), struct_format_record_size(sf));
+	EXPECT_EQ(struct_calcsize("!hV4sxdB"), struct_format_calcsize(sf));
+	EXPECT_EQ(5, struct_format_nfields(sf));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, CompiledPackUnpackValid)
+{
+	unsigned char expected[64];
+	struct_format *sf = struct_compile(">2hVx3sd");
+	int16_t h1 = -1234, h2 = 0x1234, oh1, oh2;
+	uint64_t V = 0x1234567887654321LL, oV;
+	double d = 3.141592, od;
+	char ostr[4] = {0, };
+	int len = struct_pack(expected, ">2hVx3sd", h1, h2, V, "abc", d);
+
+	ASSERT_TRUE(sf != NULL);
+	EXPECT_EQ(len, struct_format_pack(sf, buf, h1, h2, V, "abc", d));
+	EXPECT_EQ(0, memcmp(expected, buf, len));
+	EXPECT_EQ(len, struct_format_unpack(sf, buf, &oh1, &oh2, &oV, ostr, &od));
+	EXPECT_EQ(h1, oh1);
+	EXPECT_EQ(h2, oh2);
+	EXPECT_EQ(V, oV);
+	EXPECT_STREQ("abc", ostr);
+	EXPECT_DOUBLE_EQ(d, od);
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, CompiledRecordPackUnpackValid)
+{
+	unsigned char expected[64];
+	CompiledRecord rec = {-1234, 0x1234567887654321LL, {'t', 'e', 's', 't'},
+		3.141592, 200};
+	CompiledRecord orec;
+	struct_format *sf = struct_compile("!hV4sxdB");
+	int len = struct_pack(expected, "!hV4sxdB", rec.h, rec.V, rec.s, rec.d,
+			rec.B);
+
+	ASSERT_TRUE(sf != NULL);
+	memset(&orec, 0, sizeof(orec));
+	EXPECT_EQ(len, struct_format_pack_record(sf, buf, &rec));
+	EXPECT_EQ(0, memcmp(expected, buf, len));
+	EXPECT_EQ(len, struct_format_unpack_record(sf, buf, &orec));
+	EXPECT_EQ(rec.h, orec.h);
+	EXPECT_EQ(rec.V, orec.V);
+	EXPECT_EQ(0, memcmp(rec.s, orec.s, sizeof(rec.s)));
+	EXPECT_DOUBLE_EQ(rec.d, orec.d);
+	EXPECT_EQ(rec.B, orec.B);
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, CompiledCalcsizeRecordValid)
+{
+	CompiledRecord rec = {-1234, 0x1234567887654321LL, {'t', 'e', 's', 't'},
+		3.141592, 200};
+	struct_format *fixed = struct_compile("!h4sxdB");
+	struct_format *varint = struct_compile("!hV4sxdB");
+
+	ASSERT_TRUE(fixed != NULL);
+	ASSERT_TRUE(varint != NULL);
+	EXPECT_EQ(1, struct_format_is_fixed(fixed));
+	EXPECT_EQ(0, struct_format_is_fixed(varint));
+	EXPECT_EQ(struct_format_pack_record(varint, buf, &rec),
+		struct_format_calcsize_record(varint, &rec));
+	rec.V = 1;
+	EXPECT_EQ(struct_format_pack_record(varint, buf, &rec),
+		struct_format_calcsize_record(varint, &rec));
+	struct_format_free(fixed);
+	struct_format_free(varint);
+}
+
+TEST_F(Struct, CompiledLengthValid)
+{
+	struct_format *sf = struct_compile("!hV4s");
+	int len = struct_pack(buf, "!hV4s", 1, (uint64_t)0x1234567887654321LL,
+			"test");
+
+	ASSERT_TRUE(sf != NULL);
+	EXPECT_EQ(len, struct_format_length(sf, buf, len));
+	EXPECT_EQ(len, struct_format_length(sf, buf, sizeof(buf)));
+	EXPECT_EQ(-1, struct_format_length(sf, buf, len - 1));
+	EXPECT_EQ(-1, struct_format_length(sf, buf, 5));
+	memset(buf + 2, 0x80, 10);
+	EXPECT_EQ(-1, struct_format_length(sf, buf, sizeof(buf)));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, CompileInvalidFormat)
+{
+	EXPECT_TRUE(struct_compile("iy") == NULL);
+}
+
+TEST_F(Struct, OptionalFieldsValid)
+{
+	uint32_t id = 0;
+	char name[16];
+	double price = 0;
+	int has_name = -1, has_price = -1;
+
+	EXPECT_EQ(1 + 4 + 16 + 8, struct_calcsize("!I?16s?d"));
+
+	/* 1 byte of bitmap, id, price */
+	EXPECT_EQ(1 + 4 + 8, struct_pack(buf, "!I?16s?d", 7, 0, "", 1, 2.5));
+	EXPECT_EQ(0x02, buf[0]);
+
+	memset(name, 'z', sizeof(name));
+	EXPECT_EQ(1 + 4 + 8, struct_unpack(buf, "!I?16s?d", &id, &has_name,
+				name, &has_price, &price));
+	EXPECT_EQ(7U, id);
+	EXPECT_EQ(0, has_name);
+	EXPECT_EQ('z', name[0]);
+	EXPECT_EQ(1, has_price);
+	EXPECT_DOUBLE_EQ(2.5, price);
+
+	/* all present */
+	EXPECT_EQ(1 + 4 + 16 + 8, struct_pack(buf, "!I?16s?d", 7, 1,
+				"0123456789abcdef", 1, 2.5));
+	EXPECT_EQ(0x03, buf[0]);
+	EXPECT_EQ(1 + 4 + 16 + 8, struct_unpack(buf, "!I?16s?d", &id, NULL,
+				name, NULL, &price));
+	EXPECT_EQ(0, memcmp(name, "0123456789abcdef", 16));
+}
+
+TEST_F(Struct, OptionalRepeatedAndVarintValid)
+{
+	int16_t h[3] = {0, 0, 0};
+	uint64_t V = 0;
+	int64_t q = 0;
+	int has_h, has_V, has_q;
+	int i;
+
+	EXPECT_EQ(1 + 6 + 10 + 8, struct_calcsize("<?3h?V?q"));
+	EXPECT_EQ(2 + 9, struct_calcsize("?b?b?b?b?b?b?b?b?b"));
+	EXPECT_EQ(-1, struct_pack(buf, "<??V", 1, 1, (uint64_t)1));
+
+	EXPECT_EQ(1 + 2 + 6, struct_pack(buf, "<?3h?V?q", 1, -1, 2, -3, 1,
+				(uint64_t)300, 0, (int64_t)5));
+	EXPECT_EQ(0x03, buf[0]);
+	q = 42;
+	EXPECT_EQ(1 + 2 + 6, struct_unpack(buf, "<?3h?V?q", &has_h, &h[0],
+				&h[1], &h[2], &has_V, &V, &has_q, &q));
+	EXPECT_EQ(1, has_h);
+	EXPECT_EQ(-1, h[0]);
+	EXPECT_EQ(2, h[1]);
+	EXPECT_EQ(-3, h[2]);
+	EXPECT_EQ(1, has_V);
+	EXPECT_EQ(300U, V);
+	EXPECT_EQ(0, has_q);
+	EXPECT_EQ(42, q);
+
+	/* more than 8 optional fields */
+	for (i = 0; i < 10; i++) {
+		buf[i] = 0xFF;
+	}
+	EXPECT_EQ(2 + 1, struct_pack(buf, "?b?b?b?b?b?b?b?b?b", 0, 1, 0, 2, 0, 3,
+				0, 4, 0, 5, 0, 6, 0, 7, 0, 8, 1, 9));
+	EXPECT_EQ(0x00, buf[0]);
+	EXPECT_EQ(0x01, buf[1]);
+	EXPECT_EQ(9, buf[2]);
+}
+
+TEST_F(Struct, OptionalRejectedByCompile)
+{
+	EXPECT_TRUE(struct_compile("!I?d") == NULL);
+}
+
+TEST_F(Struct, DiffPatchFixedValid)
+{
+	struct_format *sf = struct_compile("!i2hx4sd");
+	unsigned char from[32], to[32], patch[64];
+	int len, plen;
+
+	ASSERT_TRUE(sf != NULL);
+	len = struct_pack(from, "!i2hx4sd", 1, 2, 3, "abcd", 1.5);
+	struct_pack(to, "!i2hx4sd", 1, 2, 4, "abcd", 2.5);
+
+	/* 5 fields: bitmap, then the second 'h' and 'd' */
+	plen = struct_format_diff(sf, from, to, patch);
+	EXPECT_EQ(1 + 2 + 8, plen);
+	EXPECT_EQ(0x04 | 0x10, patch[0]);
+	EXPECT_EQ(len, struct_format_patch(sf, from, len, patch, plen));
+	EXPECT_EQ(0, memcmp(from, to, len));
+
+	/* no change */
+	EXPECT_EQ(1, struct_format_diff(sf, from, to, patch));
+	EXPECT_EQ(0, patch[0]);
+	EXPECT_EQ(len, struct_format_patch(sf, from, len, patch, 1));
+	EXPECT_EQ(0, memcmp(from, to, len));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, DiffPatchVarintValid)
+{
+	struct_format *sf = struct_compile("<VvI9B");
+	unsigned char from[64], to[64], patch[64];
+	int flen, tlen, plen;
+
+	ASSERT_TRUE(sf != NULL);
+	flen = struct_pack(from, "<VvI9B", (uint64_t)1, (int64_t)-1, 7,
+			1, 2, 3, 4, 5, 6, 7, 8, 9);
+	tlen = struct_pack(to, "<VvI9B", (uint64_t)1 << 50, (int64_t)-1, 7,
+			1, 2, 3, 4, 5, 6, 7, 8, 10);
+
+	/* 12 fields: 2 bytes of bitmap */
+	plen = struct_format_diff(sf, from, to, patch);
+	EXPECT_EQ(2 + 8 + 1, plen);
+	EXPECT_EQ(0x01, patch[0]);
+	EXPECT_EQ(0x08, patch[1]);
+
+	/* the varint grows: the rest of the message moves */
+	EXPECT_EQ(-1, struct_format_patch(sf, from, tlen - 1, patch, plen));
+	EXPECT_EQ(0, memcmp(from + 1, "\x01", 1));
+	EXPECT_EQ(tlen, struct_format_patch(sf, from, sizeof(from), patch, plen));
+	EXPECT_EQ(0, memcmp(from, to, tlen));
+
+	/* and shrinks back */
+	flen = struct_pack(to, "<VvI9B", (uint64_t)1, (int64_t)-1, 7,
+			1, 2, 3, 4, 5, 6, 7, 8, 9);
+	plen = struct_format_diff(sf, from, to, patch);
+	EXPECT_EQ(flen, struct_format_patch(sf, from, sizeof(from), patch, plen));
+	EXPECT_EQ(0, memcmp(from, to, flen));
+
+	EXPECT_EQ(-1, struct_format_patch(sf, from, flen - 1, patch, plen));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, DiffPatchVarintsGrowAndShrinkValid)
+{
+	struct_format *sf = struct_compile("<VVvV");
+	uint64_t small = 1, big = (uint64_t)1 << 50;
+	unsigned char from[64], to[64], patch[64];
+	unsigned char *rec;
+	int flen, tlen, plen;
+
+	ASSERT_TRUE(sf != NULL);
+
+	/* an earlier varint grows before later ones shrink */
+	flen = struct_pack(from, "<VVvV", small, big, (int64_t)-(1LL << 40),
+			big);
+	tlen = struct_pack(to, "<VVvV", big, small, (int64_t)-1, big);
+	ASSERT_LT(tlen, flen);
+	plen = struct_format_diff(sf, from, to, patch);
+
+	/* exactly the room of the message: any overrun is caught by ASan */
+	rec = (unsigned char *)malloc(flen);
+	memcpy(rec, from, flen);
+	EXPECT_EQ(tlen, struct_format_patch(sf, rec, flen, patch, plen));
+	EXPECT_EQ(0, memcmp(rec, to, tlen));
+	free(rec);
+
+	/* and back, the message growing to exactly its buffer */
+	plen = struct_format_diff(sf, to, from, patch);
+	rec = (unsigned char *)malloc(flen);
+	memcpy(rec, to, tlen);
+	EXPECT_EQ(-1, struct_format_patch(sf, rec, flen - 1, patch, plen));
+	EXPECT_EQ(0, memcmp(rec, to, tlen));
+	EXPECT_EQ(flen, struct_format_patch(sf, rec, flen, patch, plen));
+	EXPECT_EQ(0, memcmp(rec, from, flen));
+	free(rec);
+
+	/* the case of the report: "<VV" from (1, 1 << 50) to (1 << 50, 1) */
+	struct_format_free(sf);
+	sf = struct_compile("<VV");
+	ASSERT_TRUE(sf != NULL);
+	flen = struct_pack(from, "<VV", small, big);
+	tlen = struct_pack(to, "<VV", big, small);
+	ASSERT_EQ(9, flen);
+	plen = struct_format_diff(sf, from, to, patch);
+	rec = (unsigned char *)malloc(flen);
+	memcpy(rec, from, flen);
+	EXPECT_EQ(tlen, struct_format_patch(sf, rec, flen, patch, plen));
+	EXPECT_EQ(0, memcmp(rec, to, tlen));
+	free(rec);
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, PatchTruncatedInvalid)
+{
+	struct_format *sf = struct_compile("<IVd");
+	unsigned char from[32], to[32], rec[32], patch[32];
+	int flen, plen;
+
+	ASSERT_TRUE(sf != NULL);
+	flen = struct_pack(from, "<IVd", 1, (uint64_t)1, 1.5);
+	struct_pack(to, "<IVd", 2, (uint64_t)1 << 40, 2.5);
+	plen = struct_format_diff(sf, from, to, patch);
+	ASSERT_EQ(1 + 4 + 6 + 8, plen);
+
+	/* every cut of the patch is rejected, the message left unchanged */
+	for (int n = 0; n < plen; n++) {
+		memcpy(rec, from, flen);
+		EXPECT_EQ(-1, struct_format_patch(sf, rec, sizeof(rec), patch, n));
+		EXPECT_EQ(0, memcmp(rec, from, flen));
+	}
+	EXPECT_EQ(-1, struct_format_patch(sf, rec, sizeof(rec), patch, -1));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, PatchUnterminatedVarintInvalid)
+{
+	struct_format *sf = struct_compile("<V");
+	unsigned char from[16], rec[16], patch[32];
+	int flen;
+
+	ASSERT_TRUE(sf != NULL);
+	flen = struct_pack(from, "<V", (uint64_t)1);
+	patch[0] = 0x01;
+	memset(patch + 1, 0x80, sizeof(patch) - 1);
+
+	memcpy(rec, from, flen);
+	EXPECT_EQ(-1, struct_format_patch(sf, rec, sizeof(rec), patch,
+			sizeof(patch)));
+	EXPECT_EQ(0, memcmp(rec, from, flen));
+
+	/* a terminator past the tenth byte is too late */
+	patch[11] = 0x01;
+	EXPECT_EQ(-1, struct_format_patch(sf, rec, sizeof(rec), patch,
+			sizeof(patch)));
+	patch[10] = 0x01;
+	EXPECT_EQ(10, struct_format_patch(sf, rec, sizeof(rec), patch,
+			sizeof(patch)));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, TranscodeVarintToFixedValid)
+{
+	unsigned char src[64];
+	unsigned char expected[64];
+	unsigned char dst[64];
+	int slen = 0;
+	int dlen = 0;
+
+	slen += struct_pack(src + slen, "!VVqd", (uint64_t)1,
+			(uint64_t)0x123456789ULL, (int64_t)-5, 2.5);
+	slen += struct_pack(src + slen, "!VVqd", (uint64_t)300, (uint64_t)0,
+			(int64_t)7, -0.5);
+	dlen += struct_pack(expected + dlen, "<QQqd", (uint64_t)1,
+			(uint64_t)0x123456789ULL, (int64_t)-5, 2.5);
+	dlen += struct_pack(expected + dlen, "<QQqd", (uint64_t)300,
+			(uint64_t)0, (int64_t)7, -0.5);
+
+	errno = 0;
+	EXPECT_EQ(dlen, struct_transcode("!VVqd", "<QQqd", src, dst, 2));
+	EXPECT_EQ(0, memcmp(expected, dst, dlen));
+	EXPECT_EQ(0, errno);
+
+	/* and back */
+	EXPECT_EQ(slen, struct_transcode("<QQqd", "!VVqd", dst, buf, 2));
+	EXPECT_EQ(0, memcmp(src, buf, slen));
+}
+
+TEST_F(Struct, TranscodeShuffleValid)
+{
+	unsigned char src[64];
+	unsigned char expected[64];
+	unsigned char dst[64];
+	int len;
+
+	len = struct_pack(src, "<hI3sxdf", -2, 0x01020304, "abc", 1.5,
+			(float)-2.25);
+	struct_pack(src + len, "<hI3sxdf", 7, 9, "xyz", 0.0, (float)1.0);
+	len = struct_pack(expected, ">2xhI3sdf", -2, 0x01020304, "abc", 1.5,
+			(float)-2.25);
+	struct_pack(expected + len, ">2xhI3sdf", 7, 9, "xyz", 0.0,
+			(float)1.0);
+
+	EXPECT_EQ(2 * len, struct_transcode("<hI3sxdf", ">2xhI3sdf", src, dst,
+				2));
+	EXPECT_EQ(0, memcmp(expected, dst, 2 * len));
+}
+
+TEST_F(Struct, TranscodeWidenNarrowValid)
+{
+	unsigned char src[64];
+	int8_t b;
+	uint8_t B;
+	int16_t h;
+	int64_t q;
+	int32_t i;
+	float f;
+	char s[6];
+
+	struct_pack(src, "<bHd4s", -100, 60000, 0.25, "abcd");
+	errno = 0;
+	EXPECT_EQ(8 + 4 + 4 + 6, struct_transcode("<bHd4s", ">qif6s", src, buf,
+				1));
+	EXPECT_EQ(0, errno);
+	struct_unpack(buf, ">qif6s", &q, &i, &f, s);
+	EXPECT_EQ(-100, q);
+	EXPECT_EQ(60000, i);
+	EXPECT_FLOAT_EQ(0.25f, f);
+	EXPECT_EQ(0, memcmp(s, "abcd\0\0", 6));
+
+	struct_pack(src, ">qiv", (int64_t)-128, 200, (int64_t)-300);
+	errno = 0;
+	EXPECT_EQ(4, struct_transcode(">qiv", "<bBh", src, buf, 1));
+	EXPECT_EQ(0, errno);
+	struct_unpack(buf, "<bBh", &b, &B, &h);
+	EXPECT_EQ(-128, b);
+	EXPECT_EQ(200, B);
+	EXPECT_EQ(-300, h);
+}
+
+TEST_F(Struct, TranscodeOverflow)
+{
+	unsigned char src[64];
+	unsigned char dst[64];
+
+	struct_pack(src, "!qd", (int64_t)-1, 1e300);
+	errno = 0;
+	EXPECT_EQ(1, struct_transcode("!q", "!B", src, dst, 1));
+	EXPECT_EQ(ERANGE, errno);
+
+	errno = 0;
+	EXPECT_EQ(4, struct_transcode("!xxxxxxxxd", "!f", src, dst, 1));
+	EXPECT_EQ(ERANGE, errno);
+
+	struct_pack(src, "!Q", (uint64_t)1 << 63);
+	errno = 0;
+	EXPECT_EQ(10, struct_transcode("!Q", "!v", src, dst, 1));
+	EXPECT_EQ(ERANGE, errno);
+	errno = 0;
+	EXPECT_EQ(10, struct_transcode("!Q", "!V", src, dst, 1));
+	EXPECT_EQ(0, errno);
+}
+
+TEST_F(Struct, TranscodeInvalidFormat)
+{
+	EXPECT_EQ(-1, struct_transcode("ii", "i", buf, buf, 1));
+	EXPECT_EQ(-1, struct_transcode("i", "d", buf, buf, 1));
+	EXPECT_EQ(-1, struct_transcode("4s", "i", buf, buf, 1));
+	EXPECT_EQ(-1, struct_transcode("iy", "ii", buf, buf, 1));
+}
+
+TEST_F(Struct, OrderedIntegers)
+{
+	const int64_t vals[] = {
+		std::numeric_limits<int64_t>::min(), -70000, -1, 0, 1, 300,
+		std::numeric_limits<int64_t>::max()
+	};
+	unsigned char prev[16];
+	unsigned char cur[16];
+	int64_t q;
+	int32_t i;
+	int16_t h;
+	char b;
+	size_t n;
+
+	struct_pack(buf, "^b", -1);
+	EXPECT_EQ(0x7f, buf[0]);
+	struct_pack(buf, "^h", 1);
+	EXPECT_EQ(0, memcmp(buf, "\x80\x01", 2));
+	struct_pack(buf, "^I", 1);
+	EXPECT_EQ(0, memcmp(buf, "\x00\x00\x00\x01", 4));
+
+	for (n = 0; n < sizeof(vals) / sizeof(vals[0]); n++) {
+		ASSERT_EQ(8, struct_pack(cur, "^q", vals[n]));
+		if (n > 0) {
+			EXPECT_LT(memcmp(prev, cur, 8), 0);
+		}
+		memcpy(prev, cur, 8);
+		struct_unpack(cur, "^q", &q);
+		EXPECT_EQ(vals[n], q);
+	}
+
+	struct_pack(buf, "^bhi", -5, -300, -70000);
+	struct_unpack(buf, "^bhi", &b, &h, &i);
+	EXPECT_EQ(-5, b);
+	EXPECT_EQ(-300, h);
+	EXPECT_EQ(-70000, i);
+	struct_pack(prev, "^bhi", -5, -300, -70000);
+	struct_pack(cur, "^bhi", -5, -299, -80000);
+	EXPECT_LT(memcmp(prev, cur, 7), 0);
+}
+
+TEST_F(Struct, OrderedFloats)
+{
+	const double vals[] = {
+		-std::numeric_limits<double>::infinity(), -1e300, -2.5, -1e-300,
+		0.0, 1e-300, 1.0, 2.5, std::numeric_limits<double>::infinity()
+	};
+	unsigned char prev[16];
+	unsigned char cur[16];
+	double d;
+	float f;
+	size_t n;
+
+	for (n = 0; n < sizeof(vals) / sizeof(vals[0]); n++) {
+		struct_pack(cur, "^d", vals[n]);
+		if (n > 0) {
+			EXPECT_LT(memcmp(prev, cur, 8), 0);
+		}
+		memcpy(prev, cur, 8);
+		struct_unpack(cur, "^d", &d);
+		EXPECT_EQ(vals[n], d);
+
+		struct_pack(cur + 8, "^f", (float)vals[n]);
+		struct_unpack(cur + 8, "^f", &f);
+		EXPECT_EQ((float)vals[n], f);
+	}
+
+	struct_pack(prev, "^f", -1.5f);
+	struct_pack(cur, "^f", -1.25f);
+	EXPECT_LT(memcmp(prev, cur, 4), 0);
+}
+
+TEST_F(Struct, OrderedCompiled)
+{
+	struct Key {
+		int32_t i;
+		double d;
+	} in = { -7, -0.5 }, out;
+	unsigned char other[16];
+	struct_format *sf = struct_compile("^id");
+	int i;
+	double d;
+
+	ASSERT_TRUE(sf != NULL);
+	EXPECT_EQ(12, struct_format_pack(sf, buf, -7, -0.5));
+	struct_unpack(buf, "^id", &i, &d);
+	EXPECT_EQ(-7, i);
+	EXPECT_EQ(-0.5, d);
+
+	EXPECT_EQ(12, struct_format_pack_record(sf, other, &in));
+	EXPECT_EQ(0, memcmp(buf, other, 12));
+	struct_format_unpack_record(sf, other, &out);
+	EXPECT_EQ(-7, out.i);
+	EXPECT_EQ(-0.5, out.d);
+
+	in.i = -6;
+	struct_format_pack_record(sf, other, &in);
+	EXPECT_LT(memcmp(buf, other, 12), 0);
+
+	/* ordered and plain big-endian are converted value by value */
+	EXPECT_EQ(12, struct_transcode("^id", "!id", buf, other, 1));
+	struct_unpack(other, "!id", &i, &d);
+	EXPECT_EQ(-7, i);
+	EXPECT_EQ(-0.5, d);
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, UnpackNullSkipsValid)
+{
+	const char *view = NULL;
+	int64_t v = 0;
+	double d = 0;
+	char str[4];
+	int len;
+
+	len = struct_pack(buf, "<h2iV4svd", 1, 2, 3, (uint64_t)1 << 40, "abcd",
+			(int64_t)-300, 2.5);
+	EXPECT_EQ(len, struct_unpack(buf, "<h2iV4svd", NULL, NULL, NULL, NULL,
+				NULL, &v, &d));
+	EXPECT_EQ(-300, v);
+	EXPECT_DOUBLE_EQ(2.5, d);
+	EXPECT_EQ(len, struct_unpack_view(buf, "<h2iV4svd", NULL, NULL, NULL,
+				NULL, &view, NULL, NULL));
+	EXPECT_EQ(0, memcmp(view, "abcd", 4));
+	EXPECT_EQ(len, struct_unpack(buf, "<h2iV4svd", NULL, NULL, NULL, NULL,
+				str, NULL, NULL));
+	EXPECT_EQ(0, memcmp(str, "abcd", 4));
+}
+
+TEST_F(Struct, CompiledProjectionValid)
+{
+	struct rec {
+		int16_t h;
+		uint64_t V;
+		int32_t i[2];
+		char s[4];
+		double d;
+	} in = { -2, 300, { 7, -8 }, { 'a', 'b', 'c', 'd' }, 1.5 }, out;
+	struct_format *sf = struct_compile("!hV2i4sxd");
+	unsigned char mask[1];
+	uint64_t V = 0;
+	int32_t i = 0;
+	int len;
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_EQ(sizeof(in), (size_t)struct_format_record_size(sf));
+	len = struct_format_pack_record(sf, buf, &in);
+	EXPECT_EQ(len, struct_format_unpack(sf, buf, NULL, &V, NULL, &i, NULL,
+				NULL));
+	EXPECT_EQ(300U, V);
+	EXPECT_EQ(-8, i);
+
+	memset(&out, 0, sizeof(out));
+	mask[0] = (1 << 1) | (1 << 5);
+	EXPECT_EQ(len, struct_format_unpack_fields(sf, buf, &out, mask));
+	EXPECT_EQ(0, out.h);
+	EXPECT_EQ(300U, out.V);
+	EXPECT_EQ(0, out.i[0]);
+	EXPECT_EQ(0, out.i[1]);
+	EXPECT_EQ(0, out.s[0]);
+	EXPECT_DOUBLE_EQ(1.5, out.d);
+
+	mask[0] = (1 << 3) | (1 << 4);
+	EXPECT_EQ(len, struct_format_unpack_fields(sf, buf, &out, mask));
+	EXPECT_EQ(-8, out.i[1]);
+	EXPECT_EQ(0, memcmp(out.s, "abcd", 4));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, CompiledOffsetValid)
+{
+	struct_format *sf = struct_compile("!hV2i4sxd");
+	int len;
+
+	ASSERT_TRUE(sf != NULL);
+	len = struct_pack(buf, "!hV2i4sxd", 1, (uint64_t)300, 2, 3, "abcd",
+			4.0);
+	EXPECT_EQ(0, struct_format_offset(sf, buf, 0));
+	EXPECT_EQ(2, struct_format_offset(sf, buf, 1));
+	EXPECT_EQ(4, struct_format_offset(sf, buf, 2));
+	EXPECT_EQ(8, struct_format_offset(sf, buf, 3));
+	EXPECT_EQ(12, struct_format_offset(sf, buf, 4));
+	EXPECT_EQ(17, struct_format_offset(sf, buf, 5));
+	EXPECT_EQ(len - 8, struct_format_offset(sf, buf, 5));
+	EXPECT_EQ(-1, struct_format_offset(sf, buf, 6));
+	EXPECT_EQ(-1, struct_format_offset(sf, buf, -1));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, UnterminatedVarintSkipsTenBytesValid)
+{
+	struct_format *sf = struct_compile("<VVB");
+	unsigned char in[32];
+	uint64_t a = 0, b = 0;
+	uint8_t c = 0;
+
+	ASSERT_TRUE(sf != NULL);
+	/* varints which never end are read as 10 bytes by every path */
+	memset(in, 0x80, sizeof(in));
+	in[20] = 5;
+	EXPECT_EQ(21, struct_unpack(in, "<VVB", &a, &b, &c));
+	EXPECT_EQ(5, c);
+	c = 0;
+	EXPECT_EQ(21, struct_unpack(in, "<VVB", NULL, NULL, &c));
+	EXPECT_EQ(5, c);
+	c = 0;
+	EXPECT_EQ(21, struct_format_unpack(sf, in, NULL, NULL, &c));
+	EXPECT_EQ(5, c);
+	EXPECT_EQ(10, struct_format_offset(sf, in, 1));
+	EXPECT_EQ(20, struct_format_offset(sf, in, 2));
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, ValidateValid)
+{
+	int len;
+	int n;
+
+	len = struct_pack(buf, "<h2iV4sv", 1, 2, 3, (uint64_t)1 << 40, "abcd",
+			(int64_t)-3);
+	EXPECT_EQ(len, struct_validate("<h2iV4sv", buf, len));
+	EXPECT_EQ(len, struct_validate("<h2iV4sv", buf, sizeof(buf)));
+	for (n = 0; n < len; n++) {
+		EXPECT_EQ(-1, struct_validate("<h2iV4sv", buf, n)) << n;
+	}
+	EXPECT_EQ(-1, struct_validate("<h2iy", buf, len));
+
+	/* varints ending at every position, and not within 10 bytes */
+	for (n = 1; n <= 10; n++) {
+		memset(buf, 0x80, 16);
+		buf[n - 1] = 0x01;
+		EXPECT_EQ(n + 1, struct_validate("Vb", buf, 16)) << n;
+		EXPECT_EQ(n, struct_validate("V", buf, n)) << n;
+		EXPECT_EQ(-1, struct_validate("V", buf, n - 1)) << n;
+	}
+	memset(buf, 0x80, 16);
+	EXPECT_EQ(-1, struct_validate("V", buf, 16));
+
+	/* absent optional fields take no space */
+	len = struct_pack(buf, "!I?16s?V", 7, 0, "", 1, (uint64_t)300);
+	EXPECT_EQ(1 + 4 + 2, len);
+	EXPECT_EQ(len, struct_validate("!I?16s?V", buf, len));
+	EXPECT_EQ(-1, struct_validate("!I?16s?V", buf, len - 1));
+	buf[0] = 0x03;
+	EXPECT_EQ(-1, struct_validate("!I?16s?V", buf, len));
+}
+
+TEST_F(Struct, CompiledValidateValid)
+{
+	struct_format *sf = struct_compile("!hV");
+	struct_format *fixed = struct_compile("!hI");
+	long len = 0;
+	int i;
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_TRUE(fixed != NULL);
+	for (i = 0; i < 100; i++) {
+		len += struct_format_pack(sf, buf + len, i, (uint64_t)i << (i % 60));
+	}
+	EXPECT_EQ(len, struct_format_validate(sf, buf, len, 100));
+	EXPECT_EQ(-1, struct_format_validate(sf, buf, len - 1, 100));
+	EXPECT_EQ(0, struct_format_validate(sf, buf, 0, 0));
+	EXPECT_EQ(-1, struct_format_validate(sf, buf, len, 101));
+
+	EXPECT_EQ(60, struct_format_validate(fixed, buf, 60, 10));
+	EXPECT_EQ(60, struct_format_validate(fixed, buf, 65, 10));
+	EXPECT_EQ(-1, struct_format_validate(fixed, buf, 59, 10));
+	EXPECT_EQ(-1, struct_format_validate(fixed, buf, 60, -1));
+	struct_format_free(fixed);
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, CalcsizeValuesValid)
+{
+	uint64_t V;
+	int64_t v;
+	int i;
+
+	EXPECT_EQ(4 + 1 + 3 + 2, struct_calcsize_values("<iV3sv", 1,
+				(uint64_t)5, "abc", (int64_t)-65));
+	for (i = 0; i < 64; i++) {
+		V = (uint64_t)1 << i;
+		v = (i % 2) ? -(int64_t)(V >> 1) : (int64_t)(V >> 1);
+		EXPECT_EQ(struct_pack(buf, "!hVxv", 1, V, v),
+				struct_calcsize_values("!hVxv", 1, V, v)) << i;
+		EXPECT_EQ(struct_pack(buf, "!2V", V - 1, V),
+				struct_calcsize_values("!2V", V - 1, V)) << i;
+	}
+	EXPECT_EQ(10, struct_calcsize_values("V", ~(uint64_t)0));
+	EXPECT_EQ(1, struct_calcsize_values("V", (uint64_t)0));
+
+	/* absent optional fields are not counted */
+	EXPECT_EQ(struct_pack(buf, "!I?16s?V", 7, 0, "", 1, (uint64_t)300),
+			struct_calcsize_values("!I?16s?V", 7, 0, "", 1, (uint64_t)300));
+	EXPECT_EQ(-1, struct_calcsize_values("iy", 1));
+}
+
+TEST_F(Struct, CompiledCalcsizeValuesValid)
+{
+	struct rec {
+		int16_t h;
+		uint64_t V;
+		char s[4];
+		int64_t v;
+	} recs[3] = {
+		{ 1, 0, { 'a' }, 0 },
+		{ 2, 300, { 'b' }, -65 },
+		{ 3, ~(uint64_t)0, { 'c' }, INT64_MIN },
+	};
+	struct_format *sf = struct_compile("!hV4sv");
+	struct_format *fixed = struct_compile("!hI");
+	long total = 0;
+	int i;
+
+	ASSERT_TRUE(sf != NULL);
+	ASSERT_TRUE(fixed != NULL);
+	ASSERT_EQ(sizeof(recs[0]), (size_t)struct_format_record_size(sf));
+	for (i = 0; i < 3; i++) {
+		EXPECT_EQ(struct_format_pack_record(sf, buf, &recs[i]),
+				struct_format_calcsize_values(sf, recs[i].h, recs[i].V,
+					recs[i].s, recs[i].v));
+		total += struct_format_calcsize_record(sf, &recs[i]);
+	}
+	EXPECT_EQ(2 + 1 + 4 + 1, struct_format_calcsize_values(sf, 1,
+				(uint64_t)0, "abcd", (int64_t)0));
+	EXPECT_EQ(total, struct_format_calcsize_records(sf, recs, 3));
+	EXPECT_EQ(0, struct_format_calcsize_records(sf, recs, 0));
+	EXPECT_EQ(6, struct_format_calcsize_values(fixed, 1, 2));
+	EXPECT_EQ(60, struct_format_calcsize_records(fixed, NULL, 10));
+	struct_format_free(fixed);
+	struct_format_free(sf);
+}
+
+TEST_F(Struct, PackCheckedValid)
+{
+	unsigned char other[64];
+	int len;
+	int n;
+
+	len = struct_pack(other, "<h2iV4sv", 1, 2, 3, (uint64_t)1 << 40,
+			"abcd", (int64_t)-300);
+	EXPECT_EQ(len, struct_pack_checked(buf, len, "<h2iV4sv", 1, 2, 3,
+				(uint64_t)1 << 40, "abcd", (int64_t)-300));
+	EXPECT_EQ(0, memcmp(buf, other, len));
+	for (n = 0; n < len; n++) {
+		memset(buf, 0xAA, sizeof(buf));
+		EXPECT_EQ(len, struct_pack_checked(buf, n, "<h2iV4sv", 1, 2, 3,
+					(uint64_t)1 << 40, "abcd", (int64_t)-300)) << n;
+		EXPECT_EQ(0xAA, buf[n]) << n;
+	}
+
+	/* sizes count from buf */
+	EXPECT_EQ(4 + 6, struct_pack_into_checked(4, buf, 10, "!hI", 1, 2U));
+	EXPECT_EQ(4 + 6, struct_pack_into_checked(4, buf, 9, "!hI", 1, 2U));
+	EXPECT_EQ(-1, struct_pack_into_checked(4, buf, 2, "!hI", 1, 2U));
+
+	/* optional fields */
+	EXPECT_EQ(1 + 4 + 2, struct_pack_checked(buf, 7, "!I?16s?V", 7, 0, "",
+				1, (uint64_t)300));
+	EXPECT_EQ(1 + 4 + 2, struct_pack_checked(buf, 6, "!I?16s?V", 7, 0, "",
+				1, (uint64_t)300));
+	EXPECT_EQ(1 + 4 + 2, struct_pack_checked(buf, 0, "!I?16s?V", 7, 0, "",
+				1, (uint64_t)300));
+	EXPECT_EQ(-1, struct_pack_checked(buf, 1, "iy", 1, 2));
+}
+
+TEST_F(Struct, UnpackCheckedValid)
+{
+	int16_t h = 0;
+	int32_t i[2] = {0, 0};
+	uint64_t V = 0;
+	char s[4];
+	int64_t v = 0;
+	int len;
+	int n;
+
+	len = struct_pack(buf, "<h2iV4sv", 1, 2, 3, (uint64_t)1 << 40, "abcd",
+			(int64_t)-300);
+	EXPECT_EQ(len, struct_unpack_checked(buf, len, "<h2iV4sv", &h, &i[0],
+				&i[1], &V, s, &v));
+	EXPECT_EQ(1, h);
+	EXPECT_EQ(3, i[1]);
+	EXPECT_EQ((uint64_t)1 << 40, V);
+	EXPECT_EQ(0, memcmp(s, "abcd", 4));
+	EXPECT_EQ(-300, v);
+
+	/* the length up to the end of the first field cut short */
+	EXPECT_EQ(2, struct_unpack_checked(buf, 0, "<h2iV4sv", &h, &i[0],
+				&i[1], &V, s, &v));
+	EXPECT_EQ(2 + 8, struct_unpack_checked(buf, 5, "<h2iV4sv", &h, &i[0],
+				&i[1], &V, s, &v));
+	EXPECT_EQ(11, struct_unpack_checked(buf, 10, "<h2iV4sv", &h, &i[0],
+				&i[1], &V, s, &v));
+	EXPECT_EQ(12, struct_unpack_checked(buf, 11, "<h2iV4sv", &h, &i[0],
+				&i[1], &V, s, &v));
+	for (n = 0; n < len; n++) {
+		EXPECT_LT(n, struct_unpack_checked(buf, n, "<h2iV4sv", &h, &i[0],
+					&i[1], &V, s, &v)) << n;
+	}
+	memmove(buf + 4, buf, len);
+	EXPECT_EQ(4 + len, struct_unpack_from_checked(4, buf, 4 + len,
+				"<h2iV4sv", &h, &i[0], &i[1], &V, s, &v));
+	EXPECT_EQ(4 + 2, struct_unpack_from_checked(4, buf, 4,
+				"<h2iV4sv", &h, &i[0], &i[1], &V, s, &v));
+
+	/* a varint which does not end within 10 bytes, or is cut short */
+	memset(buf, 0x80, 16);
+	EXPECT_EQ(-1, struct_unpack_checked(buf, 16, "V", &V));
+	EXPECT_EQ(10, struct_unpack_checked(buf, 9, "V", &V));
+	EXPECT_EQ(4 + 10, struct_unpack_checked(buf, 4 + 9, "<iV", &i[0], &V));
+
+	/* a negative size does not turn the checks off */
+	EXPECT_EQ(-1, struct_unpack_checked(buf, -1, "V", &V));
+	EXPECT_EQ(-1, struct_unpack_from_checked(0, buf, -1, "V", &V));
+	EXPECT_EQ(-1, struct_unpack_from_checked(8, buf, 4, "V", &V));
+	EXPECT_EQ(-1, struct_unpack_from_checked(-1, buf, 4, "b", &h));
+}
+
+TEST_F(Struct, CheckedNegativeSizeInvalid)
+{
+	EXPECT_EQ(-1, struct_pack_checked(buf, -1, "!I", 1U));
+	EXPECT_EQ(-1, struct_pack_into_checked(0, buf, -1, "!I", 1U));
+	EXPECT_EQ(-1, struct_pack_into_checked(8, buf, 4, "!I", 1U));
+	EXPECT_EQ(-1, struct_pack_into_checked(-1, buf, 4, "!H", 1));
+	EXPECT_EQ(8, struct_pack_into_checked(4, buf, 4, "!I", 1U));
+}
+
 } // namespace
 
 int main(int argc, char *argv[])
@@ -0,0 +1,200 @@
+/*
+ * struct_writer_test.cpp
+ *
+ * double-buffered asynchronous writer
+ */
+
+#include "struct_writer.h"
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+class StructWriter:public ::testing::Test {
+protected:
+  StructWriter() : fd(-1) {}
+  virtual ~StructWriter() {}
+
+  virtual void SetUp()
+  {
+    char path[] = "/tmp/struct_writer_testXXXXXX";
+
+    fd = mkstemp(path);
+    ASSERT_LE(0, fd);
+    unlink(path);
+  }
+
+  virtual void TearDown()
+  {
+    close(fd);
+  }
+
+  std::vector<unsigned char> contents()
+  {
+    std::vector<unsigned char> v(lseek(fd, 0, SEEK_END));
+    if (!v.empty()) {
+      EXPECT_EQ((ssize_t)v.size(), pread(fd, &v[0], v.size(), 0));
+    }
+    return v;
+  }
+
+  int fd;
+};
+
+struct Record {
+	uint32_t seq;
+	uint64_t val;
+};
+
+TEST_F(StructWriter, PackCloseValid)
+{
+	struct_writer *w = struct_writer_new(fd, 64, 0, STRUCT_WRITER_BLOCK);
+	struct_format *sf = struct_compile("!IV");
+	Record rec;
+	uint32_t seq;
+	uint64_t val;
+	int off = 0;
+	uint32_t i;
+
+	ASSERT_TRUE(w != NULL);
+	ASSERT_TRUE(sf != NULL);
+	for (i = 0; i < 1000; i++) {
+		if (i % 2 == 0) {
+			EXPECT_LT(0, struct_writer_pack(w, "!IV", i, (uint64_t)i * i));
+		} else {
+			rec.seq = i;
+			rec.val = (uint64_t)i * i;
+			EXPECT_LT(0, struct_writer_pack_record(w, sf, &rec));
+		}
+	}
+	EXPECT_EQ(0, struct_writer_close(w));
+
+	std::vector<unsigned char> v = contents();
+	for (i = 0; i < 1000; i++) {
+		ASSERT_LT(off, (int)v.size());
+		off = struct_unpack_from(off, &v[0], "!IV", &seq, &val);
+		EXPECT_EQ(i, seq);
+		EXPECT_EQ((uint64_t)i * i, val);
+	}
+	EXPECT_EQ((int)v.size(), off);
+	struct_format_free(sf);
+}
+
+TEST_F(StructWriter, FlushValid)
+{
+	struct_writer *w = struct_writer_new(fd, 4096, 0, STRUCT_WRITER_BLOCK);
+	int32_t o = 0;
+
+	ASSERT_TRUE(w != NULL);
+	EXPECT_EQ(4, struct_writer_pack(w, "<i", 0x12345678));
+	EXPECT_EQ(0u, contents().size());
+	EXPECT_EQ(0, struct_writer_flush(w));
+
+	std::vector<unsigned char> v = contents();
+	ASSERT_EQ(4u, v.size());
+	struct_unpack(&v[0], "<i", &o);
+	EXPECT_EQ(0x12345678, o);
+	EXPECT_EQ(0, struct_writer_close(w));
+}
+
+TEST_F(StructWriter, TimeThresholdValid)
+{
+	struct_writer *w = struct_writer_new(fd, 4096, 10, STRUCT_WRITER_BLOCK);
+
+	ASSERT_TRUE(w != NULL);
+	EXPECT_EQ(4, struct_writer_pack(w, "<i", 1));
+	usleep(50000);
+	EXPECT_EQ(4, struct_writer_pack(w, "<i", 2));
+	usleep(50000);
+	EXPECT_LE(4u, contents().size());
+	EXPECT_EQ(0, struct_writer_close(w));
+	EXPECT_EQ(8u, contents().size());
+}
+
+TEST_F(StructWriter, ExactSizeVarintRecords)
+{
+	/* "!IV" may take 14 bytes, but these records take 5 and 10 */
+	struct_writer *w = struct_writer_new(fd, 10, 0, STRUCT_WRITER_BLOCK);
+	uint32_t seq;
+	uint64_t val;
+	int off = 0;
+	uint32_t i;
+
+	ASSERT_TRUE(w != NULL);
+	for (i = 0; i < 100; i++) {
+		EXPECT_EQ((i % 3 == 0) ? 10 : 5, struct_writer_pack(w, "!IV", i,
+					(uint64_t)((i % 3 == 0) ? 1ULL << 40 : i)));
+	}
+	EXPECT_EQ(-1, struct_writer_pack(w, "!IIV", 1, 2, (uint64_t)1 << 40));
+	EXPECT_EQ(0, struct_writer_close(w));
+
+	std::vector<unsigned char> v = contents();
+	for (i = 0; i < 100; i++) {
+		ASSERT_LT(off, (int)v.size());
+		off = struct_unpack_from(off, &v[0], "!IV", &seq, &val);
+		EXPECT_EQ(i, seq);
+		EXPECT_EQ((uint64_t)((i % 3 == 0) ? 1ULL << 40 : i), val);
+	}
+	EXPECT_EQ((int)v.size(), off);
+}
+
+TEST_F(StructWriter, RecordTooLarge)
+{
+	struct_writer *w = struct_writer_new(fd, 4, 0, STRUCT_WRITER_BLOCK);
+
+	ASSERT_TRUE(w != NULL);
+	EXPECT_EQ(-1, struct_writer_pack(w, "q", (int64_t)1));
+	EXPECT_EQ(-1, struct_writer_pack(w, "y"));
+	EXPECT_EQ(0, struct_writer_close(w));
+}
+
+TEST_F(StructWriter, DropWhenBlocked)
+{
+	int fds[2];
+	std::vector<unsigned char> v;
+	struct_writer *w;
+	uint64_t val;
+	long dropped;
+	int off = 0;
+	int i;
+
+	ASSERT_EQ(0, pipe(fds));
+	w = struct_writer_new(fds[1], 4096, 0, STRUCT_WRITER_DROP);
+	ASSERT_TRUE(w != NULL);
+
+	/* nobody reads the pipe, so the thread blocks once it is full. */
+	for (i = 0; i < 100000; i++) {
+		EXPECT_LE(0, struct_writer_pack(w, "<Q", (uint64_t)i));
+	}
+	dropped = struct_writer_dropped(w);
+	EXPECT_LT(0, dropped);
+
+	std::thread reader([&]() {
+		unsigned char chunk[4096];
+		ssize_t n;
+		while ((n = read(fds[0], chunk, sizeof(chunk))) > 0) {
+			v.insert(v.end(), chunk, chunk + n);
+		}
+	});
+	EXPECT_EQ(0, struct_writer_close(w));
+	close(fds[1]);
+	reader.join();
+	close(fds[0]);
+
+	/* whole records, in order, with gaps. */
+	EXPECT_EQ(0u, v.size() % 8);
+	EXPECT_EQ(100000, (long)v.size() / 8 + dropped);
+	for (i = -1; off < (int)v.size(); i = (int)val) {
+		off = struct_unpack_from(off, &v[0], "<Q", &val);
+		EXPECT_LT(i, (int)val);
+	}
+}
+
+} // namespace